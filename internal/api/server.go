@@ -2,6 +2,7 @@ package api
 
 import (
 	"context"
+	"encoding/json"
 	"fmt"
 	"net/http"
 	"strconv"
@@ -62,6 +63,7 @@ func (s *Server) SetupRoutes(rg *gin.RouterGroup) {
 		nodes.GET("", s.listNodes)
 		nodes.GET("/:id", s.getNode)
 		nodes.GET("/:id/status", s.getNodeStatus)
+		nodes.POST("/:id/events", s.ingestNodeEvents)
 	}
 
 	// Blacklist management
@@ -135,15 +137,19 @@ func (s *Server) createEndpoint(c *gin.Context) {
 
 	// Create endpoint
 	endpoint := &storage.ProtectedEndpoint{
-		OrganizationID:  orgID,
-		Name:            req.Name,
-		OriginIP:        req.OriginIP,
-		OriginPort:      req.OriginPort,
-		Protocol:        req.Protocol,
-		RateLimit:       req.RateLimit,
-		BurstLimit:      req.BurstLimit,
-		MaintenanceMode: req.MaintenanceMode,
-		Active:          true,
+		OrganizationID:         orgID,
+		Name:                   req.Name,
+		OriginIP:               req.OriginIP,
+		OriginPort:             req.OriginPort,
+		Protocol:               req.Protocol,
+		RateLimit:              req.RateLimit,
+		BurstLimit:             req.BurstLimit,
+		ByteRateLimit:          req.ByteRateLimit,
+		ByteBurstLimit:         req.ByteBurstLimit,
+		EndpointByteRateLimit:  req.EndpointByteRateLimit,
+		EndpointByteBurstLimit: req.EndpointByteBurstLimit,
+		MaintenanceMode:        req.MaintenanceMode,
+		Active:                 true,
 	}
 
 	// Set default values
@@ -189,19 +195,23 @@ func (s *Server) createEndpoint(c *gin.Context) {
 
 	// Return response
 	response := &storage.EndpointResponse{
-		ID:              endpoint.ID,
-		Name:            endpoint.Name,
-		FrontIP:         endpoint.FrontIP,
-		FrontPort:       endpoint.FrontPort,
-		OriginIP:        endpoint.OriginIP,
-		OriginPort:      endpoint.OriginPort,
-		Protocol:        endpoint.Protocol,
-		RateLimit:       endpoint.RateLimit,
-		BurstLimit:      endpoint.BurstLimit,
-		MaintenanceMode: endpoint.MaintenanceMode,
-		Active:          endpoint.Active,
-		CreatedAt:       endpoint.CreatedAt,
-		UpdatedAt:       endpoint.UpdatedAt,
+		ID:                     endpoint.ID,
+		Name:                   endpoint.Name,
+		FrontIP:                endpoint.FrontIP,
+		FrontPort:              endpoint.FrontPort,
+		OriginIP:               endpoint.OriginIP,
+		OriginPort:             endpoint.OriginPort,
+		Protocol:               endpoint.Protocol,
+		RateLimit:              endpoint.RateLimit,
+		BurstLimit:             endpoint.BurstLimit,
+		ByteRateLimit:          endpoint.ByteRateLimit,
+		ByteBurstLimit:         endpoint.ByteBurstLimit,
+		EndpointByteRateLimit:  endpoint.EndpointByteRateLimit,
+		EndpointByteBurstLimit: endpoint.EndpointByteBurstLimit,
+		MaintenanceMode:        endpoint.MaintenanceMode,
+		Active:                 endpoint.Active,
+		CreatedAt:              endpoint.CreatedAt,
+		UpdatedAt:              endpoint.UpdatedAt,
 	}
 
 	c.JSON(http.StatusCreated, response)
@@ -222,19 +232,23 @@ func (s *Server) listEndpoints(c *gin.Context) {
 	responses := make([]*storage.EndpointResponse, len(endpoints))
 	for i, endpoint := range endpoints {
 		responses[i] = &storage.EndpointResponse{
-			ID:              endpoint.ID,
-			Name:            endpoint.Name,
-			FrontIP:         endpoint.FrontIP,
-			FrontPort:       endpoint.FrontPort,
-			OriginIP:        endpoint.OriginIP,
-			OriginPort:      endpoint.OriginPort,
-			Protocol:        endpoint.Protocol,
-			RateLimit:       endpoint.RateLimit,
-			BurstLimit:      endpoint.BurstLimit,
-			MaintenanceMode: endpoint.MaintenanceMode,
-			Active:          endpoint.Active,
-			CreatedAt:       endpoint.CreatedAt,
-			UpdatedAt:       endpoint.UpdatedAt,
+			ID:                     endpoint.ID,
+			Name:                   endpoint.Name,
+			FrontIP:                endpoint.FrontIP,
+			FrontPort:              endpoint.FrontPort,
+			OriginIP:               endpoint.OriginIP,
+			OriginPort:             endpoint.OriginPort,
+			Protocol:               endpoint.Protocol,
+			RateLimit:              endpoint.RateLimit,
+			BurstLimit:             endpoint.BurstLimit,
+			ByteRateLimit:          endpoint.ByteRateLimit,
+			ByteBurstLimit:         endpoint.ByteBurstLimit,
+			EndpointByteRateLimit:  endpoint.EndpointByteRateLimit,
+			EndpointByteBurstLimit: endpoint.EndpointByteBurstLimit,
+			MaintenanceMode:        endpoint.MaintenanceMode,
+			Active:                 endpoint.Active,
+			CreatedAt:              endpoint.CreatedAt,
+			UpdatedAt:              endpoint.UpdatedAt,
 		}
 	}
 
@@ -259,19 +273,23 @@ func (s *Server) getEndpoint(c *gin.Context) {
 	}
 
 	response := &storage.EndpointResponse{
-		ID:              endpoint.ID,
-		Name:            endpoint.Name,
-		FrontIP:         endpoint.FrontIP,
-		FrontPort:       endpoint.FrontPort,
-		OriginIP:        endpoint.OriginIP,
-		OriginPort:      endpoint.OriginPort,
-		Protocol:        endpoint.Protocol,
-		RateLimit:       endpoint.RateLimit,
-		BurstLimit:      endpoint.BurstLimit,
-		MaintenanceMode: endpoint.MaintenanceMode,
-		Active:          endpoint.Active,
-		CreatedAt:       endpoint.CreatedAt,
-		UpdatedAt:       endpoint.UpdatedAt,
+		ID:                     endpoint.ID,
+		Name:                   endpoint.Name,
+		FrontIP:                endpoint.FrontIP,
+		FrontPort:              endpoint.FrontPort,
+		OriginIP:               endpoint.OriginIP,
+		OriginPort:             endpoint.OriginPort,
+		Protocol:               endpoint.Protocol,
+		RateLimit:              endpoint.RateLimit,
+		BurstLimit:             endpoint.BurstLimit,
+		ByteRateLimit:          endpoint.ByteRateLimit,
+		ByteBurstLimit:         endpoint.ByteBurstLimit,
+		EndpointByteRateLimit:  endpoint.EndpointByteRateLimit,
+		EndpointByteBurstLimit: endpoint.EndpointByteBurstLimit,
+		MaintenanceMode:        endpoint.MaintenanceMode,
+		Active:                 endpoint.Active,
+		CreatedAt:              endpoint.CreatedAt,
+		UpdatedAt:              endpoint.UpdatedAt,
 	}
 
 	c.JSON(http.StatusOK, response)
@@ -311,6 +329,18 @@ func (s *Server) updateEndpoint(c *gin.Context) {
 	if req.BurstLimit != nil {
 		endpoint.BurstLimit = *req.BurstLimit
 	}
+	if req.ByteRateLimit != nil {
+		endpoint.ByteRateLimit = *req.ByteRateLimit
+	}
+	if req.ByteBurstLimit != nil {
+		endpoint.ByteBurstLimit = *req.ByteBurstLimit
+	}
+	if req.EndpointByteRateLimit != nil {
+		endpoint.EndpointByteRateLimit = *req.EndpointByteRateLimit
+	}
+	if req.EndpointByteBurstLimit != nil {
+		endpoint.EndpointByteBurstLimit = *req.EndpointByteBurstLimit
+	}
 	if req.MaintenanceMode != nil {
 		endpoint.MaintenanceMode = *req.MaintenanceMode
 	}
@@ -349,19 +379,23 @@ func (s *Server) updateEndpoint(c *gin.Context) {
 	s.store.LogAuditEvent(c.Request.Context(), auditLog)
 
 	response := &storage.EndpointResponse{
-		ID:              endpoint.ID,
-		Name:            endpoint.Name,
-		FrontIP:         endpoint.FrontIP,
-		FrontPort:       endpoint.FrontPort,
-		OriginIP:        endpoint.OriginIP,
-		OriginPort:      endpoint.OriginPort,
-		Protocol:        endpoint.Protocol,
-		RateLimit:       endpoint.RateLimit,
-		BurstLimit:      endpoint.BurstLimit,
-		MaintenanceMode: endpoint.MaintenanceMode,
-		Active:          endpoint.Active,
-		CreatedAt:       endpoint.CreatedAt,
-		UpdatedAt:       endpoint.UpdatedAt,
+		ID:                     endpoint.ID,
+		Name:                   endpoint.Name,
+		FrontIP:                endpoint.FrontIP,
+		FrontPort:              endpoint.FrontPort,
+		OriginIP:               endpoint.OriginIP,
+		OriginPort:             endpoint.OriginPort,
+		Protocol:               endpoint.Protocol,
+		RateLimit:              endpoint.RateLimit,
+		BurstLimit:             endpoint.BurstLimit,
+		ByteRateLimit:          endpoint.ByteRateLimit,
+		ByteBurstLimit:         endpoint.ByteBurstLimit,
+		EndpointByteRateLimit:  endpoint.EndpointByteRateLimit,
+		EndpointByteBurstLimit: endpoint.EndpointByteBurstLimit,
+		MaintenanceMode:        endpoint.MaintenanceMode,
+		Active:                 endpoint.Active,
+		CreatedAt:              endpoint.CreatedAt,
+		UpdatedAt:              endpoint.UpdatedAt,
 	}
 
 	c.JSON(http.StatusOK, response)
@@ -438,23 +472,34 @@ func (s *Server) getEndpointMetrics(c *gin.Context) {
 		return
 	}
 
-	// Convert to response format
-	responses := make([]*storage.MetricsResponse, len(metrics))
-	for i, metric := range metrics {
-		responses[i] = &storage.MetricsResponse{
-			EndpointID:            metric.EndpointID,
-			Timestamp:             metric.Timestamp,
-			AllowedPackets:        int64(metric.Value), // Using Value field for now
-			BlockedRateLimit:      0, // These would need to be separate metrics
-			BlockedBlacklist:      0,
-			BlockedInvalidProto:   0,
-			BlockedChallenge:      0,
-			BlockedMaintenance:    0,
-			TotalPackets:          int64(metric.Value),
-			UDPChallengesSent:     0,
-			UDPChallengesPassed:   0,
-			TopAttackers:          []string{}, // Parse from JSON if needed
+	// Convert to response format. Dataplane rows carry the node's per-endpoint
+	// counters for one flush interval; blacklist drops happen before the
+	// endpoint is known and are not broken out per endpoint.
+	responses := make([]*storage.MetricsResponse, 0, len(metrics))
+	for _, metric := range metrics {
+		var counters storage.NodeEndpointCounters
+		if metric.Type != "dataplane" || json.Unmarshal([]byte(metric.Labels), &counters) != nil {
+			continue
 		}
+
+		var dropped uint64
+		for _, n := range counters.Dropped {
+			dropped += n
+		}
+		responses = append(responses, &storage.MetricsResponse{
+			EndpointID:          metric.EndpointID,
+			Timestamp:           metric.Timestamp,
+			AllowedPackets:      int64(counters.AllowedPackets),
+			BlockedRateLimit:    int64(counters.Dropped["rate_limit"]),
+			BlockedInvalidProto: int64(counters.Dropped["invalid_protocol"]),
+			BlockedChallenge:    int64(counters.Dropped["challenge_failed"] + counters.Dropped["syncookie_failed"]),
+			BlockedMaintenance:  int64(counters.Dropped["maintenance"]),
+			BlockedAttack:       int64(counters.Dropped["attack_new_flows"]),
+			TotalPackets:        int64(counters.AllowedPackets + dropped),
+			AllowedBytes:        int64(counters.AllowedBytes),
+			DroppedBytes:        int64(counters.DroppedBytes),
+			TopAttackers:        []string{},
+		})
 	}
 
 	c.JSON(http.StatusOK, gin.H{"metrics": responses})
@@ -626,6 +671,70 @@ func (s *Server) getNodeStatus(c *gin.Context) {
 	})
 }
 
+// ingestNodeEvents records a batch of sampled dataplane drops from a node's loader
+func (s *Server) ingestNodeEvents(c *gin.Context) {
+	nodeID := c.Param("id")
+
+	var req storage.NodeEventsRequest
+	if err := c.ShouldBindJSON(&req); err != nil {
+		c.JSON(http.StatusBadRequest, gin.H{"error": err.Error()})
+		return
+	}
+
+	// The dataplane only knows front addresses; map them to endpoint IDs
+	endpoints, err := s.store.GetAllActiveEndpoints(c.Request.Context())
+	if err != nil {
+		s.monitor.LogError("Failed to get endpoints", zap.Error(err))
+		c.JSON(http.StatusInternalServerError, gin.H{"error": "Failed to get endpoints"})
+		return
+	}
+	endpointIDs := make(map[string]string, len(endpoints))
+	for _, endpoint := range endpoints {
+		endpointIDs[fmt.Sprintf("%s:%d", endpoint.FrontIP, endpoint.FrontPort)] = endpoint.ID
+	}
+
+	for _, endpoint := range req.Endpoints {
+		endpointID, ok := endpointIDs[fmt.Sprintf("%s:%d", endpoint.FrontIP, endpoint.FrontPort)]
+		if !ok {
+			continue
+		}
+		labels, err := json.Marshal(endpoint)
+		if err != nil {
+			continue
+		}
+		metric := &storage.Metric{
+			EndpointID: endpointID,
+			NodeID:     nodeID,
+			Type:       "dataplane",
+			Value:      float64(endpoint.AllowedPackets),
+			Labels:     string(labels),
+		}
+		if err := s.store.StoreMetrics(c.Request.Context(), metric); err != nil {
+			s.monitor.LogError("Failed to store endpoint metrics", zap.Error(err))
+		}
+	}
+
+	for _, event := range req.Events {
+		endpointID := endpointIDs[fmt.Sprintf("%s:%d", event.FrontIP, event.FrontPort)]
+		count := float64(event.Count)
+
+		s.monitor.RecordPacketBlocked(endpointID, event.Reason, count)
+		switch event.Reason {
+		case "rate_limit":
+			s.monitor.RecordRateLimitHit(endpointID, event.SourceIP, count)
+		case "blacklist":
+			s.monitor.RecordBlacklistHit(endpointID, event.SourceIP, count)
+		case "challenge_failed", "syncookie_failed":
+			s.monitor.RecordChallengeHit(endpointID, event.SourceIP, count)
+		}
+	}
+	if req.Lost > 0 {
+		s.monitor.RecordDataplaneEventsLost(nodeID, float64(req.Lost))
+	}
+
+	c.JSON(http.StatusOK, gin.H{"accepted": len(req.Events)})
+}
+
 // addToBlacklist adds an IP to the global blacklist
 func (s *Server) addToBlacklist(c *gin.Context) {
 	var req struct {
@@ -652,6 +761,10 @@ func (s *Server) addToBlacklist(c *gin.Context) {
 		return
 	}
 
+	if err := s.nodeManager.AddBlacklist(c.Request.Context(), entry); err != nil {
+		s.monitor.LogError("Failed to add IP to node blacklists", zap.Error(err))
+	}
+
 	c.JSON(http.StatusCreated, gin.H{"message": "IP added to blacklist"})
 }
 
@@ -665,6 +778,10 @@ func (s *Server) removeFromBlacklist(c *gin.Context) {
 		return
 	}
 
+	if err := s.nodeManager.RemoveBlacklist(c.Request.Context(), ip); err != nil {
+		s.monitor.LogError("Failed to remove IP from node blacklists", zap.Error(err))
+	}
+
 	c.JSON(http.StatusOK, gin.H{"message": "IP removed from blacklist"})
 }
 
@@ -54,6 +54,7 @@ type NodeConfig struct {
 	NodeTimeout       time.Duration `yaml:"node_timeout"`
 	RetryAttempts     int           `yaml:"retry_attempts"`
 	RetryDelay        time.Duration `yaml:"retry_delay"`
+	SyncParallelism   int           `yaml:"sync_parallelism"` // nodes synced at once
 }
 
 // ProxyConfig represents proxy configuration
@@ -67,6 +68,7 @@ type ProxyConfig struct {
 	EnableAFXDP       bool          `yaml:"enable_af_xdp"`
 	XDPInterface      string        `yaml:"xdp_interface"`
 	XDPQueueID        int           `yaml:"xdp_queue_id"`
+	XSKSocket         string        `yaml:"xsk_socket"`
 }
 
 // MonitoringConfig represents monitoring configuration
@@ -187,6 +189,9 @@ func (c *Config) setDefaults() {
 	if c.Node.RetryDelay == 0 {
 		c.Node.RetryDelay = 5 * time.Second
 	}
+	if c.Node.SyncParallelism == 0 {
+		c.Node.SyncParallelism = 16
+	}
 
 	if c.Proxy.TCPTimeout == 0 {
 		c.Proxy.TCPTimeout = 30 * time.Second
@@ -203,6 +208,9 @@ func (c *Config) setDefaults() {
 	if c.Proxy.XDPInterface == "" {
 		c.Proxy.XDPInterface = "eth0"
 	}
+	if c.Proxy.XSKSocket == "" {
+		c.Proxy.XSKSocket = "/run/cloudnordsp/xsk.sock"
+	}
 
 	if c.Monitoring.MetricsPath == "" {
 		c.Monitoring.MetricsPath = "/metrics"
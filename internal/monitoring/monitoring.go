@@ -31,6 +31,7 @@ type Monitoring struct {
 	challengeHits         *prometheus.CounterVec
 	udpChallengesSent     *prometheus.CounterVec
 	udpChallengesPassed   *prometheus.CounterVec
+	dataplaneEventsLost   *prometheus.CounterVec
 	nodeCPUUsage          *prometheus.GaugeVec
 	nodeMemoryUsage       *prometheus.GaugeVec
 	nodePacketRate        *prometheus.GaugeVec
@@ -185,6 +186,14 @@ func (m *Monitoring) initMetrics() {
 		[]string{"endpoint_id", "source_ip"},
 	)
 
+	m.dataplaneEventsLost = promauto.NewCounterVec(
+		prometheus.CounterOpts{
+			Name: "cloudnordsp_dataplane_events_lost_total",
+			Help: "Total number of sampled dataplane events nodes could not report",
+		},
+		[]string{"node_id"},
+	)
+
 	m.nodeCPUUsage = promauto.NewGaugeVec(
 		prometheus.GaugeOpts{
 			Name: "cloudnordsp_node_cpu_usage_percent",
@@ -248,31 +257,31 @@ func (m *Monitoring) RecordPacketProcessed(endpointID, protocol, action string)
 	}
 }
 
-// RecordPacketBlocked records a blocked packet
-func (m *Monitoring) RecordPacketBlocked(endpointID, reason string) {
+// RecordPacketBlocked records count blocked packets
+func (m *Monitoring) RecordPacketBlocked(endpointID, reason string, count float64) {
 	if m.packetsBlocked != nil {
-		m.packetsBlocked.WithLabelValues(endpointID, reason).Inc()
+		m.packetsBlocked.WithLabelValues(endpointID, reason).Add(count)
 	}
 }
 
-// RecordRateLimitHit records a rate limit hit
-func (m *Monitoring) RecordRateLimitHit(endpointID, sourceIP string) {
+// RecordRateLimitHit records count rate limit hits
+func (m *Monitoring) RecordRateLimitHit(endpointID, sourceIP string, count float64) {
 	if m.rateLimitHits != nil {
-		m.rateLimitHits.WithLabelValues(endpointID, sourceIP).Inc()
+		m.rateLimitHits.WithLabelValues(endpointID, sourceIP).Add(count)
 	}
 }
 
-// RecordBlacklistHit records a blacklist hit
-func (m *Monitoring) RecordBlacklistHit(endpointID, sourceIP string) {
+// RecordBlacklistHit records count blacklist hits
+func (m *Monitoring) RecordBlacklistHit(endpointID, sourceIP string, count float64) {
 	if m.blacklistHits != nil {
-		m.blacklistHits.WithLabelValues(endpointID, sourceIP).Inc()
+		m.blacklistHits.WithLabelValues(endpointID, sourceIP).Add(count)
 	}
 }
 
-// RecordChallengeHit records a challenge hit
-func (m *Monitoring) RecordChallengeHit(endpointID, sourceIP string) {
+// RecordChallengeHit records count challenge hits
+func (m *Monitoring) RecordChallengeHit(endpointID, sourceIP string, count float64) {
 	if m.challengeHits != nil {
-		m.challengeHits.WithLabelValues(endpointID, sourceIP).Inc()
+		m.challengeHits.WithLabelValues(endpointID, sourceIP).Add(count)
 	}
 }
 
@@ -290,6 +299,13 @@ func (m *Monitoring) RecordUDPChallengePassed(endpointID, sourceIP string) {
 	}
 }
 
+// RecordDataplaneEventsLost records sampled events a node could not report
+func (m *Monitoring) RecordDataplaneEventsLost(nodeID string, count float64) {
+	if m.dataplaneEventsLost != nil {
+		m.dataplaneEventsLost.WithLabelValues(nodeID).Add(count)
+	}
+}
+
 // UpdateActiveConnections updates the active connections gauge
 func (m *Monitoring) UpdateActiveConnections(count float64) {
 	if m.activeConnections != nil {
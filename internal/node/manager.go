@@ -1,7 +1,6 @@
 package node
 
 import (
-	"bytes"
 	"context"
 	"encoding/json"
 	"fmt"
@@ -27,6 +26,9 @@ type Manager struct {
 	updateTicker *time.Ticker
 	healthTicker *time.Ticker
 	stopCh       chan struct{}
+
+	desired  *syncState // endpoints and blacklist every node should have
+	syncKick chan struct{}
 }
 
 // Node represents an edge node
@@ -43,6 +45,8 @@ type Node struct {
 	PacketRate  int64     `json:"packet_rate"`
 	Endpoints   []string  `json:"endpoints"`
 	client      *http.Client
+
+	syncedVersion uint64 // dataplane sync version the node acknowledged, 0 = none
 }
 
 // NodeStatus represents the status of a node
@@ -55,12 +59,6 @@ type NodeStatus struct {
 	Endpoints   []string  `json:"endpoints"`
 }
 
-// EndpointUpdate represents an endpoint update for a node
-type EndpointUpdate struct {
-	Action   string                 `json:"action"` // "add", "remove", "update"
-	Endpoint *storage.ProtectedEndpoint `json:"endpoint"`
-}
-
 // NewManager creates a new node manager
 func NewManager(cfg *config.NodeConfig, store storage.Storage, monitor *monitoring.Monitoring) *Manager {
 	return &Manager{
@@ -69,6 +67,9 @@ func NewManager(cfg *config.NodeConfig, store storage.Storage, monitor *monitori
 		monitor: monitor,
 		nodes:   make(map[string]*Node),
 		stopCh:  make(chan struct{}),
+
+		desired:  newSyncState(),
+		syncKick: make(chan struct{}, 1),
 	}
 }
 
@@ -81,6 +82,12 @@ func (m *Manager) Start(ctx context.Context) error {
 		return fmt.Errorf("failed to load nodes: %w", err)
 	}
 
+	// Load the endpoints and blacklist nodes are synced to
+	if err := m.loadSyncState(ctx); err != nil {
+		return fmt.Errorf("failed to load node sync state: %w", err)
+	}
+	go m.syncLoop(ctx)
+
 	// Start update ticker
 	m.updateTicker = time.NewTicker(m.config.UpdateInterval)
 	go m.updateLoop(ctx)
@@ -164,87 +171,42 @@ func (m *Manager) GetAllNodes() []*Node {
 
 // UpdateEndpoint updates an endpoint on all nodes
 func (m *Manager) UpdateEndpoint(ctx context.Context, endpoint *storage.ProtectedEndpoint) error {
-	m.nodesMu.RLock()
-	nodes := make([]*Node, 0, len(m.nodes))
-	for _, node := range m.nodes {
-		if node.Status == "active" {
-			nodes = append(nodes, node)
-		}
-	}
-	m.nodesMu.RUnlock()
-
-	update := &EndpointUpdate{
-		Action:   "update",
-		Endpoint: endpoint,
-	}
-
-	for _, node := range nodes {
-		if err := m.sendEndpointUpdate(ctx, node, update); err != nil {
-			m.monitor.LogError("Failed to update endpoint on node",
-				zap.String("node_id", node.ID),
-				zap.String("endpoint_id", endpoint.ID),
-				zap.Error(err))
-		}
+	if err := m.desired.setEndpoint(endpoint); err != nil {
+		return fmt.Errorf("failed to update endpoint %s: %w", endpoint.ID, err)
 	}
-
+	m.requestSync()
 	return nil
 }
 
 // AddEndpoint adds an endpoint to all nodes
 func (m *Manager) AddEndpoint(ctx context.Context, endpoint *storage.ProtectedEndpoint) error {
-	m.nodesMu.RLock()
-	nodes := make([]*Node, 0, len(m.nodes))
-	for _, node := range m.nodes {
-		if node.Status == "active" {
-			nodes = append(nodes, node)
-		}
-	}
-	m.nodesMu.RUnlock()
-
-	update := &EndpointUpdate{
-		Action:   "add",
-		Endpoint: endpoint,
+	if err := m.desired.setEndpoint(endpoint); err != nil {
+		return fmt.Errorf("failed to add endpoint %s: %w", endpoint.ID, err)
 	}
-
-	for _, node := range nodes {
-		if err := m.sendEndpointUpdate(ctx, node, update); err != nil {
-			m.monitor.LogError("Failed to add endpoint to node",
-				zap.String("node_id", node.ID),
-				zap.String("endpoint_id", endpoint.ID),
-				zap.Error(err))
-		}
-	}
-
+	m.requestSync()
 	return nil
 }
 
 // RemoveEndpoint removes an endpoint from all nodes
 func (m *Manager) RemoveEndpoint(ctx context.Context, endpointID string) error {
-	m.nodesMu.RLock()
-	nodes := make([]*Node, 0, len(m.nodes))
-	for _, node := range m.nodes {
-		if node.Status == "active" {
-			nodes = append(nodes, node)
-		}
-	}
-	m.nodesMu.RUnlock()
-
-	update := &EndpointUpdate{
-		Action: "remove",
-		Endpoint: &storage.ProtectedEndpoint{
-			ID: endpointID,
-		},
-	}
+	m.desired.removeEndpoint(endpointID)
+	m.requestSync()
+	return nil
+}
 
-	for _, node := range nodes {
-		if err := m.sendEndpointUpdate(ctx, node, update); err != nil {
-			m.monitor.LogError("Failed to remove endpoint from node",
-				zap.String("node_id", node.ID),
-				zap.String("endpoint_id", endpointID),
-				zap.Error(err))
-		}
+// AddBlacklist blocks an address or prefix on all nodes
+func (m *Manager) AddBlacklist(ctx context.Context, entry *storage.IPBlacklist) error {
+	if err := m.desired.setBlacklist(entry); err != nil {
+		return err
 	}
+	m.requestSync()
+	return nil
+}
 
+// RemoveBlacklist unblocks an address or prefix on all nodes
+func (m *Manager) RemoveBlacklist(ctx context.Context, ip string) error {
+	m.desired.removeBlacklist(ip)
+	m.requestSync()
 	return nil
 }
 
@@ -413,34 +375,6 @@ func (m *Manager) getNodeStatus(ctx context.Context, node *Node) (*NodeStatus, e
 	return &status, nil
 }
 
-// sendEndpointUpdate sends an endpoint update to a node
-func (m *Manager) sendEndpointUpdate(ctx context.Context, node *Node, update *EndpointUpdate) error {
-	url := fmt.Sprintf("http://%s:%d/api/v1/endpoint", node.IP, node.Port)
-	
-	data, err := json.Marshal(update)
-	if err != nil {
-		return err
-	}
-
-	req, err := http.NewRequestWithContext(ctx, "POST", url, bytes.NewBuffer(data))
-	if err != nil {
-		return err
-	}
-	req.Header.Set("Content-Type", "application/json")
-
-	resp, err := node.client.Do(req)
-	if err != nil {
-		return err
-	}
-	defer resp.Body.Close()
-
-	if resp.StatusCode != http.StatusOK {
-		return fmt.Errorf("endpoint update failed with status %d", resp.StatusCode)
-	}
-
-	return nil
-}
-
 // updateNodeInDatabase updates a node in the database
 func (m *Manager) updateNodeInDatabase(ctx context.Context, node *Node) error {
 	dbNode := &storage.Node{
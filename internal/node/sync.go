@@ -0,0 +1,499 @@
+package node
+
+import (
+	"bytes"
+	"context"
+	"encoding/binary"
+	"fmt"
+	"math"
+	"net"
+	"net/http"
+	"sync"
+	"time"
+
+	"github.com/cloudnordsp/minecraft-protection/internal/storage"
+	"go.uber.org/zap"
+)
+
+// Dataplane sync. The manager holds the endpoints and blacklist every node
+// should have as one versioned table; each change bumps the version and is
+// journaled. A node that acknowledged version v is sent the changes after v
+// as a single delta, or the whole table as a snapshot once the journal no
+// longer reaches back to v. Records use the loader's ctl_endpoint and
+// ctl_blacklist layouts from minecraft_protection.h, so the node agent can
+// hand them to the loader's control socket unchanged.
+
+const (
+	syncMagic    = 0x59534e43 // "CNSY"
+	syncSnapshot = 1
+	syncDelta    = 2
+
+	// Changes kept for deltas; nodes further behind get a snapshot
+	syncJournalMax = 65536
+
+	syncContentType = "application/x-cloudnordsp-sync"
+)
+
+// Record sections of a batch, in the order a node applies them. Snapshots
+// only carry the add sections; the node drops whatever they do not list.
+const (
+	syncRemoveEndpoints = iota
+	syncRemoveBlacklist
+	syncAddEndpoints
+	syncAddBlacklist
+	syncSections
+)
+
+// syncHeader precedes the records of a batch. Everything is little-endian.
+type syncHeader struct {
+	Magic       uint32
+	Kind        uint32
+	BaseVersion uint64 // version a delta applies on top of, 0 for snapshots
+	Version     uint64
+	Counts      [syncSections]uint32
+}
+
+// ctlEndpoint mirrors struct ctl_endpoint
+type ctlEndpoint struct {
+	FrontIP                [16]byte
+	FrontPort              uint16
+	Protocol               uint8
+	_                      uint8
+	PrefixLen              uint32
+	OriginIP               [16]byte
+	OriginPort             uint16
+	_                      uint16
+	RateLimit              uint32
+	BurstLimit             uint32
+	ByteRateLimit          uint32
+	ByteBurstLimit         uint32
+	EndpointID             uint32 // assigned by the loader
+	EndpointByteRateLimit  uint32
+	EndpointByteBurstLimit uint32
+	AttackPPS              uint32
+	AttackNewFlows         uint32
+	SubnetRateLimit        uint32
+	SubnetBurstLimit       uint32
+	ProtocolType           uint8
+	MaintenanceMode        uint8
+	Flags                  uint8
+	_                      uint8
+}
+
+// ctlBlacklist mirrors struct ctl_blacklist
+type ctlBlacklist struct {
+	PrefixLen  uint32
+	IP         [16]byte
+	_          uint32
+	DurationMs uint64
+}
+
+type endpointKey struct {
+	IP        [16]byte
+	Port      uint16
+	Protocol  uint8
+	PrefixLen uint32
+}
+
+type blacklistKey struct {
+	IP        [16]byte
+	PrefixLen uint32
+}
+
+type blacklistEntry struct {
+	record    ctlBlacklist
+	expiresAt time.Time
+}
+
+type syncChange struct {
+	section   int
+	endpoint  ctlEndpoint
+	blacklist blacklistEntry
+}
+
+// syncState is the versioned table. journal[i] took the table from
+// version journalBase+i to journalBase+i+1.
+type syncState struct {
+	mu          sync.Mutex
+	version     uint64
+	endpoints   map[string]ctlEndpoint    // by endpoint ID
+	blacklist   map[string]blacklistEntry // by IP as stored
+	journal     []syncChange
+	journalBase uint64
+}
+
+func newSyncState() *syncState {
+	return &syncState{
+		endpoints: make(map[string]ctlEndpoint),
+		blacklist: make(map[string]blacklistEntry),
+	}
+}
+
+func (e *ctlEndpoint) key() endpointKey {
+	return endpointKey{IP: e.FrontIP, Port: e.FrontPort, Protocol: e.Protocol, PrefixLen: e.PrefixLen}
+}
+
+func (b *ctlBlacklist) key() blacklistKey {
+	return blacklistKey{IP: b.IP, PrefixLen: b.PrefixLen}
+}
+
+func clampUint32(v int64) uint32 {
+	if v < 0 {
+		return 0
+	}
+	if v > math.MaxUint32 {
+		return math.MaxUint32
+	}
+	return uint32(v)
+}
+
+// endpointRecord converts an endpoint to the loader's record
+func endpointRecord(endpoint *storage.ProtectedEndpoint) (ctlEndpoint, error) {
+	var rec ctlEndpoint
+
+	front := net.ParseIP(endpoint.FrontIP).To16()
+	origin := net.ParseIP(endpoint.OriginIP).To16()
+	if front == nil || origin == nil {
+		return rec, fmt.Errorf("invalid address %q -> %q", endpoint.FrontIP, endpoint.OriginIP)
+	}
+
+	switch endpoint.Protocol {
+	case "java":
+		rec.Protocol = 6 // TCP
+		rec.ProtocolType = 0
+	case "bedrock":
+		rec.Protocol = 17 // UDP
+		rec.ProtocolType = 1
+	default:
+		return rec, fmt.Errorf("unknown protocol %q", endpoint.Protocol)
+	}
+
+	copy(rec.FrontIP[:], front)
+	copy(rec.OriginIP[:], origin)
+	rec.FrontPort = uint16(endpoint.FrontPort)
+	rec.PrefixLen = 128
+	rec.OriginPort = uint16(endpoint.OriginPort)
+	rec.RateLimit = clampUint32(int64(endpoint.RateLimit))
+	rec.BurstLimit = clampUint32(int64(endpoint.BurstLimit))
+	rec.ByteRateLimit = clampUint32(endpoint.ByteRateLimit)
+	rec.ByteBurstLimit = clampUint32(endpoint.ByteBurstLimit)
+	rec.EndpointByteRateLimit = clampUint32(endpoint.EndpointByteRateLimit)
+	rec.EndpointByteBurstLimit = clampUint32(endpoint.EndpointByteBurstLimit)
+	if endpoint.MaintenanceMode {
+		rec.MaintenanceMode = 1
+	}
+	return rec, nil
+}
+
+// blacklistRecord converts a blacklist entry to the loader's record. A
+// bare IPv6 address blocks its /64, as the loader's own blacklist command
+// does.
+func blacklistRecord(entry *storage.IPBlacklist) (blacklistEntry, error) {
+	var be blacklistEntry
+
+	ip, ipNet, err := net.ParseCIDR(entry.IP)
+	if err == nil {
+		ones, bits := ipNet.Mask.Size()
+		ip = ipNet.IP
+		be.record.PrefixLen = uint32(128 - bits + ones)
+	} else if ip = net.ParseIP(entry.IP); ip != nil {
+		be.record.PrefixLen = 128
+		if ip.To4() == nil {
+			ip = ip.Mask(net.CIDRMask(64, 128))
+			be.record.PrefixLen = 64
+		}
+	} else {
+		return be, fmt.Errorf("invalid blacklist address %q", entry.IP)
+	}
+
+	copy(be.record.IP[:], ip.To16())
+	be.expiresAt = entry.ExpiresAt
+	return be, nil
+}
+
+// record journals a change as the next version. Called with mu held.
+func (s *syncState) record(change syncChange) {
+	s.version++
+	s.journal = append(s.journal, change)
+
+	// Trim in halves so the journal is not copied on every change
+	if len(s.journal) > 2*syncJournalMax {
+		drop := len(s.journal) - syncJournalMax
+		s.journal = append([]syncChange(nil), s.journal[drop:]...)
+		s.journalBase += uint64(drop)
+	}
+}
+
+func (s *syncState) setEndpoint(endpoint *storage.ProtectedEndpoint) error {
+	if !endpoint.Active {
+		s.removeEndpoint(endpoint.ID)
+		return nil
+	}
+
+	rec, err := endpointRecord(endpoint)
+	if err != nil {
+		return err
+	}
+
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	// A moved front address leaves nothing behind at the old one
+	if old, ok := s.endpoints[endpoint.ID]; ok && old.key() != rec.key() {
+		s.record(syncChange{section: syncRemoveEndpoints, endpoint: old})
+	}
+	s.endpoints[endpoint.ID] = rec
+	s.record(syncChange{section: syncAddEndpoints, endpoint: rec})
+	return nil
+}
+
+func (s *syncState) removeEndpoint(id string) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	if old, ok := s.endpoints[id]; ok {
+		delete(s.endpoints, id)
+		s.record(syncChange{section: syncRemoveEndpoints, endpoint: old})
+	}
+}
+
+func (s *syncState) setBlacklist(entry *storage.IPBlacklist) error {
+	be, err := blacklistRecord(entry)
+	if err != nil {
+		return err
+	}
+
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	s.blacklist[entry.IP] = be
+	s.record(syncChange{section: syncAddBlacklist, blacklist: be})
+	return nil
+}
+
+func (s *syncState) removeBlacklist(ip string) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	if old, ok := s.blacklist[ip]; ok {
+		delete(s.blacklist, ip)
+		s.record(syncChange{section: syncRemoveBlacklist, blacklist: old})
+	}
+}
+
+func (s *syncState) currentVersion() uint64 {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	return s.version
+}
+
+// encode returns the batch that takes a node from version since to the
+// current version, and that version. Expiring blacklist entries carry the
+// time they have left as of now.
+func (s *syncState) encode(since uint64) ([]byte, uint64, error) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	now := time.Now()
+	hdr := syncHeader{Magic: syncMagic, Kind: syncSnapshot, Version: s.version}
+	var endpoints [syncSections][]ctlEndpoint
+	var blacklist [syncSections][]ctlBlacklist
+
+	addBlacklist := func(section int, be blacklistEntry) {
+		rec := be.record
+		if section == syncAddBlacklist {
+			if !be.expiresAt.After(now) {
+				return
+			}
+			rec.DurationMs = uint64(be.expiresAt.Sub(now) / time.Millisecond)
+		}
+		blacklist[section] = append(blacklist[section], rec)
+	}
+
+	if since > 0 && since >= s.journalBase {
+		// Only the last change to each key matters
+		hdr.Kind = syncDelta
+		hdr.BaseVersion = since
+		lastEndpoint := make(map[endpointKey]syncChange)
+		lastBlacklist := make(map[blacklistKey]syncChange)
+		for _, change := range s.journal[since-s.journalBase:] {
+			if change.section == syncAddEndpoints || change.section == syncRemoveEndpoints {
+				lastEndpoint[change.endpoint.key()] = change
+			} else {
+				lastBlacklist[change.blacklist.record.key()] = change
+			}
+		}
+		for _, change := range lastEndpoint {
+			endpoints[change.section] = append(endpoints[change.section], change.endpoint)
+		}
+		for _, change := range lastBlacklist {
+			addBlacklist(change.section, change.blacklist)
+		}
+	} else {
+		for _, rec := range s.endpoints {
+			endpoints[syncAddEndpoints] = append(endpoints[syncAddEndpoints], rec)
+		}
+		for _, be := range s.blacklist {
+			addBlacklist(syncAddBlacklist, be)
+		}
+	}
+
+	for section := 0; section < syncSections; section++ {
+		hdr.Counts[section] = uint32(len(endpoints[section]) + len(blacklist[section]))
+	}
+
+	var buf bytes.Buffer
+	if err := binary.Write(&buf, binary.LittleEndian, &hdr); err != nil {
+		return nil, 0, err
+	}
+	for section := 0; section < syncSections; section++ {
+		var err error
+		if len(endpoints[section]) > 0 {
+			err = binary.Write(&buf, binary.LittleEndian, endpoints[section])
+		} else if len(blacklist[section]) > 0 {
+			err = binary.Write(&buf, binary.LittleEndian, blacklist[section])
+		}
+		if err != nil {
+			return nil, 0, err
+		}
+	}
+	return buf.Bytes(), s.version, nil
+}
+
+// loadSyncState fills the table from the database
+func (m *Manager) loadSyncState(ctx context.Context) error {
+	endpoints, err := m.store.GetAllActiveEndpoints(ctx)
+	if err != nil {
+		return fmt.Errorf("failed to get endpoints: %w", err)
+	}
+	blacklist, err := m.store.GetBlacklist(ctx)
+	if err != nil {
+		return fmt.Errorf("failed to get blacklist: %w", err)
+	}
+
+	for _, endpoint := range endpoints {
+		if err := m.desired.setEndpoint(endpoint); err != nil {
+			m.monitor.LogError("Skipping endpoint in node sync",
+				zap.String("endpoint_id", endpoint.ID),
+				zap.Error(err))
+		}
+	}
+	for _, entry := range blacklist {
+		if err := m.desired.setBlacklist(entry); err != nil {
+			m.monitor.LogError("Skipping blacklist entry in node sync",
+				zap.String("ip", entry.IP),
+				zap.Error(err))
+		}
+	}
+	return nil
+}
+
+// requestSync schedules a push; changes made before it runs share one batch
+func (m *Manager) requestSync() {
+	select {
+	case m.syncKick <- struct{}{}:
+	default:
+	}
+}
+
+// syncLoop pushes changes as they come in and retries lagging nodes
+func (m *Manager) syncLoop(ctx context.Context) {
+	ticker := time.NewTicker(m.config.RetryDelay)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case <-m.syncKick:
+			m.pushSync(ctx)
+		case <-ticker.C:
+			m.pushSync(ctx)
+		case <-ctx.Done():
+			return
+		case <-m.stopCh:
+			return
+		}
+	}
+}
+
+// pushSync brings every active node up to the current version, at most
+// SyncParallelism nodes at a time. Nodes at the same version share one
+// encoded batch.
+func (m *Manager) pushSync(ctx context.Context) {
+	m.nodesMu.RLock()
+	nodes := make([]*Node, 0, len(m.nodes))
+	for _, node := range m.nodes {
+		if node.Status == "active" {
+			nodes = append(nodes, node)
+		}
+	}
+	m.nodesMu.RUnlock()
+
+	type batch struct {
+		body    []byte
+		version uint64
+	}
+	batches := make(map[uint64]batch)
+	var wg sync.WaitGroup
+	sem := make(chan struct{}, m.config.SyncParallelism)
+
+	for _, node := range nodes {
+		since := node.syncedVersion
+		b, ok := batches[since]
+		if !ok {
+			body, version, err := m.desired.encode(since)
+			if err != nil {
+				m.monitor.LogError("Failed to encode node sync", zap.Error(err))
+				break
+			}
+			b = batch{body: body, version: version}
+			batches[since] = b
+		}
+		if since == b.version {
+			continue
+		}
+
+		wg.Add(1)
+		sem <- struct{}{}
+		go func(node *Node, b batch) {
+			defer wg.Done()
+			defer func() { <-sem }()
+
+			if err := m.sendSync(ctx, node, b.body, b.version); err != nil {
+				m.monitor.LogError("Failed to sync node",
+					zap.String("node_id", node.ID),
+					zap.Error(err))
+			}
+		}(node, b)
+	}
+	wg.Wait()
+}
+
+// sendSync posts one batch. A node that rejects a delta as not matching
+// its version is sent a snapshot on the next push.
+func (m *Manager) sendSync(ctx context.Context, node *Node, body []byte, version uint64) error {
+	url := fmt.Sprintf("http://%s:%d/api/v1/sync", node.IP, node.Port)
+
+	req, err := http.NewRequestWithContext(ctx, "POST", url, bytes.NewReader(body))
+	if err != nil {
+		return err
+	}
+	req.Header.Set("Content-Type", syncContentType)
+
+	resp, err := node.client.Do(req)
+	if err != nil {
+		return err
+	}
+	defer resp.Body.Close()
+
+	switch resp.StatusCode {
+	case http.StatusOK:
+		node.syncedVersion = version
+		return nil
+	case http.StatusConflict:
+		base := node.syncedVersion
+		node.syncedVersion = 0
+		return fmt.Errorf("node is not at version %d, resending a snapshot", base)
+	default:
+		return fmt.Errorf("sync failed with status %d", resp.StatusCode)
+	}
+}
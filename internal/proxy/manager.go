@@ -92,6 +92,11 @@ func (m *Manager) Start(ctx context.Context) error {
 		}
 	}
 
+	// Receive clean Bedrock traffic redirected to AF_XDP by the dataplane
+	if m.config.EnableAFXDP {
+		go m.handleXSKFrames(ctx)
+	}
+
 	return nil
 }
 
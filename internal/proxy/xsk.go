@@ -0,0 +1,101 @@
+package proxy
+
+import (
+	"context"
+	"encoding/binary"
+	"net"
+	"os"
+	"path/filepath"
+	"time"
+
+	"go.uber.org/zap"
+)
+
+// xskFrameHeaderLen is the size of the header xsk_consumer prepends to every
+// datagram: version, protocol, source/destination port (network order), two
+// bytes of padding, then source and destination addresses as 16-byte IPv6
+// (IPv4-mapped for IPv4 traffic).
+const (
+	xskFrameHeaderLen     = 40
+	xskFrameHeaderVersion = 1
+	ipProtoUDP            = 17
+)
+
+// handleXSKFrames receives Bedrock datagrams that the XDP program redirected
+// to AF_XDP and feeds them into the matching UDP proxy, bypassing the kernel
+// network stack on the ingress side.
+func (m *Manager) handleXSKFrames(ctx context.Context) {
+	path := m.config.XSKSocket
+	if err := os.MkdirAll(filepath.Dir(path), 0755); err != nil {
+		m.monitor.LogError("Failed to create AF_XDP socket directory", zap.Error(err))
+		return
+	}
+	os.Remove(path)
+
+	conn, err := net.ListenUnixgram("unixgram", &net.UnixAddr{Name: path, Net: "unixgram"})
+	if err != nil {
+		m.monitor.LogError("Failed to listen for AF_XDP frames",
+			zap.String("socket", path),
+			zap.Error(err))
+		return
+	}
+	defer conn.Close()
+
+	m.monitor.LogInfo("AF_XDP ingress started", zap.String("socket", path))
+
+	buffer := make([]byte, xskFrameHeaderLen+m.config.BufferSize)
+	for {
+		select {
+		case <-m.stopCh:
+			return
+		case <-ctx.Done():
+			return
+		default:
+			conn.SetReadDeadline(time.Now().Add(1 * time.Second))
+
+			n, _, err := conn.ReadFromUnix(buffer)
+			if err != nil {
+				if netErr, ok := err.(net.Error); ok && netErr.Timeout() {
+					continue
+				}
+				m.monitor.LogError("Failed to read AF_XDP frame", zap.Error(err))
+				continue
+			}
+			if n < xskFrameHeaderLen || buffer[0] != xskFrameHeaderVersion || buffer[1] != ipProtoUDP {
+				continue
+			}
+
+			srcPort := binary.BigEndian.Uint16(buffer[2:4])
+			dstPort := binary.BigEndian.Uint16(buffer[4:6])
+			srcIP := net.IP(append([]byte(nil), buffer[8:24]...))
+			dstIP := net.IP(buffer[24:40])
+
+			server := m.findUDPServer(dstIP, int(dstPort))
+			if server == nil {
+				continue
+			}
+
+			// The buffer is reused for the next frame, so the payload is copied
+			data := append([]byte(nil), buffer[xskFrameHeaderLen:n]...)
+			clientAddr := &net.UDPAddr{IP: srcIP, Port: int(srcPort)}
+			go m.handleUDPPacket(ctx, server, data, clientAddr)
+		}
+	}
+}
+
+// findUDPServer returns the UDP proxy serving the given front address
+func (m *Manager) findUDPServer(ip net.IP, port int) *UDPServer {
+	m.serversMu.RLock()
+	defer m.serversMu.RUnlock()
+
+	for _, server := range m.udpServers {
+		if server.Endpoint.FrontPort != port {
+			continue
+		}
+		frontIP := net.ParseIP(server.Endpoint.FrontIP)
+		if frontIP == nil || frontIP.IsUnspecified() || frontIP.Equal(ip) {
+			return server
+		}
+	}
+	return nil
+}
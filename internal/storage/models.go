@@ -30,18 +30,22 @@ type Organization struct {
 // ProtectedEndpoint represents a protected Minecraft server endpoint
 type ProtectedEndpoint struct {
 	gorm.Model
-	ID              string `json:"id" gorm:"primaryKey"`
-	OrganizationID  string `json:"organization_id" gorm:"not null"`
-	Name            string `json:"name" gorm:"not null"`
-	FrontIP         string `json:"front_ip" gorm:"not null"`
-	FrontPort       int    `json:"front_port" gorm:"not null"`
-	OriginIP        string `json:"origin_ip" gorm:"not null"`
-	OriginPort      int    `json:"origin_port" gorm:"not null"`
-	Protocol        string `json:"protocol" gorm:"not null"` // "java" or "bedrock"
-	RateLimit       int    `json:"rate_limit" gorm:"default:1000"`
-	BurstLimit      int    `json:"burst_limit" gorm:"default:2000"`
-	MaintenanceMode bool   `json:"maintenance_mode" gorm:"default:false"`
-	Active          bool   `json:"active" gorm:"default:true"`
+	ID                     string `json:"id" gorm:"primaryKey"`
+	OrganizationID         string `json:"organization_id" gorm:"not null"`
+	Name                   string `json:"name" gorm:"not null"`
+	FrontIP                string `json:"front_ip" gorm:"not null"`
+	FrontPort              int    `json:"front_port" gorm:"not null"`
+	OriginIP               string `json:"origin_ip" gorm:"not null"`
+	OriginPort             int    `json:"origin_port" gorm:"not null"`
+	Protocol               string `json:"protocol" gorm:"not null"` // "java" or "bedrock"
+	RateLimit              int    `json:"rate_limit" gorm:"default:1000"`
+	BurstLimit             int    `json:"burst_limit" gorm:"default:2000"`
+	ByteRateLimit          int64  `json:"byte_rate_limit" gorm:"default:0"` // bytes/s per source, 0 = unlimited
+	ByteBurstLimit         int64  `json:"byte_burst_limit" gorm:"default:0"`
+	EndpointByteRateLimit  int64  `json:"endpoint_byte_rate_limit" gorm:"default:0"` // bytes/s across all sources
+	EndpointByteBurstLimit int64  `json:"endpoint_byte_burst_limit" gorm:"default:0"`
+	MaintenanceMode        bool   `json:"maintenance_mode" gorm:"default:false"`
+	Active                 bool   `json:"active" gorm:"default:true"`
 }
 
 // Node represents an edge node running XDP programs
@@ -119,37 +123,49 @@ type AuditLog struct {
 
 // Request/Response types for API
 type CreateEndpointRequest struct {
-	Name            string `json:"name" binding:"required"`
-	OriginIP        string `json:"origin_ip" binding:"required,ip"`
-	OriginPort      int    `json:"origin_port" binding:"required,min=1,max=65535"`
-	Protocol        string `json:"protocol" binding:"required,oneof=java bedrock"`
-	RateLimit       int    `json:"rate_limit"`
-	BurstLimit      int    `json:"burst_limit"`
-	MaintenanceMode bool   `json:"maintenance_mode"`
+	Name                   string `json:"name" binding:"required"`
+	OriginIP               string `json:"origin_ip" binding:"required,ip"`
+	OriginPort             int    `json:"origin_port" binding:"required,min=1,max=65535"`
+	Protocol               string `json:"protocol" binding:"required,oneof=java bedrock"`
+	RateLimit              int    `json:"rate_limit"`
+	BurstLimit             int    `json:"burst_limit"`
+	ByteRateLimit          int64  `json:"byte_rate_limit" binding:"min=0"`
+	ByteBurstLimit         int64  `json:"byte_burst_limit" binding:"min=0"`
+	EndpointByteRateLimit  int64  `json:"endpoint_byte_rate_limit" binding:"min=0"`
+	EndpointByteBurstLimit int64  `json:"endpoint_byte_burst_limit" binding:"min=0"`
+	MaintenanceMode        bool   `json:"maintenance_mode"`
 }
 
 type UpdateEndpointRequest struct {
-	Name            *string `json:"name"`
-	RateLimit       *int    `json:"rate_limit"`
-	BurstLimit      *int    `json:"burst_limit"`
-	MaintenanceMode *bool   `json:"maintenance_mode"`
-	Active          *bool   `json:"active"`
+	Name                   *string `json:"name"`
+	RateLimit              *int    `json:"rate_limit"`
+	BurstLimit             *int    `json:"burst_limit"`
+	ByteRateLimit          *int64  `json:"byte_rate_limit"`
+	ByteBurstLimit         *int64  `json:"byte_burst_limit"`
+	EndpointByteRateLimit  *int64  `json:"endpoint_byte_rate_limit"`
+	EndpointByteBurstLimit *int64  `json:"endpoint_byte_burst_limit"`
+	MaintenanceMode        *bool   `json:"maintenance_mode"`
+	Active                 *bool   `json:"active"`
 }
 
 type EndpointResponse struct {
-	ID              string    `json:"id"`
-	Name            string    `json:"name"`
-	FrontIP         string    `json:"front_ip"`
-	FrontPort       int       `json:"front_port"`
-	OriginIP        string    `json:"origin_ip"`
-	OriginPort      int       `json:"origin_port"`
-	Protocol        string    `json:"protocol"`
-	RateLimit       int       `json:"rate_limit"`
-	BurstLimit      int       `json:"burst_limit"`
-	MaintenanceMode bool      `json:"maintenance_mode"`
-	Active          bool      `json:"active"`
-	CreatedAt       time.Time `json:"created_at"`
-	UpdatedAt       time.Time `json:"updated_at"`
+	ID                     string    `json:"id"`
+	Name                   string    `json:"name"`
+	FrontIP                string    `json:"front_ip"`
+	FrontPort              int       `json:"front_port"`
+	OriginIP               string    `json:"origin_ip"`
+	OriginPort             int       `json:"origin_port"`
+	Protocol               string    `json:"protocol"`
+	RateLimit              int       `json:"rate_limit"`
+	BurstLimit             int       `json:"burst_limit"`
+	ByteRateLimit          int64     `json:"byte_rate_limit"`
+	ByteBurstLimit         int64     `json:"byte_burst_limit"`
+	EndpointByteRateLimit  int64     `json:"endpoint_byte_rate_limit"`
+	EndpointByteBurstLimit int64     `json:"endpoint_byte_burst_limit"`
+	MaintenanceMode        bool      `json:"maintenance_mode"`
+	Active                 bool      `json:"active"`
+	CreatedAt              time.Time `json:"created_at"`
+	UpdatedAt              time.Time `json:"updated_at"`
 }
 
 type NodeStatus struct {
@@ -177,5 +193,37 @@ type MetricsResponse struct {
 	TotalPackets          int64     `json:"total_packets"`
 	UDPChallengesSent     int64     `json:"udp_challenges_sent"`
 	UDPChallengesPassed   int64     `json:"udp_challenges_passed"`
+	BlockedAttack         int64     `json:"blocked_attack"` // new flows over the cap while under attack
+	AllowedBytes          int64     `json:"allowed_bytes"`
+	DroppedBytes          int64     `json:"dropped_bytes"`
 	TopAttackers          []string  `json:"top_attackers"`
-}
\ No newline at end of file
+}
+
+// NodeEventsRequest is a batch of sampled dataplane drops posted by a node's loader
+type NodeEventsRequest struct {
+	Lost      uint64                 `json:"lost"` // events the node could not report since the last batch
+	Endpoints []NodeEndpointCounters `json:"endpoints"`
+	Events    []NodeEvent            `json:"events"`
+}
+
+// NodeEndpointCounters is one endpoint's exact dataplane counters since the previous
+// batch. It is stored as the labels of a "dataplane" Metric.
+type NodeEndpointCounters struct {
+	FrontIP        string            `json:"front_ip"`
+	FrontPort      int               `json:"front_port"`
+	Protocol       string            `json:"protocol"`
+	AllowedPackets uint64            `json:"allowed_packets"`
+	AllowedBytes   uint64            `json:"allowed_bytes"`
+	DroppedBytes   uint64            `json:"dropped_bytes"`
+	Dropped        map[string]uint64 `json:"dropped"` // packets by reason
+}
+
+// NodeEvent aggregates the sampled drops of one source towards one front address
+type NodeEvent struct {
+	FrontIP   string `json:"front_ip"`
+	FrontPort int    `json:"front_port"`
+	Protocol  string `json:"protocol"` // "tcp" or "udp"
+	SourceIP  string `json:"source_ip"`
+	Reason    string `json:"reason"`
+	Count     uint64 `json:"count"` // estimated drops, samples scaled by the sampling rate
+}
@@ -9,30 +9,491 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <dirent.h>
 #include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netdb.h>
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
 #include <net/if.h>
+#include <arpa/inet.h>
 #include <linux/if_link.h>
 
+#include "minecraft_protection.h"
+
+// Number of map entries fetched per batched syscall
+#define MAP_BATCH_SIZE 4096
+
+// Returned by the kernel for map operations it does not implement
+#ifndef ENOTSUPP
+#define ENOTSUPP 524
+#endif
+
+// Sources with fewer hits than this since the last rebalance keep their shares
+#define REBALANCE_MIN_HITS 64
+
+// Distinct (source, destination, reason) drop aggregates held between event
+// flushes; a power of two. Samples that do not fit are reported as lost.
+#define EVENT_AGG_SLOTS 8192
+
+// Default one-in-N sampling of each drop reason once an event URL is set
+#define EVENT_SAMPLE_DEFAULT 1000
+
+// Send/receive timeout for posting events to the control plane, further
+// capped by the flush interval
+#define EVENT_POST_TIMEOUT_MS 2000
+
+// XDP link of the running generation; a reload swaps the program behind it
+#define LINK_PIN_PATH PIN_BASE_DIR "/link"
+
+// How long a new loader waits on the running one during a handover
+#define HANDOVER_TIMEOUT_S 10
+
+// Control socket connections served at once; more are refused
+#define CTL_CLIENTS_MAX 16
+
+// Load-time options
+struct loader_options {
+    __u32 rate_limit_mode;
+    __u32 rebalance_interval_ms;
+    __u32 src_rate_entries;   // 0 keeps the size compiled into the object
+    __u32 subnet_rate_entries;
+    __u32 conntrack_entries;
+    __u32 cookie_rotate_ms;
+    __u32 blacklist_entries;
+    const char *blacklist_file;      // text feed, one address or prefix per line
+    const char *blacklist_bin_file;  // binary feed of struct blacklist_key records
+    __u64 blacklist_duration_ms;     // 0 blocks feed entries until removed
+    __u32 sweep_interval_ms;
+    __u32 sweep_budget;              // max entries deleted per map per sweep
+    __u32 rate_idle_ms;              // rate state idle this long is reclaimed
+    __u32 conntrack_idle_ms;
+    const char *events_url;          // control-plane ingest URL, NULL disables drop events
+    const char *events_token;        // sent as a bearer token
+    __u32 events_interval_ms;
+    __u32 event_sample[STAT_MAX];    // one-in-N drop sampling per STAT_* reason, 0 = off
+};
+
 // Map file descriptors
-static int map_protected_endpoints_fd;
+static int map_protected_endpoints_fd;  // the active exact endpoint table
+static int map_protected_prefixes_fd;
+static int map_endpoint_state_fd;
+static int map_endpoint_mode_fd;
+static int map_events_fd;
+static int map_event_sample_fd;
+static int map_endpoint_counters_fd;
 static int map_src_rate_fd;
+static int map_src_rate_percpu_fd;
+static int map_src_share_fd;
+static int map_subnet_rate_fd;
+static int map_subnet_rate_percpu_fd;
 static int map_conntrack_fd;
 static int map_blacklist_fd;
 static int map_stats_fd;
-static int map_udp_challenges_fd;
+static int map_config_fd;
+static int xsks_fd;
+static int map_origin_reverse_fd;
+static int map_cookie_secrets_fd;
+static int map_stages_fd;
+static int map_endpoint_tables_fd;
+static int map_endpoint_gen_fd;
+static int endpoint_table_fds[ENDPOINT_TABLES];  // by slot in map_endpoint_tables
+static __u32 endpoint_gen;  // as last written to map_endpoint_gen
 
 // XDP program object
 static struct bpf_object *obj;
+static struct bpf_object *stage_objs[STAGE_MAX];  // objects of hot-patched stages
+static struct bpf_link *xdp_link;
+static struct ring_buffer *events;
+
+// Last reported attack state per endpoint id; CPUs racing on a transition
+// can report it twice
+static __u8 endpoint_under_attack[ENDPOINT_ID_MAX];
+
+// Ids held in either endpoint map, read from the maps on first use and kept
+// in step by every add and remove after that
+static __u8 endpoint_ids_used[ENDPOINT_ID_MAX / 8];
+static int endpoint_ids_loaded;
+
+// Control socket listener and connected clients, -1 when unused
+static int ctl_listen_fd = -1;
+static int ctl_clients[CTL_CLIENTS_MAX];
+static ino_t ctl_sock_ino;  // of our socket file, which a newer loader may replace
+
+// Pipeline stage programs by STAGE_* slot, and their command-line names
+static const char *const stage_prog_names[STAGE_MAX] = {
+    [STAGE_POLICY] = "xdp_stage_policy",
+    [STAGE_JAVA_TCP] = "xdp_stage_java_tcp",
+    [STAGE_BEDROCK_UDP] = "xdp_stage_bedrock_udp"
+};
+
+static const char *const stage_names[STAGE_MAX] = {
+    [STAGE_POLICY] = "policy",
+    [STAGE_JAVA_TCP] = "java-tcp",
+    [STAGE_BEDROCK_UDP] = "bedrock-udp"
+};
+
+// Control-plane names of the STAT_* counters drops are counted under
+static const char *const drop_reason_names[STAT_MAX] = {
+    [STAT_BLOCKED_RATE_LIMIT] = "rate_limit",
+    [STAT_BLOCKED_BLACKLIST] = "blacklist",
+    [STAT_BLOCKED_INVALID_PROTOCOL] = "invalid_protocol",
+    [STAT_BLOCKED_CHALLENGE_FAILED] = "challenge_failed",
+    [STAT_BLOCKED_MAINTENANCE] = "maintenance",
+    [STAT_SYNCOOKIES_FAILED] = "syncookie_failed",
+    [STAT_ATTACK_NEW_FLOWS_DROPPED] = "attack_new_flows"
+};
+
+// Key of either endpoint map, for walks over both
+union endpoint_any_key {
+    struct endpoint_key exact;
+    struct endpoint_prefix_key prefix;
+};
+
+// Sampled drops aggregated since the last flush, open addressing
+struct event_agg {
+    struct ip_addr src;
+    struct ip_addr dst;
+    __u16 dport;
+    __u8 protocol;
+    __u8 used;
+    __u32 reason;
+    __u64 samples;
+};
+
+static struct event_agg *event_aggs;
+static __u32 event_agg_count;
+static __u64 event_agg_overflow;  // samples that found the table full
+static __u64 events_lost_reported;  // STAT_EVENTS_LOST as of the last flush
+
+// Event batches are posted from their own thread so a slow or unreachable
+// control plane never holds up run_loop(). One batch is in flight at most.
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int started;
+    int stop;
+    int busy;    // a post is running
+    char *body;  // next batch, owned by the poster
+    size_t len;
+} event_poster = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER
+};
+
+// Per-endpoint counter totals as of the last flush, by endpoint id
+static struct endpoint_counters *endpoint_reported;
+
+// Names of endpoint_counters.dropped entries, matching drop_reason_names
+static const char *const endpoint_drop_names[ENDPOINT_DROP_MAX] = {
+    [ENDPOINT_DROP_RATE_LIMIT] = "rate_limit",
+    [ENDPOINT_DROP_INVALID_PROTOCOL] = "invalid_protocol",
+    [ENDPOINT_DROP_CHALLENGE_FAILED] = "challenge_failed",
+    [ENDPOINT_DROP_MAINTENANCE] = "maintenance",
+    [ENDPOINT_DROP_SYNCOOKIE_FAILED] = "syncookie_failed",
+    [ENDPOINT_DROP_ATTACK_NEW_FLOWS] = "attack_new_flows"
+};
+
+static int nr_cpus;
+static volatile sig_atomic_t exiting;
+
+// Control client a new loader is taking over through, and on the new
+// loader the connection it does so on
+static int handover_slot = -1;
+static int handover_fd = -1;
+
+static void handle_signal(int sig)
+{
+    exiting = 1;
+}
+
+// Same time base as the datapath's expiry and idle timestamps
+static __u64 now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (__u64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static const char *format_ip_addr(const struct ip_addr *addr, char *buf, size_t len)
+{
+    if (ip_addr_is_v4(addr))
+        return inet_ntop(AF_INET, &addr->w[3], buf, len);
+    return inet_ntop(AF_INET6, addr, buf, len);
+}
+
+// Shift the current cookie secret to the previous slot and draw a new one
+static int rotate_cookie_secrets(void)
+{
+    __u32 current = COOKIE_SECRET_CURRENT, previous = COOKIE_SECRET_PREVIOUS;
+    struct cookie_secret secret;
+    
+    if (bpf_map_lookup_elem(map_cookie_secrets_fd, &current, &secret) == 0)
+        bpf_map_update_elem(map_cookie_secrets_fd, &previous, &secret, BPF_ANY);
+    
+    if (getrandom(&secret, sizeof(secret), 0) != sizeof(secret)) {
+        fprintf(stderr, "Failed to generate cookie secret: %s\n", strerror(errno));
+        return -1;
+    }
+    if (bpf_map_update_elem(map_cookie_secrets_fd, &current, &secret, BPF_ANY)) {
+        fprintf(stderr, "Failed to update cookie secret: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static __u32 event_agg_hash(const struct dp_event *ev)
+{
+    __u32 h = 2166136261U;  // FNV-1a over the addresses, port and reason
+    const __u8 *p = (const __u8 *)&ev->src;
+    
+    for (size_t i = 0; i < 2 * sizeof(struct ip_addr); i++)
+        h = (h ^ p[i]) * 16777619U;
+    h = (h ^ ev->dport) * 16777619U;
+    return (h ^ (__u32)ev->value) * 16777619U;
+}
+
+// Fold one sampled drop into the table. It is kept below three quarters
+// full so probes stay short; later samples are counted as overflow.
+static void aggregate_drop(const struct dp_event *ev)
+{
+    __u32 slot = event_agg_hash(ev) & (EVENT_AGG_SLOTS - 1);
+    
+    for (;;) {
+        struct event_agg *agg = &event_aggs[slot];
+        if (!agg->used)
+            break;
+        if (agg->reason == ev->value && agg->dport == ev->dport &&
+            agg->protocol == ev->protocol &&
+            !memcmp(&agg->src, &ev->src, sizeof(agg->src)) &&
+            !memcmp(&agg->dst, &ev->dst, sizeof(agg->dst))) {
+            agg->samples++;
+            return;
+        }
+        slot = (slot + 1) & (EVENT_AGG_SLOTS - 1);
+    }
+    
+    if (event_agg_count >= EVENT_AGG_SLOTS / 4 * 3) {
+        event_agg_overflow++;
+        return;
+    }
+    event_aggs[slot] = (struct event_agg){
+        .src = ev->src,
+        .dst = ev->dst,
+        .dport = ev->dport,
+        .protocol = ev->protocol,
+        .used = 1,
+        .reason = ev->value,
+        .samples = 1
+    };
+    event_agg_count++;
+}
+
+// Datapath events from map_events
+static int handle_event(void *ctx, void *data, size_t size)
+{
+    const struct dp_event *ev = data;
+    
+    if (size < sizeof(*ev))
+        return 0;
+    
+    if (ev->type == EVENT_DROP) {
+        if (event_aggs && ev->value < STAT_MAX)
+            aggregate_drop(ev);
+        return 0;
+    }
+    if (ev->endpoint_id >= ENDPOINT_ID_MAX)
+        return 0;
+    
+    switch (ev->type) {
+    case EVENT_ATTACK_START:
+        if (endpoint_under_attack[ev->endpoint_id])
+            break;
+        endpoint_under_attack[ev->endpoint_id] = 1;
+        printf("Endpoint %u under attack (~%llu pps), challenging all new flows\n",
+               ev->endpoint_id, ev->value);
+        break;
+    case EVENT_ATTACK_END:
+        if (!endpoint_under_attack[ev->endpoint_id])
+            break;
+        endpoint_under_attack[ev->endpoint_id] = 0;
+        printf("Endpoint %u attack mode ended\n", ev->endpoint_id);
+        break;
+    }
+    return 0;
+}
+
+// Point a map_stages slot at that stage's program in o. The update is
+// atomic: each packet runs either the old or the new stage.
+static int install_stage(struct bpf_object *o, __u32 stage)
+{
+    struct bpf_program *prog = bpf_object__find_program_by_name(o, stage_prog_names[stage]);
+    int prog_fd = prog ? bpf_program__fd(prog) : -1;
+    
+    if (prog_fd < 0) {
+        fprintf(stderr, "Failed to find stage program %s\n", stage_prog_names[stage]);
+        return -1;
+    }
+    if (bpf_map_update_elem(map_stages_fd, &stage, &prog_fd, BPF_ANY)) {
+        fprintf(stderr, "Failed to install stage %s: %s\n", stage_names[stage], strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// The tail-call table and packet scratch space belong to one object's stage
+// programs; everything else is state that outlives a reload.
+static int map_is_per_object(const struct bpf_map *map)
+{
+    const char *name = bpf_map__name(map);
+    return bpf_map__is_internal(map) || strcmp(name, "map_stages") == 0 ||
+           strcmp(name, "map_pkt_ctx") == 0;
+}
+
+// Bind the state maps of o to the copies pinned by the running generation.
+// A pinned map whose shape no longer matches (new value layout, resized by
+// an option) is dropped and only that map starts empty. Runs before load.
+static int reuse_pinned_maps(struct bpf_object *o, int *reused)
+{
+    struct bpf_map *map;
+    char path[PATH_MAX];
+    
+    *reused = 0;
+    bpf_object__for_each_map(map, o) {
+        if (map_is_per_object(map))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", PIN_BASE_DIR, bpf_map__name(map));
+        int fd = bpf_obj_get(path);
+        if (fd < 0)
+            continue;
+        
+        struct bpf_map_info info = {0};
+        __u32 len = sizeof(info);
+        if (bpf_obj_get_info_by_fd(fd, &info, &len) == 0 &&
+            info.type == bpf_map__type(map) &&
+            info.key_size == bpf_map__key_size(map) &&
+            info.value_size == bpf_map__value_size(map) &&
+            info.max_entries == bpf_map__max_entries(map) &&
+            info.map_flags == bpf_map__map_flags(map)) {
+            int err = bpf_map__reuse_fd(map, fd);
+            close(fd);
+            if (err) {
+                fprintf(stderr, "Failed to reuse pinned map %s: %s\n",
+                        bpf_map__name(map), strerror(-err));
+                return -1;
+            }
+            (*reused)++;
+            continue;
+        }
+        close(fd);
+        printf("Pinned map %s changed shape, starting it empty\n", bpf_map__name(map));
+        if (unlink(path)) {
+            fprintf(stderr, "Failed to unpin %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Pin every state map by name so the next generation can pick it up.
+// Reused maps are already pinned at their path.
+static int pin_state_maps(struct bpf_object *o)
+{
+    struct bpf_map *map;
+    char path[PATH_MAX];
+    
+    if (mkdir(PIN_BASE_DIR, 0700) && errno != EEXIST) {
+        fprintf(stderr, "Failed to create %s: %s\n", PIN_BASE_DIR, strerror(errno));
+        return -1;
+    }
+    bpf_object__for_each_map(map, o) {
+        if (map_is_per_object(map))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", PIN_BASE_DIR, bpf_map__name(map));
+        if (bpf_obj_pin(bpf_map__fd(map), path) && errno != EEXIST) {
+            fprintf(stderr, "Failed to pin %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Swap prog in behind the pinned link of a running generation, or attach
+// and pin a new link. bpf_link_update is atomic, so every packet runs either
+// the old or the new entry program. Returns 1 for a swap, 0 for an attach.
+static int attach_xdp_link(struct bpf_program *prog, int ifindex)
+{
+    int err;
+    
+    xdp_link = bpf_link__open(LINK_PIN_PATH);
+    if (!libbpf_get_error(xdp_link)) {
+        struct bpf_link_info info = {0};
+        __u32 len = sizeof(info);
+        if (bpf_obj_get_info_by_fd(bpf_link__fd(xdp_link), &info, &len) ||
+            info.type != BPF_LINK_TYPE_XDP || info.xdp.ifindex != (__u32)ifindex) {
+            fprintf(stderr, "%s is not attached to this interface, run unload first\n",
+                    LINK_PIN_PATH);
+            return -1;
+        }
+        err = bpf_link__update_program(xdp_link, prog);
+        if (err) {
+            fprintf(stderr, "Failed to swap XDP program: %s\n", strerror(-err));
+            return -1;
+        }
+        return 1;
+    }
+    
+    xdp_link = bpf_program__attach_xdp(prog, ifindex);
+    if (libbpf_get_error(xdp_link)) {
+        fprintf(stderr, "Failed to attach XDP program: %s\n",
+                strerror(-libbpf_get_error(xdp_link)));
+        xdp_link = NULL;
+        return -1;
+    }
+    err = bpf_link__pin(xdp_link, LINK_PIN_PATH);
+    if (err) {
+        fprintf(stderr, "Failed to pin XDP link: %s\n", strerror(-err));
+        bpf_link__destroy(xdp_link);
+        xdp_link = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int init_endpoint_tables(void);
+static int start_event_poster(const struct loader_options *opts);
+
+static __u32 count_endpoint_prefixes(void)
+{
+    struct endpoint_prefix_key key, next;
+    void *prev = NULL;
+    __u32 count = 0;
+    
+    while (bpf_map_get_next_key(map_protected_prefixes_fd, prev, &next) == 0) {
+        count++;
+        key = next;
+        prev = &key;
+    }
+    return count;
+}
 
 // Load XDP program
-static int load_xdp_program(const char *ifname, const char *filename)
+static int load_xdp_program(const char *ifname, const char *filename,
+                            const struct loader_options *opts)
 {
-    int err, prog_fd;
+    int err, prog_fd, reused, swapped;
     struct bpf_program *prog;
-    struct bpf_link *link;
     
     // Set resource limits for eBPF
     struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
@@ -41,16 +502,50 @@ static int load_xdp_program(const char *ifname, const char *filename)
     // Load eBPF object
     obj = bpf_object__open_file(filename, NULL);
     if (libbpf_get_error(obj)) {
-        fprintf(stderr, "Failed to open eBPF object: %s\n", 
-                libbpf_strerror(libbpf_get_error(obj)));
+        fprintf(stderr, "Failed to open eBPF object: %s\n",
+                strerror(-libbpf_get_error(obj)));
+        return -1;
+    }
+    
+    // Only the rate map for the selected mode needs real capacity
+    int percpu = opts->rate_limit_mode == RATE_LIMIT_PERCPU;
+    struct bpf_map *rate_map = bpf_object__find_map_by_name(obj,
+        percpu ? "map_src_rate_percpu" : "map_src_rate");
+    struct bpf_map *unused_rate_map = bpf_object__find_map_by_name(obj,
+        percpu ? "map_src_rate" : "map_src_rate_percpu");
+    struct bpf_map *subnet_map = bpf_object__find_map_by_name(obj,
+        percpu ? "map_subnet_rate_percpu" : "map_subnet_rate");
+    struct bpf_map *unused_subnet_map = bpf_object__find_map_by_name(obj,
+        percpu ? "map_subnet_rate" : "map_subnet_rate_percpu");
+    struct bpf_map *share_map = bpf_object__find_map_by_name(obj, "map_src_share");
+    struct bpf_map *conntrack_map = bpf_object__find_map_by_name(obj, "map_conntrack");
+    struct bpf_map *blacklist_map = bpf_object__find_map_by_name(obj, "map_blacklist");
+    if (!rate_map || !unused_rate_map || !subnet_map || !unused_subnet_map ||
+        !share_map || !conntrack_map || !blacklist_map) {
+        fprintf(stderr, "Failed to find state maps in eBPF object\n");
         return -1;
     }
+    bpf_map__set_max_entries(unused_rate_map, 1);
+    bpf_map__set_max_entries(unused_subnet_map, 1);
+    if (!percpu)
+        bpf_map__set_max_entries(share_map, 1);
+    if (opts->src_rate_entries)
+        bpf_map__set_max_entries(rate_map, opts->src_rate_entries);
+    if (opts->subnet_rate_entries)
+        bpf_map__set_max_entries(subnet_map, opts->subnet_rate_entries);
+    if (opts->conntrack_entries)
+        bpf_map__set_max_entries(conntrack_map, opts->conntrack_entries);
+    if (opts->blacklist_entries)
+        bpf_map__set_max_entries(blacklist_map, opts->blacklist_entries);
+    
+    // Carry rate, blacklist and conntrack state over from a running generation
+    if (reuse_pinned_maps(obj, &reused))
+        return -1;
     
     // Load eBPF program
     err = bpf_object__load(obj);
     if (err) {
-        fprintf(stderr, "Failed to load eBPF object: %s\n", 
-                libbpf_strerror(err));
+        fprintf(stderr, "Failed to load eBPF object: %s\n", strerror(-err));
         return -1;
     }
     
@@ -64,8 +559,7 @@ static int load_xdp_program(const char *ifname, const char *filename)
     // Get program file descriptor
     prog_fd = bpf_program__fd(prog);
     if (prog_fd < 0) {
-        fprintf(stderr, "Failed to get program FD: %s\n", 
-                libbpf_strerror(prog_fd));
+        fprintf(stderr, "Failed to get program FD: %s\n", strerror(-prog_fd));
         return -1;
     }
     
@@ -76,205 +570,2557 @@ static int load_xdp_program(const char *ifname, const char *filename)
         return -1;
     }
     
-    link = bpf_program__attach_xdp(prog, ifindex);
-    if (libbpf_get_error(link)) {
-        fprintf(stderr, "Failed to attach XDP program: %s\n", 
-                libbpf_strerror(libbpf_get_error(link)));
-        return -1;
-    }
-    
-    printf("XDP program attached to interface %s\n", ifname);
-    
     // Get map file descriptors
-    map_protected_endpoints_fd = bpf_object__find_map_fd_by_name(obj, "map_protected_endpoints");
+    endpoint_table_fds[0] = bpf_object__find_map_fd_by_name(obj, "map_protected_endpoints");
+    endpoint_table_fds[1] = bpf_object__find_map_fd_by_name(obj, "map_protected_endpoints_alt");
+    map_endpoint_tables_fd = bpf_object__find_map_fd_by_name(obj, "map_endpoint_tables");
+    map_endpoint_gen_fd = bpf_object__find_map_fd_by_name(obj, "map_endpoint_gen");
+    map_protected_prefixes_fd = bpf_object__find_map_fd_by_name(obj, "map_protected_prefixes");
+    map_endpoint_state_fd = bpf_object__find_map_fd_by_name(obj, "map_endpoint_state");
+    map_endpoint_mode_fd = bpf_object__find_map_fd_by_name(obj, "map_endpoint_mode");
+    map_events_fd = bpf_object__find_map_fd_by_name(obj, "map_events");
+    map_event_sample_fd = bpf_object__find_map_fd_by_name(obj, "map_event_sample");
+    map_endpoint_counters_fd = bpf_object__find_map_fd_by_name(obj, "map_endpoint_counters");
     map_src_rate_fd = bpf_object__find_map_fd_by_name(obj, "map_src_rate");
+    map_src_rate_percpu_fd = bpf_object__find_map_fd_by_name(obj, "map_src_rate_percpu");
+    map_src_share_fd = bpf_object__find_map_fd_by_name(obj, "map_src_share");
+    map_subnet_rate_fd = bpf_object__find_map_fd_by_name(obj, "map_subnet_rate");
+    map_subnet_rate_percpu_fd = bpf_object__find_map_fd_by_name(obj, "map_subnet_rate_percpu");
     map_conntrack_fd = bpf_object__find_map_fd_by_name(obj, "map_conntrack");
     map_blacklist_fd = bpf_object__find_map_fd_by_name(obj, "map_blacklist");
     map_stats_fd = bpf_object__find_map_fd_by_name(obj, "map_stats");
-    map_udp_challenges_fd = bpf_object__find_map_fd_by_name(obj, "map_udp_challenges");
+    map_config_fd = bpf_object__find_map_fd_by_name(obj, "map_config");
+    xsks_fd = bpf_object__find_map_fd_by_name(obj, "xsks");
+    map_origin_reverse_fd = bpf_object__find_map_fd_by_name(obj, "map_origin_reverse");
+    map_cookie_secrets_fd = bpf_object__find_map_fd_by_name(obj, "map_cookie_secrets");
+    map_stages_fd = bpf_object__find_map_fd_by_name(obj, "map_stages");
     
-    if (map_protected_endpoints_fd < 0 || map_src_rate_fd < 0 || 
-        map_conntrack_fd < 0 || map_blacklist_fd < 0 || map_stats_fd < 0 ||
-        map_udp_challenges_fd < 0) {
+    if (endpoint_table_fds[0] < 0 || endpoint_table_fds[1] < 0 ||
+        map_endpoint_tables_fd < 0 || map_endpoint_gen_fd < 0 ||
+        map_protected_prefixes_fd < 0 ||
+        map_endpoint_state_fd < 0 || map_endpoint_mode_fd < 0 ||
+        map_endpoint_counters_fd < 0 ||
+        map_events_fd < 0 || map_event_sample_fd < 0 || map_src_rate_fd < 0 ||
+        map_src_rate_percpu_fd < 0 || map_src_share_fd < 0 || map_subnet_rate_fd < 0 ||
+        map_subnet_rate_percpu_fd < 0 || map_conntrack_fd < 0 ||
+        map_blacklist_fd < 0 || map_stats_fd < 0 ||
+        map_config_fd < 0 || xsks_fd < 0 ||
+        map_origin_reverse_fd < 0 || map_cookie_secrets_fd < 0 ||
+        map_stages_fd < 0) {
         fprintf(stderr, "Failed to get map file descriptors\n");
         return -1;
     }
     
-    return 0;
-}
-
-// Add protected endpoint
-int add_protected_endpoint(__u32 front_ip, __u16 front_port, __u8 protocol,
-                          __u32 origin_ip, __u16 origin_port, __u8 protocol_type,
-                          __u32 rate_limit, __u32 burst_limit)
-{
-    struct endpoint_key key = {
-        .prefix_len = 32,
-        .ip = front_ip,
-        .port = front_port,
-        .protocol = protocol
-    };
+    // Also publishes the XSKMAP so xsk_consumer processes can register sockets
+    if (pin_state_maps(obj))
+        return -1;
     
-    struct endpoint_info info = {
-        .origin_ip = origin_ip,
-        .origin_port = origin_port,
-        .rate_limit = rate_limit,
-        .burst_limit = burst_limit,
-        .protocol_type = protocol_type,
-        .maintenance_mode = 0,
-        .padding = {0, 0}
+    // Configure the dataplane before it sees its first packet
+    __u32 config_key = 0;
+    struct dataplane_config config = {
+        .nr_cpus = nr_cpus,
+        .rate_limit_mode = opts->rate_limit_mode
     };
+    // A reload keeps the GUID clients have cached. The prefix count comes
+    // from the trie itself, which may have been recreated empty.
+    struct dataplane_config prev;
+    config.endpoint_prefixes = count_endpoint_prefixes();
+    if (bpf_map_lookup_elem(map_config_fd, &config_key, &prev) == 0 && prev.nr_cpus) {
+        config.raknet_guid = prev.raknet_guid;
+    } else if (getrandom(&config.raknet_guid, sizeof(config.raknet_guid), 0) !=
+               sizeof(config.raknet_guid)) {
+        fprintf(stderr, "Failed to generate RakNet GUID: %s\n", strerror(errno));
+        return -1;
+    }
+    if (bpf_map_update_elem(map_config_fd, &config_key, &config, BPF_ANY)) {
+        fprintf(stderr, "Failed to write dataplane config: %s\n", strerror(errno));
+        return -1;
+    }
     
-    int err = bpf_map_update_elem(map_protected_endpoints_fd, &key, &info, BPF_ANY);
-    if (err) {
-        fprintf(stderr, "Failed to add protected endpoint: %s\n", strerror(errno));
+    // Fill both cookie slots so nothing is ever keyed with zeros. Reused
+    // secrets are kept so cookies already handed out still validate.
+    __u32 secret_key = COOKIE_SECRET_CURRENT;
+    struct cookie_secret secret = {0}, no_secret = {0};
+    bpf_map_lookup_elem(map_cookie_secrets_fd, &secret_key, &secret);
+    if (!memcmp(&secret, &no_secret, sizeof(secret)) &&
+        (rotate_cookie_secrets() || rotate_cookie_secrets()))
+        return -1;
+    
+    events = ring_buffer__new(map_events_fd, handle_event, NULL, NULL);
+    if (!events) {
+        fprintf(stderr, "Failed to create event ring buffer: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    // Drop events are only sampled while someone collects them
+    if (opts->events_url) {
+        event_aggs = calloc(EVENT_AGG_SLOTS, sizeof(*event_aggs));
+        endpoint_reported = calloc(ENDPOINT_ID_MAX, sizeof(*endpoint_reported));
+        if (!event_aggs || !endpoint_reported) {
+            fprintf(stderr, "Failed to allocate event aggregation table\n");
+            return -1;
+        }
+        if (start_event_poster(opts))
+            return -1;
+        for (__u32 reason = 0; reason < STAT_MAX; reason++) {
+            __u32 rate = drop_reason_names[reason] ? opts->event_sample[reason] : 0;
+            if (bpf_map_update_elem(map_event_sample_fd, &reason, &rate, BPF_ANY)) {
+                fprintf(stderr, "Failed to set event sampling: %s\n", strerror(errno));
+                return -1;
+            }
+        }
+    }
+    
+    if (init_endpoint_tables())
         return -1;
+    
+    // The pipeline must be complete before the first packet enters it
+    for (__u32 stage = 0; stage < STAGE_MAX; stage++) {
+        if (install_stage(obj, stage))
+            return -1;
     }
     
-    printf("Added protected endpoint: %u.%u.%u.%u:%u -> %u.%u.%u.%u:%u\n",
-           (front_ip >> 24) & 0xFF, (front_ip >> 16) & 0xFF, 
-           (front_ip >> 8) & 0xFF, front_ip & 0xFF, front_port,
-           (origin_ip >> 24) & 0xFF, (origin_ip >> 16) & 0xFF, 
-           (origin_ip >> 8) & 0xFF, origin_ip & 0xFF, origin_port);
+    swapped = attach_xdp_link(prog, ifindex);
+    if (swapped < 0)
+        return -1;
+    
+    printf("XDP program %s interface %s (%s rate limiting, %d maps carried over)\n",
+           swapped ? "swapped in on" : "attached to", ifname,
+           opts->rate_limit_mode == RATE_LIMIT_PERCPU ? "per-CPU" : "shared", reused);
     
     return 0;
 }
 
-// Remove protected endpoint
-int remove_protected_endpoint(__u32 front_ip, __u16 front_port, __u8 protocol)
+// Walk every entry of a hash map in batches of MAP_BATCH_SIZE. value_size is
+// the full user-space value size (already multiplied out for per-CPU maps).
+// fn returns < 0 to abort with an error, > 0 to stop early.
+typedef int (*map_batch_fn)(void *keys, void *values, __u32 count, void *ctx);
+
+static int walk_map_batched(int map_fd, size_t key_size, size_t value_size,
+                            map_batch_fn fn, void *ctx)
 {
-    struct endpoint_key key = {
-        .prefix_len = 32,
-        .ip = front_ip,
-        .port = front_port,
-        .protocol = protocol
-    };
+    void *keys = calloc(MAP_BATCH_SIZE, key_size);
+    void *values = calloc(MAP_BATCH_SIZE, value_size);
+    __u32 batch, count;
+    void *in_batch = NULL;
+    int err = 0;
     
-    int err = bpf_map_delete_elem(map_protected_endpoints_fd, &key);
-    if (err) {
-        fprintf(stderr, "Failed to remove protected endpoint: %s\n", strerror(errno));
-        return -1;
+    if (!keys || !values) {
+        free(keys);
+        free(values);
+        return -ENOMEM;
+    }
+    
+    for (;;) {
+        count = MAP_BATCH_SIZE;
+        int ret = bpf_map_lookup_batch(map_fd, in_batch, &batch, keys, values, &count, NULL);
+        int done = ret && errno == ENOENT;
+        if (ret && !done) {
+            err = -errno;
+            break;
+        }
+        if (count > 0 && (err = fn(keys, values, count, ctx)) != 0)
+            break;
+        if (done)
+            break;
+        in_batch = &batch;
     }
     
-    printf("Removed protected endpoint: %u.%u.%u.%u:%u\n",
-           (front_ip >> 24) & 0xFF, (front_ip >> 16) & 0xFF, 
-           (front_ip >> 8) & 0xFF, front_ip & 0xFF, front_port);
+    free(keys);
+    free(values);
+    return err < 0 ? err : 0;
+}
+
+// Shift each hot source's per-CPU budget towards the CPUs its packets land
+// on. RSS usually pins a single source to one queue, so an even split would
+// otherwise leave that CPU with 1/nr_cpus of the configured limit. Idle CPUs
+// keep a floor so a source moving queues is not starved until the next
+// rebalance, and all shares are scaled to sum to exactly RATE_SHARE_SCALE so
+// the CPUs together never grant more than the configured limit. Only
+// map_src_share is written; the rate state itself belongs to the datapath.
+static int rebalance_batch(void *keys, void *values, __u32 count, void *ctx)
+{
+    struct rate_limit_state *states = values;
+    struct rate_share *shares = ctx;
+    __u32 floor_share = RATE_SHARE_SCALE / (4 * nr_cpus);
+    
+    if (floor_share == 0)
+        floor_share = 1;
     
+    for (__u32 i = 0; i < count; i++) {
+        struct rate_limit_state *percpu = &states[(size_t)i * nr_cpus];
+        struct ip_addr *key = (struct ip_addr *)keys + i;
+        __u64 total = 0, weight_sum = 0;
+        
+        // Cumulative hits below the threshold cannot have enough new ones
+        for (int cpu = 0; cpu < nr_cpus; cpu++)
+            total += percpu[cpu].hits;
+        if (total < REBALANCE_MIN_HITS)
+            continue;
+        
+        if (bpf_map_lookup_elem(map_src_share_fd, key, shares))
+            memset(shares, 0, sizeof(*shares) * nr_cpus);
+        
+        // A source reclaimed and recreated restarts its hit counters
+        total = 0;
+        for (int cpu = 0; cpu < nr_cpus; cpu++) {
+            __u32 hits = percpu[cpu].hits;
+            shares[cpu].share = hits >= shares[cpu].hits ? hits - shares[cpu].hits : hits;
+            shares[cpu].hits = hits;
+            total += shares[cpu].share;
+        }
+        if (total < REBALANCE_MIN_HITS)
+            continue;
+        
+        for (int cpu = 0; cpu < nr_cpus; cpu++) {
+            __u32 weight = (__u64)shares[cpu].share * RATE_SHARE_SCALE / total;
+            shares[cpu].share = weight < floor_share ? floor_share : weight;
+            weight_sum += shares[cpu].share;
+        }
+        
+        // Rounding leaves the busiest CPU to absorb the remainder
+        int assigned = 0, top = 0;
+        for (int cpu = 0; cpu < nr_cpus; cpu++) {
+            __u32 share = shares[cpu].share * RATE_SHARE_SCALE / weight_sum;
+            shares[cpu].share = share ? share : 1;
+            assigned += shares[cpu].share;
+            if (shares[cpu].share > shares[top].share)
+                top = cpu;
+        }
+        shares[top].share += RATE_SHARE_SCALE - assigned;
+        
+        if (bpf_map_update_elem(map_src_share_fd, key, shares, BPF_ANY))
+            fprintf(stderr, "Failed to rebalance rate shares: %s\n", strerror(errno));
+    }
     return 0;
 }
 
-// Add IP to blacklist
-int add_to_blacklist(__u32 ip, __u64 duration_ms)
+static int rebalance_rate_shares(void)
 {
-    __u64 block_until = (__u64)time(NULL) * 1000 + duration_ms;
+    // One share per CPU must stay representable
+    if (nr_cpus > RATE_SHARE_SCALE / 2)
+        return 0;
     
-    int err = bpf_map_update_elem(map_blacklist_fd, &ip, &block_until, BPF_ANY);
+    struct rate_share *shares = calloc(nr_cpus, sizeof(*shares));
+    if (!shares)
+        return -1;
+    int err = walk_map_batched(map_src_rate_percpu_fd, sizeof(struct ip_addr),
+                               sizeof(struct rate_limit_state) * nr_cpus,
+                               rebalance_batch, shares);
+    free(shares);
     if (err) {
-        fprintf(stderr, "Failed to add IP to blacklist: %s\n", strerror(errno));
+        fprintf(stderr, "Failed to walk per-CPU rate map: %s\n", strerror(-err));
         return -1;
     }
-    
-    printf("Added IP to blacklist: %u.%u.%u.%u (until %llu)\n",
-           (ip >> 24) & 0xFF, (ip >> 16) & 0xFF, 
-           (ip >> 8) & 0xFF, ip & 0xFF, block_until);
-    
     return 0;
 }
 
-// Remove IP from blacklist
-int remove_from_blacklist(__u32 ip)
+// Expiry sweeper. Expired and idle entries are deleted from user space so
+// the datapath never has to; LRU eviction still covers bursts between
+// sweeps. Timestamps in the maps are truncated bpf_ktime_get_coarse_ns() ms;
+// that clock and now_ms() are both CLOCK_MONOTONIC, so they compare
+// directly, as wrapping 32-bit differences.
+struct sweep_ctx {
+    int map_fd;
+    size_t key_size;
+    size_t value_size;
+    __u32 now;
+    __u32 idle_ms;
+    __u32 budget;
+    __u32 reclaimed;
+    int (*expired)(const void *value, const struct sweep_ctx *sc);
+};
+
+static int rate_state_expired(const void *value, const struct sweep_ctx *sc)
 {
-    int err = bpf_map_delete_elem(map_blacklist_fd, &ip);
-    if (err) {
-        fprintf(stderr, "Failed to remove IP from blacklist: %s\n", strerror(errno));
-        return -1;
+    const struct rate_limit_state *state = value;
+    __u32 last_update_ms = state->last_update / 1000000;
+    return (__u32)(sc->now - last_update_ms) >= sc->idle_ms;
+}
+
+// A per-CPU entry is idle only when every CPU's copy is
+static int rate_state_percpu_expired(const void *value, const struct sweep_ctx *sc)
+{
+    const struct rate_limit_state *states = value;
+    for (int cpu = 0; cpu < nr_cpus; cpu++) {
+        if (states[cpu].last_update && !rate_state_expired(&states[cpu], sc))
+            return 0;
     }
+    return 1;
+}
+
+static int conntrack_expired(const void *value, const struct sweep_ctx *sc)
+{
+    const struct conntrack_entry *conn = value;
+    return (__u32)(sc->now - conn->last_seen) >= sc->idle_ms;
+}
+
+static int sweep_batch(void *keys, void *values, __u32 count, void *ctx)
+{
+    struct sweep_ctx *sc = ctx;
+    __u32 n = 0;
     
-    printf("Removed IP from blacklist: %u.%u.%u.%u\n",
-           (ip >> 24) & 0xFF, (ip >> 16) & 0xFF, 
-           (ip >> 8) & 0xFF, ip & 0xFF);
+    // Compact the expired keys to the front of the batch
+    for (__u32 i = 0; i < count && sc->reclaimed + n < sc->budget; i++) {
+        if (!sc->expired((char *)values + i * sc->value_size, sc))
+            continue;
+        if (n != i)
+            memcpy((char *)keys + n * sc->key_size, (char *)keys + i * sc->key_size,
+                   sc->key_size);
+        n++;
+    }
     
-    return 0;
+    // The batch delete stops at the first key the datapath or LRU already
+    // removed; finish the rest one by one
+    __u32 deleted = n;
+    if (n && bpf_map_delete_batch(sc->map_fd, keys, &deleted, NULL)) {
+        for (__u32 i = deleted; i < n; i++) {
+            if (bpf_map_delete_elem(sc->map_fd, (char *)keys + i * sc->key_size) == 0)
+                deleted++;
+        }
+    }
+    
+    sc->reclaimed += deleted;
+    return sc->reclaimed >= sc->budget;
 }
 
-// Get statistics
-int get_stats(__u64 *stats, size_t count)
+static __u32 sweep_hash_map(int map_fd, size_t key_size, size_t value_size, __u32 idle_ms,
+                            __u32 budget, int (*expired)(const void *, const struct sweep_ctx *))
 {
-    for (size_t i = 0; i < count; i++) {
-        __u32 key = i;
-        __u64 *value = bpf_map_lookup_elem(map_stats_fd, &key);
-        if (value) {
-            stats[i] = *value;
-        } else {
-            stats[i] = 0;
+    struct sweep_ctx sc = {
+        .map_fd = map_fd,
+        .key_size = key_size,
+        .value_size = value_size,
+        .now = (__u32)now_ms(),
+        .idle_ms = idle_ms,
+        .budget = budget,
+        .expired = expired
+    };
+    
+    int err = walk_map_batched(map_fd, key_size, value_size, sweep_batch, &sc);
+    if (err)
+        fprintf(stderr, "Failed to sweep map: %s\n", strerror(-err));
+    return sc.reclaimed;
+}
+
+// The blacklist is walked key by key, at most budget keys per sweep,
+// resuming where the previous sweep stopped so a large feed costs a
+// bounded number of syscalls each time. get_next_key() from a key that is
+// gone restarts at the first key, so the key the walk stopped on stays
+// until the next sweep has moved past it, even if it expired.
+static struct {
+    struct blacklist_key key;
+    int valid;    // the walk resumes after key
+    int expired;  // delete key once the walk has left it
+} blacklist_cursor;
+
+static __u32 sweep_blacklist(__u32 budget)
+{
+    struct blacklist_key next;
+    __u64 now = now_ms(), until;
+    __u32 n = 0, reclaimed = 0;
+    
+    if (budget > MAP_BATCH_SIZE)
+        budget = MAP_BATCH_SIZE;
+    struct blacklist_key *expired = calloc(budget + 1, sizeof(*expired));
+    if (!expired)
+        return 0;
+    
+    for (__u32 visited = 0; visited < budget; visited++) {
+        int more = bpf_map_get_next_key(map_blacklist_fd,
+                                        blacklist_cursor.valid ? &blacklist_cursor.key : NULL,
+                                        &next) == 0;
+        if (blacklist_cursor.valid && blacklist_cursor.expired)
+            expired[n++] = blacklist_cursor.key;
+        if (!more) {
+            // End of the trie; the next sweep starts over
+            blacklist_cursor.valid = 0;
+            break;
         }
+        blacklist_cursor.key = next;
+        blacklist_cursor.valid = 1;
+        blacklist_cursor.expired = bpf_map_lookup_elem(map_blacklist_fd, &next, &until) == 0 &&
+                                   until != BLACKLIST_FOREVER && until <= now;
     }
-    return 0;
+    
+    for (__u32 i = 0; i < n; i++) {
+        if (bpf_map_delete_elem(map_blacklist_fd, &expired[i]) == 0)
+            reclaimed++;
+    }
+    
+    free(expired);
+    return reclaimed;
 }
 
-// Print statistics
-void print_stats(void)
+static void sweep_maps(const struct loader_options *opts)
 {
-    __u64 stats[12];
-    get_stats(stats, 12);
+    __u32 blacklist = sweep_blacklist(opts->sweep_budget);
+    __u32 rate, conntrack;
     
-    printf("\n=== CloudNordSP Statistics ===\n");
-    printf("Total packets processed: %llu\n", stats[6]);
-    printf("Allowed packets: %llu\n", stats[0]);
-    printf("Blocked - Rate limit: %llu\n", stats[1]);
-    printf("Blocked - Blacklist: %llu\n", stats[2]);
-    printf("Blocked - Invalid protocol: %llu\n", stats[3]);
-    printf("Blocked - Challenge failed: %llu\n", stats[4]);
-    printf("Blocked - Maintenance: %llu\n", stats[5]);
-    printf("XDP drops: %llu\n", stats[7]);
-    printf("XDP passes: %llu\n", stats[8]);
-    printf("XDP redirects: %llu\n", stats[9]);
-    printf("UDP challenges sent: %llu\n", stats[10]);
-    printf("UDP challenges passed: %llu\n", stats[11]);
-    printf("==============================\n");
+    if (opts->rate_limit_mode == RATE_LIMIT_PERCPU) {
+        rate = sweep_hash_map(map_src_rate_percpu_fd, sizeof(struct ip_addr),
+                              sizeof(struct rate_limit_state) * nr_cpus, opts->rate_idle_ms,
+                              opts->sweep_budget, rate_state_percpu_expired);
+        rate += sweep_hash_map(map_subnet_rate_percpu_fd, sizeof(struct ip_addr),
+                               sizeof(struct rate_limit_state) * nr_cpus, opts->rate_idle_ms,
+                               opts->sweep_budget, rate_state_percpu_expired);
+    } else {
+        rate = sweep_hash_map(map_src_rate_fd, sizeof(struct ip_addr),
+                              sizeof(struct rate_limit_state), opts->rate_idle_ms,
+                              opts->sweep_budget, rate_state_expired);
+        rate += sweep_hash_map(map_subnet_rate_fd, sizeof(struct ip_addr),
+                               sizeof(struct rate_limit_state), opts->rate_idle_ms,
+                               opts->sweep_budget, rate_state_expired);
+    }
+    conntrack = sweep_hash_map(map_conntrack_fd, sizeof(__u64), sizeof(struct conntrack_entry),
+                               opts->conntrack_idle_ms, opts->sweep_budget, conntrack_expired);
+    
+    if (blacklist || rate || conntrack)
+        printf("Swept %u blacklist, %u rate limit, %u conntrack entries\n",
+               blacklist, rate, conntrack);
 }
 
-// Cleanup
-void cleanup(void)
+int get_stats(__u64 *stats, size_t count);
+
+// Minimal HTTP/1.1 POST of a JSON body to an http://host[:port]/path URL.
+// Only the status line of the reply is read.
+static int http_post_json(const char *url, const char *token, const char *body, size_t len,
+                          __u32 timeout_ms)
 {
-    if (obj) {
-        bpf_object__close(obj);
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM}, *res, *ai;
+    struct timeval tv = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+    char host[256], port[8] = "80", header[1024], status[32];
+    int fd = -1;
+    
+    if (strncmp(url, "http://", 7) != 0) {
+        fprintf(stderr, "Unsupported event URL: %s\n", url);
+        return -1;
+    }
+    const char *authority = url + 7;
+    const char *path = strchr(authority, '/');
+    size_t host_len = path ? (size_t)(path - authority) : strlen(authority);
+    if (!path)
+        path = "/";
+    if (host_len == 0 || host_len >= sizeof(host)) {
+        fprintf(stderr, "Invalid event URL: %s\n", url);
+        return -1;
+    }
+    memcpy(host, authority, host_len);
+    host[host_len] = '\0';
+    char *colon = strrchr(host, ':');
+    if (colon) {
+        *colon = '\0';
+        snprintf(port, sizeof(port), "%s", colon + 1);
+    }
+    
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err) {
+        fprintf(stderr, "Failed to resolve %s: %s\n", host, gai_strerror(err));
+        return -1;
+    }
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to connect to %s:%s: %s\n", host, port, strerror(errno));
+        return -1;
+    }
+    
+    int n = snprintf(header, sizeof(header),
+                     "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+                     "Content-Length: %zu\r\n%s%s%sConnection: close\r\n\r\n",
+                     path, host, len, token ? "Authorization: Bearer " : "",
+                     token ? token : "", token ? "\r\n" : "");
+    int ok = n > 0 && (size_t)n < sizeof(header) &&
+             send(fd, header, n, MSG_NOSIGNAL) == n &&
+             send(fd, body, len, MSG_NOSIGNAL) == (ssize_t)len;
+    
+    ssize_t got = ok ? recv(fd, status, sizeof(status) - 1, 0) : -1;
+    close(fd);
+    if (got < 12) {
+        fprintf(stderr, "Failed to post events to %s\n", url);
+        return -1;
+    }
+    status[got] = '\0';
+    if (strncmp(status, "HTTP/1.", 7) != 0 || status[9] != '2') {
+        fprintf(stderr, "Control plane rejected events: %.12s\n", status);
+        return -1;
     }
+    return 0;
 }
 
-// Main function for CLI usage
-int main(int argc, char *argv[])
+static void *event_poster_run(void *arg)
 {
-    if (argc < 3) {
-        printf("Usage: %s <interface> <command> [args...]\n", argv[0]);
-        printf("Commands:\n");
-        printf("  load <xdp_file>                    - Load XDP program\n");
-        printf("  add-endpoint <front_ip> <front_port> <protocol> <origin_ip> <origin_port> <type> <rate> <burst>\n");
-        printf("  remove-endpoint <front_ip> <front_port> <protocol>\n");
-        printf("  blacklist <ip> <duration_ms>\n");
-        printf("  unblacklist <ip>\n");
-        printf("  stats\n");
-        return 1;
-    }
+    const struct loader_options *opts = arg;
+    __u32 timeout_ms = EVENT_POST_TIMEOUT_MS;
     
-    const char *ifname = argv[1];
-    const char *command = argv[2];
+    // A post never outlives the interval in which the next batch is built
+    if (opts->events_interval_ms && opts->events_interval_ms < timeout_ms)
+        timeout_ms = opts->events_interval_ms;
     
-    if (strcmp(command, "load") == 0) {
-        if (argc < 4) {
-            printf("Usage: %s <interface> load <xdp_file>\n", argv[0]);
-            return 1;
+    pthread_mutex_lock(&event_poster.lock);
+    while (!event_poster.stop) {
+        if (!event_poster.body) {
+            pthread_cond_wait(&event_poster.wake, &event_poster.lock);
+            continue;
         }
+        char *body = event_poster.body;
+        size_t len = event_poster.len;
+        event_poster.body = NULL;
+        event_poster.busy = 1;
+        pthread_mutex_unlock(&event_poster.lock);
         
-        if (load_xdp_program(ifname, argv[3]) < 0) {
-            return 1;
-        }
+        http_post_json(opts->events_url, opts->events_token, body, len, timeout_ms);
+        free(body);
         
-        // Keep running to maintain the program
-        printf("XDP program loaded. Press Ctrl+C to stop.\n");
-        while (1) {
-            sleep(1);
+        pthread_mutex_lock(&event_poster.lock);
+        event_poster.busy = 0;
+    }
+    pthread_mutex_unlock(&event_poster.lock);
+    return NULL;
+}
+
+static int start_event_poster(const struct loader_options *opts)
+{
+    int err = pthread_create(&event_poster.thread, NULL, event_poster_run, (void *)opts);
+    if (err) {
+        fprintf(stderr, "Failed to start event poster: %s\n", strerror(err));
+        return -1;
+    }
+    event_poster.started = 1;
+    return 0;
+}
+
+// Waits for a post in flight, which the timeout bounds
+static void stop_event_poster(void)
+{
+    if (!event_poster.started)
+        return;
+    pthread_mutex_lock(&event_poster.lock);
+    event_poster.stop = 1;
+    pthread_cond_signal(&event_poster.wake);
+    pthread_mutex_unlock(&event_poster.lock);
+    pthread_join(event_poster.thread, NULL);
+    free(event_poster.body);
+    event_poster.body = NULL;
+    event_poster.started = 0;
+}
+
+// Queue a batch for the poster, which takes ownership of body. A batch
+// that finds the previous one still in flight is dropped like a failed post.
+static void post_events(char *body, size_t len)
+{
+    int queued = 0;
+    
+    pthread_mutex_lock(&event_poster.lock);
+    if (!event_poster.busy && !event_poster.body) {
+        event_poster.body = body;
+        event_poster.len = len;
+        pthread_cond_signal(&event_poster.wake);
+        queued = 1;
+    }
+    pthread_mutex_unlock(&event_poster.lock);
+    
+    if (!queued) {
+        fprintf(stderr, "Previous event post still running, dropping batch\n");
+        free(body);
+    }
+}
+
+// Per-endpoint counters summed over CPUs, with the front address each id
+// belongs to
+struct endpoint_export {
+    struct endpoint_counters *totals;  // by endpoint id
+    union endpoint_any_key *keys;      // by endpoint id
+    __u8 *kind;                        // ENDPOINT_EXPORT_*
+};
+
+enum {
+    ENDPOINT_EXPORT_NONE,
+    ENDPOINT_EXPORT_EXACT,
+    ENDPOINT_EXPORT_PREFIX
+};
+
+static int sum_endpoint_counters(void *keys, void *values, __u32 count, void *ctx)
+{
+    struct endpoint_export *ex = ctx;
+    const __u32 *ids = keys;
+    const struct endpoint_counters *percpu = values;
+    
+    for (__u32 i = 0; i < count; i++) {
+        if (ids[i] >= ENDPOINT_ID_MAX)
+            continue;
+        // Every field is a __u64 counter
+        __u64 *total = (__u64 *)&ex->totals[ids[i]];
+        for (int cpu = 0; cpu < nr_cpus; cpu++) {
+            const __u64 *c = (const __u64 *)&percpu[i * nr_cpus + cpu];
+            for (size_t k = 0; k < sizeof(struct endpoint_counters) / sizeof(__u64); k++)
+                total[k] += c[k];
+        }
+    }
+    return 0;
+}
+
+static void label_endpoint_ids(int map_fd, __u8 kind, struct endpoint_export *ex)
+{
+    union endpoint_any_key key, next;
+    struct endpoint_info info;
+    void *prev = NULL;
+    
+    while (bpf_map_get_next_key(map_fd, prev, &next) == 0) {
+        if (bpf_map_lookup_elem(map_fd, &next, &info) == 0 &&
+            info.endpoint_id < ENDPOINT_ID_MAX) {
+            ex->keys[info.endpoint_id] = next;
+            ex->kind[info.endpoint_id] = kind;
+        }
+        key = next;
+        prev = &key;
+    }
+}
+
+// Append the counters that moved since the last flush as a JSON array.
+// Counters of a reused id restart from zero, so a total below the last
+// reported one counts from zero.
+static size_t format_endpoint_counters(char *buf, size_t cap, const struct endpoint_export *ex)
+{
+    size_t len = snprintf(buf, cap, "[");
+    int first = 1;
+    
+    for (__u32 id = 0; id < ENDPOINT_ID_MAX; id++) {
+        if (ex->kind[id] == ENDPOINT_EXPORT_NONE)
+            continue;
+        
+        struct endpoint_counters delta;
+        const __u64 *cur = (const __u64 *)&ex->totals[id];
+        const __u64 *last = (const __u64 *)&endpoint_reported[id];
+        __u64 *d = (__u64 *)&delta, moved = 0;
+        for (size_t k = 0; k < sizeof(delta) / sizeof(__u64); k++) {
+            d[k] = cur[k] >= last[k] ? cur[k] - last[k] : cur[k];
+            moved |= d[k];
+        }
+        endpoint_reported[id] = ex->totals[id];
+        if (!moved)
+            continue;
+        
+        const union endpoint_any_key *key = &ex->keys[id];
+        int prefix = ex->kind[id] == ENDPOINT_EXPORT_PREFIX;
+        char ip[INET6_ADDRSTRLEN + 4];
+        format_ip_addr(prefix ? &key->prefix.ip : &key->exact.ip, ip, INET6_ADDRSTRLEN);
+        if (prefix) {
+            __u32 bits = key->prefix.prefix_len - ENDPOINT_PREFIX_HDR_BITS;
+            if (ip_addr_is_v4(&key->prefix.ip))
+                bits -= 96;
+            snprintf(ip + strlen(ip), sizeof(ip) - strlen(ip), "/%u", bits);
+        }
+        __u16 port = prefix ? key->prefix.port : key->exact.port;
+        __u8 protocol = prefix ? key->prefix.protocol : key->exact.protocol;
+        
+        len += snprintf(buf + len, cap - len,
+                        "%s{\"front_ip\":\"%s\",\"front_port\":%u,\"protocol\":\"%s\","
+                        "\"allowed_packets\":%llu,\"allowed_bytes\":%llu,"
+                        "\"dropped_bytes\":%llu,\"dropped\":{",
+                        first ? "" : ",", ip, port, protocol == IPPROTO_TCP ? "tcp" : "udp",
+                        delta.allowed_packets, delta.allowed_bytes, delta.dropped_bytes);
+        for (int r = 0; r < ENDPOINT_DROP_MAX; r++)
+            len += snprintf(buf + len, cap - len, "%s\"%s\":%llu", r ? "," : "",
+                            endpoint_drop_names[r], delta.dropped[r]);
+        len += snprintf(buf + len, cap - len, "}}");
+        first = 0;
+    }
+    
+    len += snprintf(buf + len, cap - len, "]");
+    return len;
+}
+
+// Send the drops aggregated since the last flush, with sample counts scaled
+// back up by their sampling rate, and the per-endpoint counters read with
+// batched lookups. Events lost to a full ring buffer or a full table are
+// reported alongside so the control plane can tell sampling from loss. A
+// failed or dropped post loses the batch; the datapath counters still hold
+// the exact totals. The post itself runs on the poster thread.
+static void flush_events(const struct loader_options *opts)
+{
+    struct endpoint_export ex = {
+        .totals = calloc(ENDPOINT_ID_MAX, sizeof(*ex.totals)),
+        .keys = calloc(ENDPOINT_ID_MAX, sizeof(*ex.keys)),
+        .kind = calloc(ENDPOINT_ID_MAX, sizeof(*ex.kind))
+    };
+    __u64 stats[STAT_MAX];
+    __u64 lost = event_agg_overflow;
+    __u32 endpoints = 0;
+    char *body = NULL;
+    
+    if (!ex.totals || !ex.keys || !ex.kind)
+        goto out;
+    
+    if (get_stats(stats, STAT_MAX) == 0) {
+        lost += stats[STAT_EVENTS_LOST] - events_lost_reported;
+        events_lost_reported = stats[STAT_EVENTS_LOST];
+    }
+    
+    int err = walk_map_batched(map_endpoint_counters_fd, sizeof(__u32),
+                               sizeof(struct endpoint_counters) * nr_cpus,
+                               sum_endpoint_counters, &ex);
+    if (err) {
+        // Partial totals would read as counter resets; skip endpoints this time
+        fprintf(stderr, "Failed to read endpoint counters: %s\n", strerror(-err));
+    } else {
+        label_endpoint_ids(map_protected_endpoints_fd, ENDPOINT_EXPORT_EXACT, &ex);
+        label_endpoint_ids(map_protected_prefixes_fd, ENDPOINT_EXPORT_PREFIX, &ex);
+    }
+    for (__u32 id = 0; id < ENDPOINT_ID_MAX; id++)
+        endpoints += ex.kind[id] != ENDPOINT_EXPORT_NONE;
+    
+    // Each event formats to well under 256 bytes, each endpoint under 512
+    size_t cap = (size_t)event_agg_count * 256 + (size_t)endpoints * 512 + 64, len = 0;
+    body = malloc(cap);
+    if (!body)
+        goto out;
+    
+    len += snprintf(body + len, cap - len, "{\"lost\":%llu,\"endpoints\":", lost);
+    size_t endpoints_off = len;
+    len += format_endpoint_counters(body + len, cap - len, &ex);
+    if (event_agg_count == 0 && lost == 0 && len - endpoints_off <= 2)
+        goto out;  // nothing happened
+    len += snprintf(body + len, cap - len, ",\"events\":[");
+    for (__u32 i = 0, first = 1; i < EVENT_AGG_SLOTS; i++) {
+        const struct event_agg *agg = &event_aggs[i];
+        char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+        if (!agg->used)
+            continue;
+        __u32 rate = opts->event_sample[agg->reason];
+        format_ip_addr(&agg->src, src, sizeof(src));
+        format_ip_addr(&agg->dst, dst, sizeof(dst));
+        len += snprintf(body + len, cap - len,
+                        "%s{\"front_ip\":\"%s\",\"front_port\":%u,\"protocol\":\"%s\","
+                        "\"source_ip\":\"%s\",\"reason\":\"%s\",\"count\":%llu}",
+                        first ? "" : ",", dst, agg->dport,
+                        agg->protocol == IPPROTO_TCP ? "tcp" : "udp", src,
+                        drop_reason_names[agg->reason] ? drop_reason_names[agg->reason] : "other",
+                        agg->samples * (rate ? rate : 1));
+        first = 0;
+    }
+    len += snprintf(body + len, cap - len, "]}");
+    
+    post_events(body, len);
+    body = NULL;
+    
+out:
+    free(body);
+    free(ex.totals);
+    free(ex.keys);
+    free(ex.kind);
+    memset(event_aggs, 0, EVENT_AGG_SLOTS * sizeof(*event_aggs));
+    event_agg_count = 0;
+    event_agg_overflow = 0;
+}
+
+static void poll_io(int timeout_ms);
+
+// Periodic maintenance while the program is attached
+static void run_loop(const struct loader_options *opts)
+{
+    __u64 next_rebalance = now_ms() + opts->rebalance_interval_ms;
+    __u64 next_cookie_rotate = now_ms() + opts->cookie_rotate_ms;
+    __u64 next_sweep = now_ms() + opts->sweep_interval_ms;
+    __u64 next_events_flush = now_ms() + opts->events_interval_ms;
+    
+    while (!exiting) {
+        __u64 now = now_ms();
+        
+        // Quiesced while a new loader takes over
+        if (handover_slot >= 0) {
+            poll_io(100);
+            continue;
+        }
+        
+        if (opts->rate_limit_mode == RATE_LIMIT_PERCPU && now >= next_rebalance) {
+            rebalance_rate_shares();
+            next_rebalance = now + opts->rebalance_interval_ms;
+        }
+        
+        if (now >= next_cookie_rotate) {
+            rotate_cookie_secrets();
+            next_cookie_rotate = now + opts->cookie_rotate_ms;
+        }
+        
+        if (opts->sweep_interval_ms && now >= next_sweep) {
+            sweep_maps(opts);
+            next_sweep = now_ms() + opts->sweep_interval_ms;
+        }
+        
+        if (event_aggs && now >= next_events_flush) {
+            flush_events(opts);
+            next_events_flush = now_ms() + opts->events_interval_ms;
+        }
+        
+        // Waits up to 100ms for datapath events and control requests
+        poll_io(100);
+    }
+}
+
+// Parse an IPv4 or IPv6 address; IPv4 is stored IPv4-mapped
+static int parse_ip_addr(const char *str, struct ip_addr *addr)
+{
+    struct in_addr v4;
+    
+    if (inet_pton(AF_INET, str, &v4) == 1) {
+        ip_addr_set_v4(addr, v4.s_addr);
+        return 0;
+    }
+    if (inet_pton(AF_INET6, str, addr) == 1)
+        return 0;
+    
+    fprintf(stderr, "Invalid IP address: %s\n", str);
+    return -1;
+}
+
+// Clear the host bits below a 128-bit prefix length
+static void mask_ip_addr(struct ip_addr *addr, __u32 len)
+{
+    for (int i = 0; i < 4; i++) {
+        int bits = (int)len - i * 32;
+        if (bits >= 32)
+            continue;
+        addr->w[i] &= bits <= 0 ? 0 : htonl(~0U << (32 - bits));
+    }
+}
+
+// Parse "addr" or "addr/len". The prefix length is returned in 128-bit
+// terms (IPv4 /24 is 120) and host bits are cleared.
+static int parse_ip_prefix(const char *str, struct ip_addr *addr, __u32 *prefix_len)
+{
+    char buf[INET6_ADDRSTRLEN + 4];
+    char *slash;
+    
+    if (strlen(str) >= sizeof(buf)) {
+        fprintf(stderr, "Invalid IP prefix: %s\n", str);
+        return -1;
+    }
+    strcpy(buf, str);
+    slash = strchr(buf, '/');
+    if (slash)
+        *slash = '\0';
+    
+    if (parse_ip_addr(buf, addr))
+        return -1;
+    
+    int v4 = ip_addr_is_v4(addr);
+    __u32 max_len = v4 ? 32 : 128;
+    __u32 len = max_len;
+    if (slash) {
+        char *end;
+        len = strtoul(slash + 1, &end, 10);
+        if (*end || end == slash + 1 || len > max_len) {
+            fprintf(stderr, "Invalid prefix length: %s\n", str);
+            return -1;
+        }
+    }
+    if (v4)
+        len += 96;
+    
+    mask_ip_addr(addr, len);
+    *prefix_len = len;
+    return 0;
+}
+
+// Track how many prefix endpoints exist; the datapath skips the LPM lookup
+// while there are none
+static int adjust_endpoint_prefixes(int delta)
+{
+    __u32 config_key = 0;
+    struct dataplane_config config;
+    
+    if (bpf_map_lookup_elem(map_config_fd, &config_key, &config))
+        return -1;
+    if (delta < 0 && config.endpoint_prefixes < (__u32)-delta)
+        config.endpoint_prefixes = 0;
+    else
+        config.endpoint_prefixes += delta;
+    return bpf_map_update_elem(map_config_fd, &config_key, &config, BPF_ANY);
+}
+
+static void mark_endpoint_ids(int map_fd, __u8 *used)
+{
+    union endpoint_any_key key, next;
+    struct endpoint_info info;
+    void *prev = NULL;
+    
+    while (bpf_map_get_next_key(map_fd, prev, &next) == 0) {
+        if (bpf_map_lookup_elem(map_fd, &next, &info) == 0 &&
+            info.endpoint_id < ENDPOINT_ID_MAX)
+            used[info.endpoint_id / 8] |= 1 << (info.endpoint_id % 8);
+        key = next;
+        prev = &key;
+    }
+}
+
+// Endpoint ids index per-endpoint state. A replaced endpoint keeps its id
+// and its budgets; a new one takes the lowest id no endpoint map uses
+// and starts from a cleared state slot.
+static int assign_endpoint_id(int map_fd, const void *key, __u32 *id)
+{
+    __u8 *used = endpoint_ids_used;
+    struct endpoint_info existing;
+    
+    if (bpf_map_lookup_elem(map_fd, key, &existing) == 0) {
+        *id = existing.endpoint_id;
+        return 0;
+    }
+    
+    // Endpoints carried over from a previous generation hold their ids
+    if (!endpoint_ids_loaded) {
+        for (int t = 0; t < ENDPOINT_TABLES; t++)
+            mark_endpoint_ids(endpoint_table_fds[t], used);
+        mark_endpoint_ids(map_protected_prefixes_fd, used);
+        endpoint_ids_loaded = 1;
+    }
+    
+    for (__u32 i = 0; i < ENDPOINT_ID_MAX; i++) {
+        if (used[i / 8] & (1 << (i % 8)))
+            continue;
+        
+        struct endpoint_state *zero = calloc(nr_cpus, sizeof(*zero));
+        struct endpoint_counters *counters = calloc(nr_cpus, sizeof(*counters));
+        struct endpoint_mode mode = {0};
+        if (!zero || !counters) {
+            free(zero);
+            free(counters);
+            return -1;
+        }
+        int err = bpf_map_update_elem(map_endpoint_state_fd, &i, zero, BPF_ANY) ||
+                  bpf_map_update_elem(map_endpoint_mode_fd, &i, &mode, BPF_ANY) ||
+                  bpf_map_update_elem(map_endpoint_counters_fd, &i, counters, BPF_ANY);
+        free(zero);
+        free(counters);
+        endpoint_under_attack[i] = 0;
+        if (endpoint_reported)
+            memset(&endpoint_reported[i], 0, sizeof(*endpoint_reported));
+        if (err) {
+            fprintf(stderr, "Failed to reset endpoint state: %s\n", strerror(errno));
+            return -1;
+        }
+        used[i / 8] |= 1 << (i % 8);
+        *id = i;
+        return 0;
+    }
+    
+    fprintf(stderr, "No free endpoint id\n");
+    errno = ENOSPC;
+    return -1;
+}
+
+// Protect every address in a prefix. Prefix endpoints cannot use the fast
+// path since replies need a single front address to translate back to.
+static int add_protected_prefix(const struct ip_addr *front, __u32 prefix_len,
+                                __u16 front_port, __u8 protocol,
+                                struct endpoint_info *info)
+{
+    struct endpoint_prefix_key key = {
+        .prefix_len = ENDPOINT_PREFIX_HDR_BITS + prefix_len,
+        .port = front_port,
+        .protocol = protocol,
+        .ip = *front
+    };
+    struct endpoint_info existing;
+    
+    if (info->flags & ENDPOINT_F_FAST_PATH) {
+        fprintf(stderr, "Fast path requires a single front address\n");
+        return -1;
+    }
+    
+    int is_new = bpf_map_lookup_elem(map_protected_prefixes_fd, &key, &existing) != 0;
+    if (assign_endpoint_id(map_protected_prefixes_fd, &key, &info->endpoint_id))
+        return -1;
+    if (bpf_map_update_elem(map_protected_prefixes_fd, &key, info, BPF_ANY)) {
+        fprintf(stderr, "Failed to add protected prefix: %s\n", strerror(errno));
+        return -1;
+    }
+    if (is_new && adjust_endpoint_prefixes(1)) {
+        fprintf(stderr, "Failed to update dataplane config: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Return an endpoint's id to endpoint_ids_used once its map entry is gone
+static void release_endpoint_id(__u32 id)
+{
+    if (id < ENDPOINT_ID_MAX)
+        endpoint_ids_used[id / 8] &= ~(1 << (id % 8));
+}
+
+// Exact endpoints are double-buffered. The datapath reads the table
+// map_endpoint_gen selects; the loader writes the standby one and bumps
+// the generation, so every change of a request becomes visible in one
+// step. The same changes are then replayed onto the table just retired.
+// Inside a transaction they stay in the standby table until commit.
+struct endpoint_removal {
+    struct endpoint_key key;
+    struct endpoint_info info;
+};
+
+static struct {
+    int open;
+    int owner;  // ctl_clients slot
+    struct endpoint_removal *removed;  // released once the commit publishes them
+    size_t removed_count, removed_cap;
+} endpoint_txn = { .owner = -1 };
+
+// Set when a replay failed and the standby table no longer matches
+static int endpoint_standby_stale;
+
+static int standby_endpoints_fd(void)
+{
+    return endpoint_table_fds[(endpoint_gen + 1) % ENDPOINT_TABLES];
+}
+
+static int write_endpoint_table(int map_fd, const struct endpoint_key *keys,
+                                const struct endpoint_info *infos, __u32 count)
+{
+    static int no_batch;
+    __u32 n = count;
+    
+    if (count && !no_batch) {
+        LIBBPF_OPTS(bpf_map_batch_opts, opts, .elem_flags = BPF_ANY);
+        if (bpf_map_update_batch(map_fd, keys, infos, &n, &opts) == 0)
+            return 0;
+        if (errno != EINVAL && errno != ENOTSUPP && errno != EOPNOTSUPP) {
+            fprintf(stderr, "Endpoint batch update failed: %s\n", strerror(errno));
+            return -1;
+        }
+        no_batch = 1;
+    }
+    for (n = 0; n < count; n++) {
+        if (bpf_map_update_elem(map_fd, &keys[n], &infos[n], BPF_ANY)) {
+            fprintf(stderr, "Failed to add protected endpoint: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int delete_endpoint_table(int map_fd, const struct endpoint_key *keys, __u32 count)
+{
+    for (__u32 i = 0; i < count; i++) {
+        if (bpf_map_delete_elem(map_fd, &keys[i]) && errno != ENOENT) {
+            fprintf(stderr, "Failed to remove protected endpoint: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int copy_endpoint_batch(void *keys, void *values, __u32 count, void *ctx)
+{
+    return write_endpoint_table(*(int *)ctx, keys, values, count) ? -errno : 0;
+}
+
+// Make the standby table a copy of the active one again
+static int resync_standby_endpoints(void)
+{
+    int standby = standby_endpoints_fd();
+    struct endpoint_key key;
+    int err = 0;
+    
+    endpoint_standby_stale = 1;
+    while (bpf_map_get_next_key(standby, NULL, &key) == 0) {
+        if (bpf_map_delete_elem(standby, &key)) {
+            err = -errno;
+            break;
+        }
+    }
+    if (!err)
+        err = walk_map_batched(map_protected_endpoints_fd, sizeof(struct endpoint_key),
+                               sizeof(struct endpoint_info), copy_endpoint_batch, &standby);
+    if (err) {
+        fprintf(stderr, "Failed to resync standby endpoint table: %s\n", strerror(-err));
+        return -1;
+    }
+    endpoint_standby_stale = 0;
+    return 0;
+}
+
+static int flip_endpoint_gen(void)
+{
+    __u32 key = 0, gen = endpoint_gen + 1;
+    
+    if (bpf_map_update_elem(map_endpoint_gen_fd, &key, &gen, BPF_ANY)) {
+        fprintf(stderr, "Failed to flip endpoint generation: %s\n", strerror(errno));
+        return -1;
+    }
+    endpoint_gen = gen;
+    map_protected_endpoints_fd = endpoint_table_fds[gen % ENDPOINT_TABLES];
+    return 0;
+}
+
+// Point map_endpoint_tables at this object's tables and pick up the
+// generation a previous loader left. Pinned tables keep their contents
+// but the outer map holds references, so its slots are set every load.
+static int init_endpoint_tables(void)
+{
+    __u32 key = 0;
+    
+    for (__u32 slot = 0; slot < ENDPOINT_TABLES; slot++) {
+        if (bpf_map_update_elem(map_endpoint_tables_fd, &slot, &endpoint_table_fds[slot], BPF_ANY)) {
+            fprintf(stderr, "Failed to set endpoint table %u: %s\n", slot, strerror(errno));
+            return -1;
+        }
+    }
+    if (bpf_map_lookup_elem(map_endpoint_gen_fd, &key, &endpoint_gen))
+        endpoint_gen = 0;
+    map_protected_endpoints_fd = endpoint_table_fds[endpoint_gen % ENDPOINT_TABLES];
+    return resync_standby_endpoints();
+}
+
+// Replies are matched to their endpoint by origin alone, so an origin can
+// back only one fast-path endpoint. A mapping whose front no longer uses
+// that origin in either table is stale and may be taken over.
+static int origin_in_use(const struct origin_key *rkey, const struct endpoint_key *key)
+{
+    struct front_addr owner;
+    struct endpoint_info info;
+    
+    if (bpf_map_lookup_elem(map_origin_reverse_fd, rkey, &owner))
+        return 0;
+    if (owner.ip == key->ip.w[3] && owner.port == key->port)
+        return 0;
+    
+    struct endpoint_key okey = {
+        .port = owner.port,
+        .protocol = rkey->protocol
+    };
+    ip_addr_set_v4(&okey.ip, owner.ip);
+    for (int t = 0; t < ENDPOINT_TABLES; t++) {
+        if (bpf_map_lookup_elem(endpoint_table_fds[t], &okey, &info) == 0 &&
+            (info.flags & ENDPOINT_F_FAST_PATH) &&
+            info.origin_ip.w[3] == rkey->ip && info.origin_port == rkey->port)
+            return 1;
+    }
+    return 0;
+}
+
+// Remove a reverse translation if it still belongs to key's front
+static void drop_origin_mapping(const struct endpoint_key *key, const struct endpoint_info *info)
+{
+    struct origin_key rkey = {
+        .ip = info->origin_ip.w[3],
+        .port = info->origin_port,
+        .protocol = key->protocol
+    };
+    struct front_addr owner;
+    
+    if (bpf_map_lookup_elem(map_origin_reverse_fd, &rkey, &owner) == 0 &&
+        owner.ip == key->ip.w[3] && owner.port == key->port)
+        bpf_map_delete_elem(map_origin_reverse_fd, &rkey);
+}
+
+// Drop what a removed endpoint left behind once no table holds it. The
+// reverse translation and id stay if a transaction re-added the key.
+static void release_endpoint(const struct endpoint_key *key, const struct endpoint_info *info)
+{
+    struct endpoint_info now;
+    int readded = bpf_map_lookup_elem(map_protected_endpoints_fd, key, &now) == 0;
+    
+    if ((info->flags & ENDPOINT_F_FAST_PATH) &&
+        !(readded && (now.flags & ENDPOINT_F_FAST_PATH) &&
+          now.origin_ip.w[3] == info->origin_ip.w[3] && now.origin_port == info->origin_port))
+        drop_origin_mapping(key, info);
+    if (!readded || now.endpoint_id != info->endpoint_id)
+        release_endpoint_id(info->endpoint_id);
+}
+
+// Write endpoints (infos != NULL) or remove them from the standby table and,
+// outside a transaction, publish them with a generation flip
+static int stage_endpoints(const struct endpoint_key *keys,
+                           const struct endpoint_info *infos, __u32 count)
+{
+    if (!count)
+        return 0;
+    if (endpoint_standby_stale && resync_standby_endpoints())
+        return -1;
+    
+    int standby = standby_endpoints_fd();
+    if (infos ? write_endpoint_table(standby, keys, infos, count)
+              : delete_endpoint_table(standby, keys, count)) {
+        // Inside a transaction the caller aborts, which resyncs the table
+        if (!endpoint_txn.open) {
+            int saved_errno = errno;
+            resync_standby_endpoints();
+            errno = saved_errno;
+        }
+        return -1;
+    }
+    if (endpoint_txn.open)
+        return 0;
+    
+    if (flip_endpoint_gen()) {
+        int saved_errno = errno;
+        resync_standby_endpoints();
+        errno = saved_errno;
+        return -1;
+    }
+    standby = standby_endpoints_fd();
+    if (infos ? write_endpoint_table(standby, keys, infos, count)
+              : delete_endpoint_table(standby, keys, count))
+        endpoint_standby_stale = 1;
+    return 0;
+}
+
+static int begin_endpoint_txn(int slot)
+{
+    if (endpoint_txn.open) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (endpoint_standby_stale && resync_standby_endpoints())
+        return -1;
+    endpoint_txn.open = 1;
+    endpoint_txn.owner = slot;
+    endpoint_txn.removed_count = 0;
+    return 0;
+}
+
+// Removals in a transaction are released only after the commit flip
+static int defer_endpoint_release(const struct endpoint_key *key, const struct endpoint_info *info)
+{
+    if (endpoint_txn.removed_count == endpoint_txn.removed_cap) {
+        size_t cap = endpoint_txn.removed_cap ? endpoint_txn.removed_cap * 2 : 64;
+        struct endpoint_removal *removed = realloc(endpoint_txn.removed, cap * sizeof(*removed));
+        if (!removed)
+            return -1;
+        endpoint_txn.removed = removed;
+        endpoint_txn.removed_cap = cap;
+    }
+    endpoint_txn.removed[endpoint_txn.removed_count].key = *key;
+    endpoint_txn.removed[endpoint_txn.removed_count].info = *info;
+    endpoint_txn.removed_count++;
+    return 0;
+}
+
+static void end_endpoint_txn(void)
+{
+    endpoint_txn.open = 0;
+    endpoint_txn.owner = -1;
+    endpoint_txn.removed_count = 0;
+}
+
+// Publish a transaction. A failed flip leaves it open to retry or abort.
+static int commit_endpoint_txn(void)
+{
+    if (flip_endpoint_gen())
+        return -1;
+    for (size_t i = 0; i < endpoint_txn.removed_count; i++)
+        release_endpoint(&endpoint_txn.removed[i].key, &endpoint_txn.removed[i].info);
+    end_endpoint_txn();
+    
+    // The flip already published everything; a failed copy is retried later
+    resync_standby_endpoints();
+    return 0;
+}
+
+static void abort_endpoint_txn(void)
+{
+    int standby = standby_endpoints_fd();
+    struct endpoint_key key, next;
+    struct endpoint_info staged, live;
+    void *prev = NULL;
+    
+    // Reverse translations installed for staged fast-path endpoints
+    while (bpf_map_get_next_key(standby, prev, &next) == 0) {
+        if (bpf_map_lookup_elem(standby, &next, &staged) == 0 &&
+            (staged.flags & ENDPOINT_F_FAST_PATH) &&
+            (bpf_map_lookup_elem(map_protected_endpoints_fd, &next, &live) ||
+             !(live.flags & ENDPOINT_F_FAST_PATH) ||
+             live.origin_ip.w[3] != staged.origin_ip.w[3] ||
+             live.origin_port != staged.origin_port))
+            drop_origin_mapping(&next, &staged);
+        key = next;
+        prev = &key;
+    }
+    
+    resync_standby_endpoints();
+    end_endpoint_txn();
+    
+    // Ids handed to staged endpoints are recounted from the tables
+    memset(endpoint_ids_used, 0, sizeof(endpoint_ids_used));
+    endpoint_ids_loaded = 0;
+}
+
+static void default_endpoint_bursts(struct endpoint_info *info)
+{
+    if (!info->byte_burst_limit)
+        info->byte_burst_limit = info->byte_rate_limit;
+    if (!info->endpoint_byte_burst_limit)
+        info->endpoint_byte_burst_limit = info->endpoint_byte_rate_limit;
+    if (!info->subnet_burst_limit)
+        info->subnet_burst_limit = info->subnet_rate_limit;
+}
+
+// Everything but the endpoint table write for a single-address
+// endpoint: validation, the reverse translation and its id
+static int prepare_endpoint(const struct endpoint_key *key, struct endpoint_info *info)
+{
+    if ((info->flags & ENDPOINT_F_FAST_PATH) &&
+        (!ip_addr_is_v4(&key->ip) || !ip_addr_is_v4(&info->origin_ip))) {
+        fprintf(stderr, "Fast path requires IPv4 front and origin addresses\n");
+        errno = EINVAL;
+        return -1;
+    }
+    
+    // Install the reverse translation first so the origin's first reply
+    // can already be rewritten once forwarding starts
+    struct origin_key rkey = {
+        .ip = info->origin_ip.w[3],
+        .port = info->origin_port,
+        .protocol = key->protocol
+    };
+    struct front_addr front = {
+        .ip = key->ip.w[3],
+        .port = key->port
+    };
+    if (info->flags & ENDPOINT_F_FAST_PATH) {
+        if (origin_in_use(&rkey, key)) {
+            fprintf(stderr, "Origin already backs another fast-path endpoint\n");
+            errno = EEXIST;
+            return -1;
+        }
+        if (bpf_map_update_elem(map_origin_reverse_fd, &rkey, &front, BPF_ANY)) {
+            fprintf(stderr, "Failed to add origin reverse mapping: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    
+    // The standby table already holds any change staged in a transaction
+    return assign_endpoint_id(standby_endpoints_fd(), key, &info->endpoint_id);
+}
+
+static int uninstall_endpoint(const struct endpoint_key *key, __u32 prefix_len)
+{
+    struct endpoint_info info;
+    
+    if (prefix_len < 128) {
+        struct endpoint_prefix_key pkey = {
+            .prefix_len = ENDPOINT_PREFIX_HDR_BITS + prefix_len,
+            .port = key->port,
+            .protocol = key->protocol,
+            .ip = key->ip
+        };
+        int found = bpf_map_lookup_elem(map_protected_prefixes_fd, &pkey, &info) == 0;
+        if (bpf_map_delete_elem(map_protected_prefixes_fd, &pkey)) {
+            fprintf(stderr, "Failed to remove protected prefix: %s\n", strerror(errno));
+            return -1;
+        }
+        adjust_endpoint_prefixes(-1);
+        if (found)
+            release_endpoint_id(info.endpoint_id);
+        return 0;
+    }
+    
+    if (bpf_map_lookup_elem(standby_endpoints_fd(), key, &info)) {
+        fprintf(stderr, "Failed to remove protected endpoint: %s\n", strerror(errno));
+        return -1;
+    }
+    if (stage_endpoints(key, NULL, 1))
+        return -1;
+    if (endpoint_txn.open)
+        return defer_endpoint_release(key, &info);
+    release_endpoint(key, &info);
+    return 0;
+}
+
+// Blacklist key for an address or prefix. A bare IPv6 address blocks its
+// whole /64, matching how the datapath keys per-source state.
+static int parse_blacklist_key(const char *str, struct blacklist_key *key)
+{
+    if (parse_ip_prefix(str, &key->ip, &key->prefix_len))
+        return -1;
+    if (!strchr(str, '/') && !ip_addr_is_v4(&key->ip)) {
+        key->prefix_len = 64;
+        ip_addr_source_key(&key->ip);
+    }
+    return 0;
+}
+
+// Bulk blacklist import. Entries are written MAP_BATCH_SIZE at a time with
+// bpf_map_update_batch(); kernels without batch support for LPM tries get
+// one update per entry instead. Trie updates are RCU, so the datapath keeps
+// filtering against the entries already present while a feed loads.
+struct blacklist_import {
+    struct blacklist_key *keys;
+    __u64 *values;
+    __u32 count;
+    int no_batch;
+    size_t imported;
+};
+
+static int flush_blacklist_import(struct blacklist_import *imp)
+{
+    __u32 n = imp->count;
+    
+    if (n == 0)
+        return 0;
+    
+    if (!imp->no_batch) {
+        LIBBPF_OPTS(bpf_map_batch_opts, opts, .elem_flags = BPF_ANY);
+        if (bpf_map_update_batch(map_blacklist_fd, imp->keys, imp->values, &n, &opts) == 0) {
+            imp->imported += n;
+            imp->count = 0;
+            return 0;
+        }
+        if (errno != EINVAL && errno != ENOTSUPP && errno != EOPNOTSUPP) {
+            fprintf(stderr, "Blacklist batch update failed: %s\n", strerror(errno));
+            return -1;
+        }
+        imp->no_batch = 1;
+    }
+    
+    for (__u32 i = 0; i < imp->count; i++) {
+        if (bpf_map_update_elem(map_blacklist_fd, &imp->keys[i], &imp->values[i], BPF_ANY)) {
+            fprintf(stderr, "Blacklist update failed: %s\n", strerror(errno));
+            return -1;
+        }
+        imp->imported++;
+    }
+    imp->count = 0;
+    return 0;
+}
+
+static int read_blacklist_text(FILE *f, struct blacklist_import *imp, __u64 block_until)
+{
+    char line[256];
+    size_t lineno = 0, invalid = 0;
+    
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        
+        // Strip comments and surrounding whitespace
+        char *p = strchr(line, '#');
+        if (p)
+            *p = '\0';
+        p = line + strspn(line, " \t");
+        p[strcspn(p, " \t\r\n")] = '\0';
+        if (*p == '\0')
+            continue;
+        
+        if (parse_blacklist_key(p, &imp->keys[imp->count])) {
+            invalid++;
+            continue;
+        }
+        imp->values[imp->count++] = block_until;
+        if (imp->count == MAP_BATCH_SIZE && flush_blacklist_import(imp))
+            return -1;
+    }
+    
+    if (invalid)
+        fprintf(stderr, "Skipped %zu invalid blacklist lines out of %zu\n", invalid, lineno);
+    return 0;
+}
+
+static int read_blacklist_binary(FILE *f, struct blacklist_import *imp, __u64 block_until)
+{
+    size_t n;
+    
+    while ((n = fread(imp->keys, sizeof(*imp->keys), MAP_BATCH_SIZE, f)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            if (imp->keys[i].prefix_len > 128) {
+                fprintf(stderr, "Invalid prefix length %u in binary blacklist\n",
+                        imp->keys[i].prefix_len);
+                return -1;
+            }
+            imp->values[i] = block_until;
+        }
+        imp->count = n;
+        if (flush_blacklist_import(imp))
+            return -1;
+    }
+    return ferror(f) ? -1 : 0;
+}
+
+// Import a threat feed into the blacklist
+static int import_blacklist(const char *path, int binary, __u64 duration_ms)
+{
+    struct blacklist_import imp = {
+        .keys = calloc(MAP_BATCH_SIZE, sizeof(struct blacklist_key)),
+        .values = calloc(MAP_BATCH_SIZE, sizeof(__u64))
+    };
+    __u64 block_until = duration_ms ? now_ms() + duration_ms : BLACKLIST_FOREVER;
+    __u64 start = now_ms();
+    int err = -1;
+    
+    FILE *f = fopen(path, binary ? "rb" : "r");
+    if (!f) {
+        fprintf(stderr, "Failed to open blacklist %s: %s\n", path, strerror(errno));
+        goto out;
+    }
+    if (!imp.keys || !imp.values)
+        goto out;
+    
+    err = binary ? read_blacklist_binary(f, &imp, block_until)
+                 : read_blacklist_text(f, &imp, block_until);
+    if (!err)
+        err = flush_blacklist_import(&imp);
+    
+    printf("Imported %zu blacklist entries from %s in %llu ms%s\n", imp.imported, path,
+           now_ms() - start, imp.no_batch ? " (no batch support)" : "");
+
+out:
+    if (f)
+        fclose(f);
+    free(imp.keys);
+    free(imp.values);
+    return err;
+}
+
+// Hot-patch one pipeline stage from a rebuilt object file. The new object
+// shares every map of the running program by name, so no state is lost,
+// and only the replaced stage is loaded from it. The stage it replaces
+// keeps running until the map_stages update.
+int replace_stage(const char *stage_name, const char *filename)
+{
+    __u32 stage = STAGE_MAX;
+    struct bpf_object *patch;
+    struct bpf_program *prog;
+    struct bpf_map *map;
+    
+    for (__u32 i = 0; i < STAGE_MAX; i++) {
+        if (strcmp(stage_name, stage_names[i]) == 0)
+            stage = i;
+    }
+    if (stage == STAGE_MAX || !obj) {
+        fprintf(stderr, "Unknown pipeline stage: %s\n", stage_name);
+        return -1;
+    }
+    
+    patch = bpf_object__open_file(filename, NULL);
+    if (libbpf_get_error(patch)) {
+        fprintf(stderr, "Failed to open eBPF object: %s\n",
+                strerror(-libbpf_get_error(patch)));
+        return -1;
+    }
+    
+    bpf_object__for_each_map(map, patch) {
+        int fd = bpf_object__find_map_fd_by_name(obj, bpf_map__name(map));
+        if (fd < 0 || bpf_map__reuse_fd(map, fd)) {
+            fprintf(stderr, "Failed to share map %s with the running program\n",
+                    bpf_map__name(map));
+            bpf_object__close(patch);
+            return -1;
+        }
+    }
+    bpf_object__for_each_program(prog, patch)
+        bpf_program__set_autoload(prog, strcmp(bpf_program__name(prog),
+                                               stage_prog_names[stage]) == 0);
+    
+    int err = bpf_object__load(patch);
+    if (err) {
+        fprintf(stderr, "Failed to load eBPF object: %s\n", strerror(-err));
+        bpf_object__close(patch);
+        return -1;
+    }
+    if (install_stage(patch, stage)) {
+        bpf_object__close(patch);
+        return -1;
+    }
+    
+    // The prog array holds its own reference to the new program
+    if (stage_objs[stage])
+        bpf_object__close(stage_objs[stage]);
+    stage_objs[stage] = patch;
+    
+    printf("Replaced pipeline stage %s from %s\n", stage_name, filename);
+    return 0;
+}
+
+// Get statistics
+// Read every counter from every CPU; percpu holds count * nr_cpus values
+static int get_stats_percpu(__u64 *percpu, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        __u32 key = i;
+        if (bpf_map_lookup_elem(map_stats_fd, &key, &percpu[i * nr_cpus])) {
+            memset(&percpu[i * nr_cpus], 0, sizeof(__u64) * nr_cpus);
+        }
+    }
+    return 0;
+}
+
+// Get statistics summed across CPUs
+int get_stats(__u64 *stats, size_t count)
+{
+    __u64 *percpu = calloc(count * nr_cpus, sizeof(__u64));
+    if (!percpu)
+        return -1;
+    
+    get_stats_percpu(percpu, count);
+    for (size_t i = 0; i < count; i++) {
+        stats[i] = 0;
+        for (int cpu = 0; cpu < nr_cpus; cpu++)
+            stats[i] += percpu[i * nr_cpus + cpu];
+    }
+    
+    free(percpu);
+    return 0;
+}
+
+static void print_stat_totals(const __u64 *stats)
+{
+    printf("\n=== CloudNordSP Statistics ===\n");
+    printf("Total packets processed: %llu\n", stats[STAT_TOTAL_PACKETS]);
+    printf("Allowed packets: %llu\n", stats[STAT_ALLOWED_PACKETS]);
+    printf("Blocked - Rate limit: %llu\n", stats[STAT_BLOCKED_RATE_LIMIT]);
+    printf("Blocked - Blacklist: %llu\n", stats[STAT_BLOCKED_BLACKLIST]);
+    printf("Blocked - Invalid protocol: %llu\n", stats[STAT_BLOCKED_INVALID_PROTOCOL]);
+    printf("Blocked - Challenge failed: %llu\n", stats[STAT_BLOCKED_CHALLENGE_FAILED]);
+    printf("Blocked - Maintenance: %llu\n", stats[STAT_BLOCKED_MAINTENANCE]);
+    printf("XDP drops: %llu\n", stats[STAT_XDP_DROP]);
+    printf("XDP passes: %llu\n", stats[STAT_XDP_PASS]);
+    printf("XDP redirects: %llu\n", stats[STAT_XDP_REDIRECT]);
+    printf("UDP challenges sent: %llu\n", stats[STAT_UDP_CHALLENGES_SENT]);
+    printf("UDP challenges passed: %llu\n", stats[STAT_UDP_CHALLENGES_PASSED]);
+    printf("State inserts (LRU pressure): %llu\n", stats[STAT_STATE_INSERTS]);
+    printf("State insert failures: %llu\n", stats[STAT_STATE_INSERT_FAILED]);
+    printf("Fast-path forwarded: %llu\n", stats[STAT_FAST_PATH_FORWARDED]);
+    printf("SYN cookies sent: %llu\n", stats[STAT_SYNCOOKIES_SENT]);
+    printf("SYN cookies passed: %llu\n", stats[STAT_SYNCOOKIES_PASSED]);
+    printf("SYN cookies failed: %llu\n", stats[STAT_SYNCOOKIES_FAILED]);
+    printf("New flows dropped under attack: %llu\n", stats[STAT_ATTACK_NEW_FLOWS_DROPPED]);
+    printf("Events lost (ring buffer full): %llu\n", stats[STAT_EVENTS_LOST]);
+    printf("Missing pipeline stages: %llu\n", stats[STAT_STAGE_MISSING]);
+}
+
+// Totals, then the per-CPU breakdown that shows RSS imbalance across RX
+// queues. percpu is laid out as get_stats_percpu() fills it.
+static void print_stats(const __u64 *percpu, int cpus)
+{
+    __u64 stats[STAT_MAX];
+    
+    for (int i = 0; i < STAT_MAX; i++) {
+        stats[i] = 0;
+        for (int cpu = 0; cpu < cpus; cpu++)
+            stats[i] += percpu[i * cpus + cpu];
+    }
+    
+    print_stat_totals(stats);
+    
+    printf("\n--- Per-CPU breakdown ---\n");
+    printf("%-5s %14s %14s %8s\n", "CPU", "Total", "Allowed", "Share");
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        __u64 total = percpu[STAT_TOTAL_PACKETS * cpus + cpu];
+        __u64 allowed = percpu[STAT_ALLOWED_PACKETS * cpus + cpu];
+        if (total == 0)
+            continue;
+        printf("%-5d %14llu %14llu %7.1f%%\n", cpu, total, allowed,
+               stats[STAT_TOTAL_PACKETS] ? 100.0 * total / stats[STAT_TOTAL_PACKETS] : 0.0);
+    }
+    printf("==============================\n");
+}
+
+// Control socket. The running loader owns the maps; the CLI commands and
+// node agents change them through it instead of opening the object again.
+static int open_control_socket(void)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct stat st;
+    
+    for (int i = 0; i < CTL_CLIENTS_MAX; i++)
+        ctl_clients[i] = -1;
+    
+    ctl_listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ctl_listen_fd < 0) {
+        fprintf(stderr, "Failed to create control socket: %s\n", strerror(errno));
+        return -1;
+    }
+    strncpy(addr.sun_path, CONTROL_SOCK_PATH, sizeof(addr.sun_path) - 1);
+    
+    // On reload the new loader takes the path over from the old one
+    unlink(CONTROL_SOCK_PATH);
+    if (bind(ctl_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        chmod(CONTROL_SOCK_PATH, 0600) || stat(CONTROL_SOCK_PATH, &st) ||
+        listen(ctl_listen_fd, CTL_CLIENTS_MAX)) {
+        fprintf(stderr, "Failed to open control socket %s: %s\n",
+                CONTROL_SOCK_PATH, strerror(errno));
+        close(ctl_listen_fd);
+        ctl_listen_fd = -1;
+        return -1;
+    }
+    ctl_sock_ino = st.st_ino;
+    return 0;
+}
+
+static void close_control_socket(void)
+{
+    struct stat st;
+    
+    if (ctl_listen_fd < 0)
+        return;
+    for (int i = 0; i < CTL_CLIENTS_MAX; i++) {
+        if (ctl_clients[i] >= 0)
+            close(ctl_clients[i]);
+        ctl_clients[i] = -1;
+    }
+    close(ctl_listen_fd);
+    ctl_listen_fd = -1;
+    if (stat(CONTROL_SOCK_PATH, &st) == 0 && st.st_ino == ctl_sock_ino)
+        unlink(CONTROL_SOCK_PATH);
+}
+
+// Record size of each CTL_OP_*, 0 for ops without records
+static const size_t ctl_record_size[CTL_OP_MAX] = {
+    [CTL_OP_ADD_ENDPOINT] = sizeof(struct ctl_endpoint),
+    [CTL_OP_REMOVE_ENDPOINT] = sizeof(struct ctl_endpoint),
+    [CTL_OP_BLACKLIST_ADD] = sizeof(struct ctl_blacklist),
+    [CTL_OP_BLACKLIST_REMOVE] = sizeof(struct ctl_blacklist),
+    [CTL_OP_REPLACE_STAGE] = sizeof(struct ctl_stage)
+};
+
+#define CTL_BLACKLIST_MAX (CTL_MSG_MAX / sizeof(struct ctl_blacklist))
+
+// A message of blacklist records becomes one bpf_map_update_batch() call
+static int ctl_blacklist_add(const struct ctl_blacklist *recs, __u32 count, __u32 *applied)
+{
+    static struct blacklist_key keys[CTL_BLACKLIST_MAX];
+    static __u64 values[CTL_BLACKLIST_MAX];
+    static int no_batch;
+    struct blacklist_import imp = {
+        .keys = keys,
+        .values = values,
+        .count = count,
+        .no_batch = no_batch
+    };
+    __u64 now = now_ms();
+    
+    for (__u32 i = 0; i < count; i++) {
+        if (recs[i].key.prefix_len > 128) {
+            errno = EINVAL;
+            return -1;
+        }
+        keys[i] = recs[i].key;
+        mask_ip_addr(&keys[i].ip, keys[i].prefix_len);
+        values[i] = recs[i].duration_ms ? now + recs[i].duration_ms : BLACKLIST_FOREVER;
+    }
+    
+    int err = flush_blacklist_import(&imp);
+    no_batch = imp.no_batch;
+    *applied = imp.imported;
+    return err;
+}
+
+#define CTL_ENDPOINTS_MAX (CTL_MSG_MAX / sizeof(struct ctl_endpoint))
+
+// origin_in_use() for the fast-path endpoints earlier in a message, which
+// are not in a table yet
+static int origin_staged(const struct endpoint_key *keys, const struct endpoint_info *infos,
+                         __u32 staged, const struct ctl_endpoint *ep)
+{
+    if (!(ep->info.flags & ENDPOINT_F_FAST_PATH))
+        return 0;
+    for (__u32 j = 0; j < staged; j++) {
+        if ((infos[j].flags & ENDPOINT_F_FAST_PATH) &&
+            keys[j].protocol == ep->key.protocol &&
+            infos[j].origin_ip.w[3] == ep->info.origin_ip.w[3] &&
+            infos[j].origin_port == ep->info.origin_port &&
+            memcmp(&keys[j], &ep->key, sizeof(ep->key)))
+            return 1;
+    }
+    return 0;
+}
+
+// Prefixes go into the trie one by one; the single-address endpoints of a
+// message are prepared first, written to the standby table in one batch
+// and published together by one generation flip. Addresses may be IPv4 or
+// IPv6; the XDP fast path needs IPv4 on both sides. Rate limits apply per
+// source, subnet_rate_limit to each source /24 (IPv6 /48) and
+// endpoint_byte_rate_limit to all sources together; a limit of 0 leaves
+// that level unlimited. Above attack_pps (0 = never) the endpoint
+// challenges every new flow and admits at most attack_new_flows per second
+// (0 = no cap). Bursts left at 0 default to one second of the rate.
+static int ctl_add_endpoints(const struct ctl_endpoint *recs, __u32 count, __u32 *applied)
+{
+    static struct endpoint_key keys[CTL_ENDPOINTS_MAX];
+    static struct endpoint_info infos[CTL_ENDPOINTS_MAX];
+    struct ctl_endpoint ep;
+    __u32 staged = 0, done = 0;
+    int err = 0;
+    
+    for (__u32 i = 0; i < count && !err; i++) {
+        memcpy(&ep, &recs[i], sizeof(ep));
+        if (ep.prefix_len > 128) {
+            errno = EINVAL;
+            err = -1;
+            break;
+        }
+        memset(ep.key.padding, 0, sizeof(ep.key.padding));
+        mask_ip_addr(&ep.key.ip, ep.prefix_len);
+        default_endpoint_bursts(&ep.info);
+        
+        if (ep.prefix_len < 128) {
+            err = add_protected_prefix(&ep.key.ip, ep.prefix_len, ep.key.port,
+                                       ep.key.protocol, &ep.info);
+            done += !err;
+        } else if (origin_staged(keys, infos, staged, &ep)) {
+            fprintf(stderr, "Origin already backs another fast-path endpoint\n");
+            errno = EEXIST;
+            err = -1;
+        } else if (!(err = prepare_endpoint(&ep.key, &ep.info))) {
+            // A key repeated within the message keeps one slot and one id
+            __u32 j = 0;
+            while (j < staged && memcmp(&keys[j], &ep.key, sizeof(ep.key)))
+                j++;
+            if (j == staged) {
+                staged++;
+            } else {
+                if (infos[j].endpoint_id != ep.info.endpoint_id)
+                    release_endpoint_id(infos[j].endpoint_id);
+                done++;
+            }
+            keys[j] = ep.key;
+            infos[j] = ep.info;
+        }
+    }
+    
+    // Whatever was prepared before a failure is still written
+    int saved_errno = errno;
+    if (stage_endpoints(keys, infos, staged)) {
+        *applied = done;
+        return -1;
+    }
+    *applied = done + staged;
+    errno = saved_errno;
+    return err;
+}
+
+// Removals mirror ctl_add_endpoints: prefixes leave the trie one by one,
+// single addresses go in one flip
+static int ctl_remove_endpoints(const struct ctl_endpoint *recs, __u32 count, __u32 *applied)
+{
+    static struct endpoint_key keys[CTL_ENDPOINTS_MAX];
+    static struct endpoint_info infos[CTL_ENDPOINTS_MAX];
+    struct ctl_endpoint ep;
+    __u32 staged = 0, done = 0;
+    int err = 0;
+    
+    for (__u32 i = 0; i < count && !err; i++) {
+        memcpy(&ep, &recs[i], sizeof(ep));
+        if (ep.prefix_len > 128) {
+            errno = EINVAL;
+            err = -1;
+            break;
+        }
+        memset(ep.key.padding, 0, sizeof(ep.key.padding));
+        mask_ip_addr(&ep.key.ip, ep.prefix_len);
+        
+        if (ep.prefix_len < 128) {
+            err = uninstall_endpoint(&ep.key, ep.prefix_len);
+            done += !err;
+            continue;
+        }
+        
+        __u32 j = 0;
+        while (j < staged && memcmp(&keys[j], &ep.key, sizeof(ep.key)))
+            j++;
+        if (j < staged) {
+            done++;
+        } else if (bpf_map_lookup_elem(standby_endpoints_fd(), &ep.key, &infos[staged])) {
+            fprintf(stderr, "Failed to remove protected endpoint: %s\n", strerror(errno));
+            err = -1;
+        } else {
+            keys[staged++] = ep.key;
+        }
+    }
+    
+    int saved_errno = errno;
+    if (stage_endpoints(keys, NULL, staged)) {
+        *applied = done;
+        return -1;
+    }
+    for (__u32 i = 0; i < staged; i++) {
+        if (!endpoint_txn.open) {
+            release_endpoint(&keys[i], &infos[i]);
+        } else if (defer_endpoint_release(&keys[i], &infos[i])) {
+            *applied = done + staged;
+            return -1;
+        }
+    }
+    *applied = done + staged;
+    errno = saved_errno;
+    return err;
+}
+
+static int apply_control_request(int slot, const struct ctl_header *hdr, const void *records,
+                                 __u32 *applied, __u64 *stats)
+{
+    const struct ctl_blacklist *bl = records;
+    struct ctl_stage st;
+    int ret;
+    
+    // A loader handing over changes nothing for anyone else
+    if (handover_slot >= 0 && slot != handover_slot) {
+        errno = EBUSY;
+        return -1;
+    }
+    
+    switch (hdr->op) {
+    case CTL_OP_ADD_ENDPOINT:
+    case CTL_OP_REMOVE_ENDPOINT:
+        // Another client's transaction owns the standby table
+        if (endpoint_txn.open && endpoint_txn.owner != slot) {
+            errno = EBUSY;
+            return -1;
+        }
+        ret = hdr->op == CTL_OP_ADD_ENDPOINT ?
+              ctl_add_endpoints(records, hdr->count, applied) :
+              ctl_remove_endpoints(records, hdr->count, applied);
+        // A transaction that failed to stage part of its batch cannot be
+        // committed as sent, and must not keep the standby table locked
+        if (ret && endpoint_txn.open) {
+            int saved_errno = errno;
+            abort_endpoint_txn();
+            errno = saved_errno;
+        }
+        return ret;
+    case CTL_OP_BLACKLIST_ADD:
+        return ctl_blacklist_add(bl, hdr->count, applied);
+    case CTL_OP_BLACKLIST_REMOVE:
+        for (; *applied < hdr->count; (*applied)++) {
+            struct blacklist_key key = bl[*applied].key;
+            if (key.prefix_len > 128) {
+                errno = EINVAL;
+                return -1;
+            }
+            mask_ip_addr(&key.ip, key.prefix_len);
+            if (bpf_map_delete_elem(map_blacklist_fd, &key))
+                return -1;
+        }
+        return 0;
+    case CTL_OP_STATS:
+        return get_stats_percpu(stats, STAT_MAX);
+    case CTL_OP_REPLACE_STAGE:
+        memcpy(&st, records, sizeof(st));
+        st.path[sizeof(st.path) - 1] = '\0';
+        if (hdr->count != 1 || st.stage >= STAGE_MAX) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (replace_stage(stage_names[st.stage], st.path))
+            return -1;
+        *applied = 1;
+        return 0;
+    case CTL_OP_BEGIN:
+        return begin_endpoint_txn(slot);
+    case CTL_OP_COMMIT:
+    case CTL_OP_ABORT:
+        if (!endpoint_txn.open || endpoint_txn.owner != slot) {
+            errno = ENOENT;
+            return -1;
+        }
+        if (hdr->op == CTL_OP_COMMIT)
+            return commit_endpoint_txn();
+        abort_endpoint_txn();
+        return 0;
+    case CTL_OP_HANDOVER:
+        // The second request comes once the new generation is attached
+        if (handover_slot == slot) {
+            printf("New loader attached, exiting\n");
+            exiting = 1;
+            return 0;
+        }
+        if (endpoint_txn.open)
+            abort_endpoint_txn();
+        handover_slot = slot;
+        printf("Handing over to a new loader\n");
+        return 0;
+    }
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+static void close_control_client(int slot)
+{
+    // A transaction dies with the connection that opened it
+    if (endpoint_txn.open && endpoint_txn.owner == slot)
+        abort_endpoint_txn();
+    if (handover_slot == slot) {
+        handover_slot = -1;
+        if (!exiting)
+            printf("Handover abandoned, resuming\n");
+    }
+    close(ctl_clients[slot]);
+    ctl_clients[slot] = -1;
+}
+
+// Serve one request message and send its reply
+static void serve_control_client(int slot)
+{
+    static __u64 msg[CTL_MSG_MAX / sizeof(__u64)];
+    static __u64 *stats;  // CTL_OP_STATS reply, STAT_MAX counters per CPU
+    const struct ctl_header *hdr = (const struct ctl_header *)msg;
+    struct ctl_reply reply = {0};
+    size_t stats_len = sizeof(__u64) * STAT_MAX * nr_cpus;
+    struct iovec iov[2] = {
+        { .iov_base = &reply, .iov_len = sizeof(reply) },
+        { .iov_base = NULL, .iov_len = 0 }
+    };
+    struct msghdr out = { .msg_iov = iov, .msg_iovlen = 2 };
+    
+    ssize_t n = recv(ctl_clients[slot], msg, sizeof(msg), MSG_TRUNC | MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        close_control_client(slot);
+        return;
+    }
+    
+    if ((size_t)n > sizeof(msg)) {
+        reply.status = -EMSGSIZE;
+    } else if ((size_t)n < sizeof(*hdr)) {
+        reply.status = -EBADMSG;
+    } else if (hdr->op == 0 || hdr->op >= CTL_OP_MAX) {
+        reply.seq = hdr->seq;
+        reply.status = -EOPNOTSUPP;
+    } else if (hdr->count > CTL_MSG_MAX ||
+               (size_t)n != sizeof(*hdr) + hdr->count * ctl_record_size[hdr->op]) {
+        reply.seq = hdr->seq;
+        reply.status = -EBADMSG;
+    } else if (hdr->op == CTL_OP_STATS && !stats && !(stats = malloc(stats_len))) {
+        reply.seq = hdr->seq;
+        reply.status = -ENOMEM;
+    } else {
+        reply.seq = hdr->seq;
+        errno = 0;
+        if (apply_control_request(slot, hdr, hdr + 1, &reply.applied, stats))
+            reply.status = errno ? -errno : -EIO;
+        else if (hdr->op == CTL_OP_STATS) {
+            reply.count = nr_cpus;
+            iov[1] = (struct iovec){ .iov_base = stats, .iov_len = stats_len };
+        }
+    }
+    
+    // A client that does not read its replies is dropped rather than waited on
+    if (sendmsg(ctl_clients[slot], &out, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+        close_control_client(slot);
+}
+
+static void accept_control_client(void)
+{
+    int fd = accept(ctl_listen_fd, NULL, NULL);
+    if (fd < 0)
+        return;
+    for (int i = 0; i < CTL_CLIENTS_MAX; i++) {
+        if (ctl_clients[i] < 0) {
+            ctl_clients[i] = fd;
+            return;
+        }
+    }
+    close(fd);
+}
+
+static void poll_io(int timeout_ms)
+{
+    struct pollfd fds[2 + CTL_CLIENTS_MAX];
+    
+    // Events are left for the new loader during a handover
+    fds[0] = (struct pollfd){
+        .fd = handover_slot < 0 ? ring_buffer__epoll_fd(events) : -1,
+        .events = POLLIN
+    };
+    fds[1] = (struct pollfd){ .fd = ctl_listen_fd, .events = POLLIN };
+    for (int i = 0; i < CTL_CLIENTS_MAX; i++)
+        fds[2 + i] = (struct pollfd){ .fd = ctl_clients[i], .events = POLLIN };
+    
+    if (poll(fds, 2 + CTL_CLIENTS_MAX, timeout_ms) < 0) {
+        if (errno != EINTR) {
+            fprintf(stderr, "Failed to poll: %s\n", strerror(errno));
+            usleep(100 * 1000);
+        }
+        return;
+    }
+    
+    if (fds[0].revents) {
+        int err = ring_buffer__consume(events);
+        if (err < 0)
+            fprintf(stderr, "Failed to consume events: %s\n", strerror(-err));
+    }
+    if (fds[1].revents & POLLIN)
+        accept_control_client();
+    for (int i = 0; i < CTL_CLIENTS_MAX; i++) {
+        if (fds[2 + i].revents)
+            serve_control_client(i);
+    }
+}
+
+static int control_connect(void)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    
+    strncpy(addr.sun_path, CONTROL_SOCK_PATH, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+// Send one request on fd and wait for its reply. out receives the reply
+// records.
+static int control_exchange(int fd, __u32 op, const void *records, __u32 count,
+                            size_t record_size, void *out, size_t out_len)
+{
+    struct ctl_header hdr = { .op = op, .seq = getpid(), .count = count };
+    struct ctl_reply reply;
+    struct iovec req_iov[2] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = (void *)records, .iov_len = count * record_size }
+    };
+    struct iovec reply_iov[2] = {
+        { .iov_base = &reply, .iov_len = sizeof(reply) },
+        { .iov_base = out, .iov_len = out_len }
+    };
+    struct msghdr req = { .msg_iov = req_iov, .msg_iovlen = 2 };
+    struct msghdr rep = { .msg_iov = reply_iov, .msg_iovlen = 2 };
+    
+    ssize_t n = sendmsg(fd, &req, 0);
+    if (n >= 0)
+        n = recvmsg(fd, &rep, 0);
+    if (n < (ssize_t)sizeof(reply)) {
+        fprintf(stderr, "No reply from loader: %s\n", n < 0 ? strerror(errno) : "short message");
+        return -1;
+    }
+    if (reply.status) {
+        fprintf(stderr, "Loader rejected request after %u records: %s\n",
+                reply.applied, strerror(-reply.status));
+        errno = -reply.status;
+        return -1;
+    }
+    if (out_len && (size_t)n != sizeof(reply) + out_len) {
+        fprintf(stderr, "Unexpected reply size from loader\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Send one request to the running loader and wait for its reply
+static int control_request(__u32 op, const void *records, __u32 count, size_t record_size,
+                           void *out, size_t out_len)
+{
+    int fd = control_connect();
+    if (fd < 0) {
+        fprintf(stderr, "Failed to connect to %s (is the loader running?): %s\n",
+                CONTROL_SOCK_PATH, strerror(errno));
+        return -1;
+    }
+    int err = control_exchange(fd, op, records, count, record_size, out, out_len);
+    close(fd);
+    return err;
+}
+
+// Upgrades hand ownership over explicitly so two loaders never rotate
+// secrets, sweep or drain events at once. The running loader quiesces
+// while this one loads, then exits once the new generation is attached.
+// It stays alive until then because its tail-call table still serves the
+// attached program. Closing the connection before finishing lets the old
+// loader resume.
+static int begin_handover(void)
+{
+    struct timeval tv = {.tv_sec = HANDOVER_TIMEOUT_S};
+    
+    handover_fd = control_connect();
+    if (handover_fd < 0)
+        return errno == ENOENT || errno == ECONNREFUSED ? 0 : -1;
+    setsockopt(handover_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (control_exchange(handover_fd, CTL_OP_HANDOVER, NULL, 0, 0, NULL, 0)) {
+        fprintf(stderr, "Running loader refused the handover; stop it before loading\n");
+        close(handover_fd);
+        handover_fd = -1;
+        return -1;
+    }
+    printf("Running loader quiesced for the handover\n");
+    return 0;
+}
+
+static void finish_handover(void)
+{
+    char buf;
+    
+    if (handover_fd < 0)
+        return;
+    // On failure the connection stays open, which keeps the old loader quiet
+    if (control_exchange(handover_fd, CTL_OP_HANDOVER, NULL, 0, 0, NULL, 0))
+        return;
+    // The old loader closes its connections on exit
+    if (recv(handover_fd, &buf, sizeof(buf), 0) < 0)
+        fprintf(stderr, "Warning: previous loader has not exited yet\n");
+    close(handover_fd);
+    handover_fd = -1;
+}
+
+// Cleanup
+void cleanup(void)
+{
+    if (handover_fd >= 0) {
+        close(handover_fd);
+        handover_fd = -1;
+    }
+    close_control_socket();
+    stop_event_poster();
+    if (events) {
+        ring_buffer__free(events);
+        events = NULL;
+    }
+    free(event_aggs);
+    event_aggs = NULL;
+    free(endpoint_reported);
+    endpoint_reported = NULL;
+    // The pinned link and maps stay behind; only unload detaches them
+    if (xdp_link) {
+        bpf_link__destroy(xdp_link);
+    }
+    for (int i = 0; i < STAGE_MAX; i++) {
+        if (stage_objs[i]) {
+            bpf_object__close(stage_objs[i]);
+            stage_objs[i] = NULL;
+        }
+    }
+    if (obj) {
+        bpf_object__close(obj);
+    }
+}
+
+// Drop the pinned link and state maps. XDP detaches once no loader still
+// holds the link, and the next load starts from empty maps.
+static int unload_xdp_program(void)
+{
+    DIR *dir = opendir(PIN_BASE_DIR);
+    struct dirent *de;
+    char path[PATH_MAX];
+    int err = 0;
+    
+    if (!dir) {
+        if (errno == ENOENT)
+            return 0;
+        fprintf(stderr, "Failed to open %s: %s\n", PIN_BASE_DIR, strerror(errno));
+        return -1;
+    }
+    while ((de = readdir(dir))) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", PIN_BASE_DIR, de->d_name);
+        if (unlink(path)) {
+            fprintf(stderr, "Failed to unpin %s: %s\n", path, strerror(errno));
+            err = -1;
+        }
+    }
+    closedir(dir);
+    if (!err && rmdir(PIN_BASE_DIR)) {
+        fprintf(stderr, "Failed to remove %s: %s\n", PIN_BASE_DIR, strerror(errno));
+        err = -1;
+    }
+    return err;
+}
+
+// Parse "<reason>=<n>" for --event-sample
+static int parse_event_sample(const char *arg, __u32 *event_sample)
+{
+    const char *eq = strchr(arg, '=');
+    
+    for (int r = 0; eq && r < STAT_MAX; r++) {
+        const char *name = drop_reason_names[r];
+        if (name && strlen(name) == (size_t)(eq - arg) && strncmp(arg, name, eq - arg) == 0) {
+            event_sample[r] = strtoul(eq + 1, NULL, 10);
+            return 0;
+        }
+    }
+    fprintf(stderr, "Invalid event sample %s, expected <reason>=<n>\n", arg);
+    return -1;
+}
+
+// "tcp", "udp" or a protocol number
+static __u8 parse_protocol(const char *str)
+{
+    if (strcmp(str, "tcp") == 0)
+        return IPPROTO_TCP;
+    if (strcmp(str, "udp") == 0)
+        return IPPROTO_UDP;
+    return strtoul(str, NULL, 10);
+}
+
+// "java", "bedrock" or an endpoint_info.protocol_type value
+static __u8 parse_endpoint_type(const char *str)
+{
+    if (strcmp(str, "java") == 0)
+        return 0;
+    if (strcmp(str, "bedrock") == 0)
+        return 1;
+    return strtoul(str, NULL, 10);
+}
+
+// add-endpoint arguments, in the order the usage text lists them
+static int parse_endpoint_args(int argc, char **argv, struct ctl_endpoint *rec)
+{
+    struct endpoint_info *info = &rec->info;
+    __u32 *limits[] = {
+        &info->rate_limit, &info->burst_limit,
+        &info->byte_rate_limit, &info->byte_burst_limit,
+        &info->subnet_rate_limit, &info->subnet_burst_limit,
+        &info->endpoint_byte_rate_limit, &info->endpoint_byte_burst_limit,
+        &info->attack_pps, &info->attack_new_flows
+    };
+    
+    memset(rec, 0, sizeof(*rec));
+    for (; argc > 0; argc--) {
+        if (strcmp(argv[argc - 1], "fast-path") == 0)
+            info->flags |= ENDPOINT_F_FAST_PATH;
+        else if (strcmp(argv[argc - 1], "syn-cookies") == 0)
+            info->flags |= ENDPOINT_F_SYN_COOKIES;
+        else
+            break;
+    }
+    if (argc < 8 || argc > 16 || argc % 2) {
+        fprintf(stderr, "add-endpoint: wrong number of arguments\n");
+        return -1;
+    }
+    if (parse_ip_prefix(argv[0], &rec->key.ip, &rec->prefix_len) ||
+        parse_ip_addr(argv[3], &info->origin_ip))
+        return -1;
+    rec->key.port = strtoul(argv[1], NULL, 10);
+    rec->key.protocol = parse_protocol(argv[2]);
+    info->origin_port = strtoul(argv[4], NULL, 10);
+    info->protocol_type = parse_endpoint_type(argv[5]);
+    for (int i = 6; i < argc; i++)
+        *limits[i - 6] = strtoul(argv[i], NULL, 10);
+    return 0;
+}
+
+// Main function for CLI usage
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        printf("Usage: %s <interface> <command> [args...]\n", argv[0]);
+        printf("Commands:\n");
+        printf("  load <xdp_file> [options]          - Load XDP program\n");
+        printf("      --percpu-rate                  per-CPU source rate limiting\n");
+        printf("      --rebalance-ms <ms>            per-CPU budget rebalance interval\n");
+        printf("      --src-rate-entries <n>         source rate map size\n");
+        printf("      --subnet-rate-entries <n>      subnet rate map size\n");
+        printf("      --conntrack-entries <n>        conntrack map size\n");
+        printf("      --cookie-rotate-s <s>          SYN cookie secret rotation interval\n");
+        printf("      --blacklist-entries <n>        blacklist map size\n");
+        printf("      --blacklist-file <path>        import addresses/prefixes, one per line\n");
+        printf("      --blacklist-bin <path>         import struct blacklist_key records\n");
+        printf("      --blacklist-duration-s <s>     expiry for imported entries (0 = never)\n");
+        printf("      --sweep-interval-s <s>         expiry sweep interval (0 = off)\n");
+        printf("      --sweep-budget <n>             max entries deleted per map per sweep\n");
+        printf("      --rate-idle-s <s>              reclaim rate state idle this long\n");
+        printf("      --conntrack-idle-s <s>         reclaim flows idle this long\n");
+        printf("      --events-url <url>             post sampled drop events to the control plane\n");
+        printf("      --events-token <token>         bearer token for --events-url\n");
+        printf("      --events-interval-s <s>        drop event flush interval\n");
+        printf("      --event-sample <reason>=<n>    report one in n drops for reason (0 = none)\n");
+        printf("  unload                             - Detach XDP program and drop pinned state\n");
+        printf("  add-endpoint <front_ip[/len]> <front_port> <protocol> <origin_ip> <origin_port> <type> <rate> <burst> [<byte_rate> <byte_burst> [<subnet_rate> <subnet_burst> [<endpoint_byte_rate> <endpoint_byte_burst> [<attack_pps> <attack_new_flows>]]]] [fast-path] [syn-cookies]\n");
+        printf("  remove-endpoint <front_ip[/len]> <front_port> <protocol>\n");
+        printf("  blacklist <ip[/len]> <duration_ms>\n");
+        printf("  unblacklist <ip[/len]>\n");
+        printf("  replace-stage <policy|java-tcp|bedrock-udp> <xdp_file>\n");
+        printf("  stats\n");
+        printf("Commands other than load and unload are sent to the running loader.\n");
+        return 1;
+    }
+    
+    const char *ifname = argv[1];
+    const char *command = argv[2];
+    
+    if (strcmp(command, "load") == 0) {
+        if (argc < 4) {
+            printf("Usage: %s <interface> load <xdp_file> [options]\n", argv[0]);
+            return 1;
+        }
+        
+        struct loader_options opts = {
+            .rate_limit_mode = RATE_LIMIT_SHARED,
+            .rebalance_interval_ms = 1000,
+            .cookie_rotate_ms = 60 * 1000,
+            .sweep_interval_ms = 10 * 1000,
+            .sweep_budget = 65536,
+            .rate_idle_ms = 60 * 1000,
+            .conntrack_idle_ms = 300 * 1000,
+            .events_interval_ms = 5 * 1000
+        };
+        for (int r = 0; r < STAT_MAX; r++)
+            opts.event_sample[r] = drop_reason_names[r] ? EVENT_SAMPLE_DEFAULT : 0;
+        for (int i = 4; i < argc; i++) {
+            if (strcmp(argv[i], "--percpu-rate") == 0) {
+                opts.rate_limit_mode = RATE_LIMIT_PERCPU;
+            } else if (strcmp(argv[i], "--rebalance-ms") == 0 && i + 1 < argc) {
+                opts.rebalance_interval_ms = strtoul(argv[++i], NULL, 10);
+            } else if (strcmp(argv[i], "--src-rate-entries") == 0 && i + 1 < argc) {
+                opts.src_rate_entries = strtoul(argv[++i], NULL, 10);
+            } else if (strcmp(argv[i], "--subnet-rate-entries") == 0 && i + 1 < argc) {
+                opts.subnet_rate_entries = strtoul(argv[++i], NULL, 10);
+            } else if (strcmp(argv[i], "--conntrack-entries") == 0 && i + 1 < argc) {
+                opts.conntrack_entries = strtoul(argv[++i], NULL, 10);
+            } else if (strcmp(argv[i], "--cookie-rotate-s") == 0 && i + 1 < argc) {
+                opts.cookie_rotate_ms = strtoul(argv[++i], NULL, 10) * 1000;
+            } else if (strcmp(argv[i], "--blacklist-entries") == 0 && i + 1 < argc) {
+                opts.blacklist_entries = strtoul(argv[++i], NULL, 10);
+            } else if (strcmp(argv[i], "--blacklist-file") == 0 && i + 1 < argc) {
+                opts.blacklist_file = argv[++i];
+            } else if (strcmp(argv[i], "--blacklist-bin") == 0 && i + 1 < argc) {
+                opts.blacklist_bin_file = argv[++i];
+            } else if (strcmp(argv[i], "--blacklist-duration-s") == 0 && i + 1 < argc) {
+                opts.blacklist_duration_ms = strtoull(argv[++i], NULL, 10) * 1000;
+            } else if (strcmp(argv[i], "--sweep-interval-s") == 0 && i + 1 < argc) {
+                opts.sweep_interval_ms = strtoul(argv[++i], NULL, 10) * 1000;
+            } else if (strcmp(argv[i], "--sweep-budget") == 0 && i + 1 < argc) {
+                opts.sweep_budget = strtoul(argv[++i], NULL, 10);
+            } else if (strcmp(argv[i], "--rate-idle-s") == 0 && i + 1 < argc) {
+                opts.rate_idle_ms = strtoul(argv[++i], NULL, 10) * 1000;
+            } else if (strcmp(argv[i], "--conntrack-idle-s") == 0 && i + 1 < argc) {
+                opts.conntrack_idle_ms = strtoul(argv[++i], NULL, 10) * 1000;
+            } else if (strcmp(argv[i], "--events-url") == 0 && i + 1 < argc) {
+                opts.events_url = argv[++i];
+            } else if (strcmp(argv[i], "--events-token") == 0 && i + 1 < argc) {
+                opts.events_token = argv[++i];
+            } else if (strcmp(argv[i], "--events-interval-s") == 0 && i + 1 < argc) {
+                opts.events_interval_ms = strtoul(argv[++i], NULL, 10) * 1000;
+            } else if (strcmp(argv[i], "--event-sample") == 0 && i + 1 < argc) {
+                if (parse_event_sample(argv[++i], opts.event_sample))
+                    return 1;
+            } else {
+                printf("Unknown load option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        
+        nr_cpus = libbpf_num_possible_cpus();
+        if (nr_cpus <= 0) {
+            fprintf(stderr, "Failed to get number of possible CPUs\n");
+            return 1;
+        }
+        
+        if (begin_handover())
+            return 1;
+        if (load_xdp_program(ifname, argv[3], &opts) < 0) {
+            cleanup();
+            return 1;
+        }
+        finish_handover();
+        
+        // Feeds load after attach so protection is never held up by them
+        if (opts.blacklist_file &&
+            import_blacklist(opts.blacklist_file, 0, opts.blacklist_duration_ms))
+            fprintf(stderr, "Warning: blacklist import from %s incomplete\n", opts.blacklist_file);
+        if (opts.blacklist_bin_file &&
+            import_blacklist(opts.blacklist_bin_file, 1, opts.blacklist_duration_ms))
+            fprintf(stderr, "Warning: blacklist import from %s incomplete\n", opts.blacklist_bin_file);
+        
+        if (open_control_socket()) {
+            cleanup();
+            return 1;
+        }
+        
+        signal(SIGINT, handle_signal);
+        signal(SIGTERM, handle_signal);
+        
+        // Keep running to maintain the program
+        printf("XDP program loaded. Ctrl+C stops the loader; protection stays until unload.\n");
+        run_loop(&opts);
+        cleanup();
+        return 0;
+    }
+    
+    if (strcmp(command, "unload") == 0)
+        return unload_xdp_program() ? 1 : 0;
+    
+    // The rest are requests to the running loader
+    if (strcmp(command, "add-endpoint") == 0) {
+        struct ctl_endpoint rec;
+        if (parse_endpoint_args(argc - 3, argv + 3, &rec))
+            return 1;
+        if (control_request(CTL_OP_ADD_ENDPOINT, &rec, 1, sizeof(rec), NULL, 0))
+            return 1;
+        if (rec.info.flags & ENDPOINT_F_SYN_COOKIES)
+            printf("Note: XDP SYN cookies need a netfilter SYNPROXY rule for port %u "
+                   "(see README), or Java connections will not complete\n", rec.key.port);
+        return 0;
+    }
+    
+    if (strcmp(command, "remove-endpoint") == 0) {
+        struct ctl_endpoint rec = {0};
+        if (argc != 6) {
+            printf("Usage: %s <interface> remove-endpoint <front_ip[/len]> <front_port> <protocol>\n", argv[0]);
+            return 1;
+        }
+        if (parse_ip_prefix(argv[3], &rec.key.ip, &rec.prefix_len))
+            return 1;
+        rec.key.port = strtoul(argv[4], NULL, 10);
+        rec.key.protocol = parse_protocol(argv[5]);
+        return control_request(CTL_OP_REMOVE_ENDPOINT, &rec, 1, sizeof(rec), NULL, 0) ? 1 : 0;
+    }
+    
+    if (strcmp(command, "blacklist") == 0 || strcmp(command, "unblacklist") == 0) {
+        int add = strcmp(command, "blacklist") == 0;
+        struct ctl_blacklist rec = {0};
+        if (argc != (add ? 5 : 4)) {
+            printf("Usage: %s <interface> %s\n", argv[0],
+                   add ? "blacklist <ip[/len]> <duration_ms>" : "unblacklist <ip[/len]>");
+            return 1;
+        }
+        if (parse_blacklist_key(argv[3], &rec.key))
+            return 1;
+        if (add)
+            rec.duration_ms = strtoull(argv[4], NULL, 10);
+        return control_request(add ? CTL_OP_BLACKLIST_ADD : CTL_OP_BLACKLIST_REMOVE,
+                               &rec, 1, sizeof(rec), NULL, 0) ? 1 : 0;
+    }
+    
+    if (strcmp(command, "replace-stage") == 0) {
+        struct ctl_stage rec = {0};
+        char path[PATH_MAX];
+        if (argc != 5) {
+            printf("Usage: %s <interface> replace-stage <stage> <xdp_file>\n", argv[0]);
+            return 1;
+        }
+        while (rec.stage < STAGE_MAX && strcmp(stage_names[rec.stage], argv[3]) != 0)
+            rec.stage++;
+        // The loader may run in another directory
+        if (rec.stage == STAGE_MAX || !realpath(argv[4], path) ||
+            strlen(path) >= sizeof(rec.path)) {
+            fprintf(stderr, "Invalid stage %s or object %s\n", argv[3], argv[4]);
+            return 1;
+        }
+        strcpy(rec.path, path);
+        return control_request(CTL_OP_REPLACE_STAGE, &rec, 1, sizeof(rec), NULL, 0) ? 1 : 0;
+    }
+    
+    if (strcmp(command, "stats") == 0) {
+        // The loader runs on this host, so it reports the same CPU count
+        int cpus = libbpf_num_possible_cpus();
+        __u64 *percpu = cpus > 0 ? calloc((size_t)STAT_MAX * cpus, sizeof(__u64)) : NULL;
+        if (!percpu) {
+            fprintf(stderr, "Failed to allocate per-CPU statistics\n");
+            return 1;
         }
+        int err = control_request(CTL_OP_STATS, NULL, 0, 0, percpu,
+                                  sizeof(__u64) * STAT_MAX * cpus);
+        if (!err)
+            print_stats(percpu, cpus);
+        free(percpu);
+        return err ? 1 : 0;
     }
     
     printf("Unknown command: %s\n", command);
@@ -11,475 +11,2005 @@
 #include <linux/ipv6.h>
 #include <linux/udp.h>
 #include <linux/tcp.h>
+#include <linux/in.h>
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_endian.h>
 
+#include "minecraft_protection.h"
+
+#ifndef AF_INET
+#define AF_INET 2
+#endif
+#ifndef AF_INET6
+#define AF_INET6 10
+#endif
+
+// How long a source stays trusted after passing a SipHash SYN cookie
+#define SYNCOOKIE_VERIFIED_MS 30000
+
+// MSS advertised by SipHash SYN cookies; the handshake is reset anyway
+#define SYNCOOKIE_FALLBACK_MSS 536
+
+// 802.1Q/802.1ad tags walked (QinQ)
+#define VLAN_MAX_DEPTH 2
+
+// IPv6 extension headers walked before giving up on a packet
+#define IPV6_MAX_EXT_HDRS 6
+
+// Endpoint attack detection window, and how long an endpoint stays in
+// attack mode after its last window over the threshold
+#define ATTACK_WINDOW_NS 1000000000ULL
+#define ATTACK_HOLD_NS (30 * ATTACK_WINDOW_NS)
+
+// Longest idle gap credited to a token bucket in one refill; keeps
+// elapsed * rate within 64 bits for any 32-bit rate
+#define RATE_MAX_GAP_NS (1ULL << 31)
+
+// Keeps variable packet offsets provably bounded for the verifier
+#define PKT_OFF_MASK 0x3fff
+
 // BPF Maps
-struct {
-    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+// Endpoints are matched exactly with a single hash probe; the LPM tier is
+// only walked on a miss, and only while it has entries. The exact tier is
+// double-buffered: the loader rewrites the standby table and bumps
+// map_endpoint_gen, so packets see a reconfiguration of any size at once.
+struct endpoint_table {
+    __uint(type, BPF_MAP_TYPE_HASH);
     __type(key, struct endpoint_key);
     __type(value, struct endpoint_info);
     __uint(max_entries, 10000);
+} map_protected_endpoints SEC(".maps"), map_protected_endpoints_alt SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, ENDPOINT_TABLES);
+    __array(values, struct endpoint_table);
+} map_endpoint_tables SEC(".maps") = {
+    .values = { &map_protected_endpoints, &map_protected_endpoints_alt }
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, __u32);  // generation; the active table is gen % ENDPOINT_TABLES
+    __uint(max_entries, 1);
+} map_endpoint_gen SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __type(key, struct endpoint_prefix_key);
+    __type(value, struct endpoint_info);
+    __uint(max_entries, 1024);
     __uint(map_flags, BPF_F_NO_PREALLOC);
-} map_protected_endpoints SEC(".maps");
+} map_protected_prefixes SEC(".maps");
 
+// Per-source and per-flow state is LRU so a random-source flood recycles
+// the coldest entries instead of filling the map; sizes are set by the loader.
 struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
-    __type(key, __u32);  // source IP
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct ip_addr);  // source key, see ip_addr_source_key()
     __type(value, struct rate_limit_state);
     __uint(max_entries, 100000);
 } map_src_rate SEC(".maps");
 
 struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+    __type(key, struct ip_addr);  // source key
+    __type(value, struct rate_limit_state);
+    __uint(max_entries, 100000);
+} map_src_rate_percpu SEC(".maps");
+
+// Per-CPU budget shares of hot sources, see struct rate_share
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+    __type(key, struct ip_addr);  // source key
+    __type(value, struct rate_share);
+    __uint(max_entries, 16384);
+} map_src_share SEC(".maps");
+
+// Subnet buckets, one level above the source buckets (ip_addr_subnet_key())
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct ip_addr);
+    __type(value, struct rate_limit_state);
+    __uint(max_entries, 65536);
+} map_subnet_rate SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+    __type(key, struct ip_addr);
+    __type(value, struct rate_limit_state);
+    __uint(max_entries, 65536);
+} map_subnet_rate_percpu SEC(".maps");
+
+// Endpoint-wide budgets indexed by endpoint_info.endpoint_id. Each CPU
+// enforces its even share, so the hot path needs no atomics.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, __u32);
+    __type(value, struct endpoint_state);
+    __uint(max_entries, ENDPOINT_ID_MAX);
+} map_endpoint_state SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, struct endpoint_mode);
+    __uint(max_entries, ENDPOINT_ID_MAX);
+} map_endpoint_mode SEC(".maps");
+
+// Per-endpoint counters keyed by endpoint_info.endpoint_id. Entries are
+// created by the loader when it assigns an id and only allocated for ids
+// in use.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __type(key, __u32);
+    __type(value, struct endpoint_counters);
+    __uint(max_entries, ENDPOINT_ID_MAX);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+} map_endpoint_counters SEC(".maps");
+
+// Events for the loader (struct dp_event)
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, 256 * 1024);
+} map_events SEC(".maps");
+
+// Drop sampling rates indexed by STAT_* reason: one in N drops is reported
+// as an EVENT_DROP, 0 reports none. Set by the loader.
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, __u32);
+    __uint(max_entries, STAT_MAX);
+} map_event_sample SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
     __type(key, __u64);  // 5-tuple hash
     __type(value, struct conntrack_entry);
     __uint(max_entries, 100000);
 } map_conntrack SEC(".maps");
 
+// Blocked prefixes from the API and threat feeds, matched on the full
+// source address; resized by the loader
 struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
-    __type(key, __u32);  // IP address
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __type(key, struct blacklist_key);
     __type(value, __u64);  // timestamp until blocked
-    __uint(max_entries, 50000);
+    __uint(max_entries, 262144);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
 } map_blacklist SEC(".maps");
 
+// Per-CPU so counting never bounces a shared cache line between RX queues;
+// the loader sums the per-CPU values when reporting.
 struct {
-    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
     __type(key, __u32);
     __type(value, __u64);
-    __uint(max_entries, 10);
+    __uint(max_entries, STAT_MAX);
 } map_stats SEC(".maps");
 
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, struct dataplane_config);
+    __uint(max_entries, 1);
+} map_config SEC(".maps");
+
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
-    __type(key, __u32);  // source IP
-    __type(value, struct udp_challenge_state);
+    __type(key, struct origin_key);
+    __type(value, struct front_addr);
     __uint(max_entries, 10000);
-} map_udp_challenges SEC(".maps");
-
-// Data structures
-struct endpoint_key {
-    __u32 prefix_len;
-    __u32 ip;
-    __u16 port;
-    __u8 protocol;
-};
+} map_origin_reverse SEC(".maps");
 
-struct endpoint_info {
-    __u32 origin_ip;
-    __u16 origin_port;
-    __u32 rate_limit;
-    __u32 burst_limit;
-    __u8 protocol_type;  // 0=Java, 1=Bedrock
-    __u8 maintenance_mode;
-    __u8 padding[2];
-};
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, struct cookie_secret);
+    __uint(max_entries, COOKIE_SECRET_MAX);
+} map_cookie_secrets SEC(".maps");
+
+#ifdef SYNCOOKIE_SIPHASH
+// Sources that completed a SipHash cookie handshake; their next SYN goes
+// straight to the kernel
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct ip_addr);  // source key
+    __type(value, __u64);  // verified until (ms)
+    __uint(max_entries, 65536);
+} map_syncookie_verified SEC(".maps");
+#endif
+
+// AF_XDP sockets keyed by RX queue index, registered by xsk_consumer
+struct {
+    __uint(type, BPF_MAP_TYPE_XSKMAP);
+    __type(key, __u32);
+    __type(value, __u32);
+    __uint(max_entries, XSK_MAX_QUEUES);
+} xsks SEC(".maps");
 
-struct rate_limit_state {
-    __u64 last_update;
-    __u32 tokens;
-    __u32 last_burst;
+// Parsed view of a packet. Offsets are from the start of the frame.
+struct pkt_info {
+    struct ip_addr saddr;
+    struct ip_addr daddr;
+    __u16 l3_off;   // IP header
+    __u16 l4_off;   // TCP/UDP header
+    __u16 payload_off;  // TCP/UDP payload
+    __u16 l3_end;   // end of the IP datagram, excluding Ethernet padding
+    __u16 sport;    // host order
+    __u16 dport;
+    __u8 family;    // AF_INET or AF_INET6
+    __u8 l4_proto;
+    __u16 frame_len;  // bytes received; the IP length fields are the sender's claim
 };
 
-struct conntrack_entry {
-    __u32 src_ip;
-    __u32 dst_ip;
-    __u16 src_port;
-    __u16 dst_port;
-    __u8 protocol;
-    __u8 state;  // 0=unknown, 1=established, 2=challenge_sent
-    __u16 challenge_id;
-    __u8 padding[1];
+enum {
+    PARSE_OK,
+    PARSE_PASS,  // not IP, leave to the kernel
+    PARSE_DROP   // truncated or malformed
 };
 
-struct udp_challenge_state {
-    __u64 timestamp;
-    __u32 challenge_cookie;
-    __u8 challenge_sent;
-    __u8 padding[3];
+struct vlan_hdr {
+    __be16 h_vlan_TCI;
+    __be16 h_vlan_encapsulated_proto;
 };
 
-// Statistics counters
-enum {
-    STAT_ALLOWED_PACKETS,
-    STAT_BLOCKED_RATE_LIMIT,
-    STAT_BLOCKED_BLACKLIST,
-    STAT_BLOCKED_INVALID_PROTOCOL,
-    STAT_BLOCKED_CHALLENGE_FAILED,
-    STAT_BLOCKED_MAINTENANCE,
-    STAT_TOTAL_PACKETS,
-    STAT_XDP_DROP,
-    STAT_XDP_PASS,
-    STAT_XDP_REDIRECT,
-    STAT_UDP_CHALLENGES_SENT,
-    STAT_UDP_CHALLENGES_PASSED
+struct ipv6_frag_hdr {
+    __u8 nexthdr;
+    __u8 reserved;
+    __be16 frag_off;
+    __be32 identification;
 };
 
+#define IPV6_FRAG_OFFSET 0xfff8
+#define IPV4_FRAG_OFFSET 0x1fff
+
+#ifdef TEST_CLOCK
+// Test builds (make test) take the time from here while it is non-zero,
+// so replayed traces see exactly the timestamps they carry
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, __u64);  // ns, 0 = use the real clock
+    __uint(max_entries, 1);
+} map_test_clock SEC(".maps");
+#endif
+
 // Helper functions
-static __always_inline __u32 get_current_time(void)
+// CLOCK_MONOTONIC, the clock the loader uses for expiry times. The coarse
+// clock (tick resolution) is plenty for token buckets and timeouts and is
+// cheaper to read on every packet.
+static __always_inline __u64 get_time_ns(void)
 {
-    return bpf_ktime_get_ns() / 1000000; // Convert to milliseconds
+#ifdef TEST_CLOCK
+    __u32 zero = 0;
+    __u64 *now = bpf_map_lookup_elem(&map_test_clock, &zero);
+    if (now && *now)
+        return *now;
+#endif
+    return bpf_ktime_get_coarse_ns();
 }
 
-static __always_inline __u64 hash_5tuple(__u32 src_ip, __u32 dst_ip, 
-                                        __u16 src_port, __u16 dst_port, __u8 protocol)
+// Milliseconds of get_time_ns(). 32-bit fields hold it truncated and are
+// compared as wrapping differences.
+static __always_inline __u64 get_current_time(void)
 {
-    return ((__u64)src_ip << 32) | dst_ip | ((__u64)src_port << 48) | 
-           ((__u64)dst_port << 32) | ((__u64)protocol << 24);
+    return get_time_ns() / 1000000;
 }
 
-static __always_inline int update_rate_limit(__u32 src_ip, __u32 rate_limit, __u32 burst_limit)
+static __always_inline void update_stats(__u32 stat_type)
 {
-    struct rate_limit_state *state = bpf_map_lookup_elem(&map_src_rate, &src_ip);
-    __u32 current_time = get_current_time();
-    
-    if (!state) {
-        // First packet from this IP
-        struct rate_limit_state new_state = {
-            .last_update = current_time,
-            .tokens = burst_limit,
-            .last_burst = 0
-        };
-        if (bpf_map_update_elem(&map_src_rate, &src_ip, &new_state, BPF_ANY) < 0)
-            return -1;
-        return 1; // Allow
+    __u64 *count = bpf_map_lookup_elem(&map_stats, &stat_type);
+    if (count) {
+        (*count)++;
     }
+}
+
+// Bounds-checked pointer to len bytes at off
+static __always_inline void *pkt_at(struct xdp_md *ctx, __u32 off, __u32 len)
+{
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+    void *p = data + (off & PKT_OFF_MASK);
     
-    // Calculate tokens based on time elapsed
-    __u32 time_diff = current_time - state->last_update;
-    __u32 new_tokens = state->tokens + (time_diff * rate_limit / 1000);
+    if (p + len > data_end)
+        return NULL;
+    return p;
+}
+
+static __always_inline int ipv6_is_ext_hdr(__u8 nexthdr)
+{
+    return nexthdr == IPPROTO_HOPOPTS || nexthdr == IPPROTO_ROUTING ||
+           nexthdr == IPPROTO_DSTOPTS || nexthdr == IPPROTO_FRAGMENT ||
+           nexthdr == IPPROTO_AH;
+}
+
+// Walk the IPv6 extension header chain up to the transport header. Chains
+// longer than IPV6_MAX_EXT_HDRS are dropped rather than let through
+// unfiltered; non-initial fragments carry no ports and are reported as
+// IPPROTO_FRAGMENT.
+static __always_inline int parse_ipv6(struct xdp_md *ctx, struct ipv6hdr *ip6,
+                                      struct pkt_info *pi)
+{
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+    __u8 nexthdr = ip6->nexthdr;
+    void *pos = ip6 + 1;
     
-    if (new_tokens > burst_limit)
-        new_tokens = burst_limit;
+    pi->family = AF_INET6;
+    __builtin_memcpy(&pi->saddr, &ip6->saddr, sizeof(pi->saddr));
+    __builtin_memcpy(&pi->daddr, &ip6->daddr, sizeof(pi->daddr));
+    pi->l3_end = pi->l3_off + sizeof(struct ipv6hdr) + bpf_ntohs(ip6->payload_len);
     
-    if (new_tokens == 0) {
-        // Rate limited
-        state->last_update = current_time;
-        return 0; // Drop
+#pragma unroll
+    for (int i = 0; i < IPV6_MAX_EXT_HDRS; i++) {
+        if (!ipv6_is_ext_hdr(nexthdr))
+            break;
+        
+        struct ipv6_opt_hdr *opt = pos;
+        if ((void *)(opt + 1) > data_end)
+            return PARSE_DROP;
+        
+        if (nexthdr == IPPROTO_FRAGMENT) {
+            struct ipv6_frag_hdr *frag = pos;
+            if ((void *)(frag + 1) > data_end)
+                return PARSE_DROP;
+            if (frag->frag_off & bpf_htons(IPV6_FRAG_OFFSET)) {
+                pi->l4_proto = IPPROTO_FRAGMENT;
+                return PARSE_OK;
+            }
+            pos += sizeof(*frag);
+        } else if (nexthdr == IPPROTO_AH) {
+            pos += (opt->hdrlen + 2) * 4;
+        } else {
+            pos += (opt->hdrlen + 1) * 8;
+        }
+        nexthdr = opt->nexthdr;
     }
     
-    // Consume one token
-    new_tokens--;
-    state->tokens = new_tokens;
-    state->last_update = current_time;
+    if (ipv6_is_ext_hdr(nexthdr))
+        return PARSE_DROP;
     
-    return 1; // Allow
+    pi->l4_off = pos - data;
+    pi->l4_proto = nexthdr;
+    return PARSE_OK;
 }
 
-static __always_inline int is_blacklisted(__u32 src_ip)
+static __always_inline int is_vlan_proto(__be16 proto)
 {
-    __u64 *blocked_until = bpf_map_lookup_elem(&map_blacklist, &src_ip);
-    if (!blocked_until)
-        return 0;
-    
-    __u64 current_time = bpf_ktime_get_ns() / 1000000;
-    if (current_time < *blocked_until)
-        return 1; // Still blocked
-    
-    // Expired, remove from blacklist
-    bpf_map_delete_elem(&map_blacklist, &src_ip);
-    return 0;
+    return proto == bpf_htons(ETH_P_8021Q) || proto == bpf_htons(ETH_P_8021AD);
 }
 
-static __always_inline int validate_minecraft_java(struct xdp_md *ctx, void *data, void *data_end)
+// Parse L2-L4 into pi: up to VLAN_MAX_DEPTH VLAN tags, IPv4 with options
+// or IPv6 with extension headers. Ports and the payload offset are only
+// filled in for TCP and UDP; non-initial fragments of either family are
+// reported as IPPROTO_FRAGMENT.
+static __always_inline int parse_packet(struct xdp_md *ctx, struct pkt_info *pi)
 {
-    // Enhanced Minecraft Java TCP validation
-    // Minecraft Java handshake: VarInt length + packet ID (0x00 for handshake)
-    // Then: protocol version (VarInt) + server address (String) + port (unsigned short) + next state (VarInt)
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
     
-    if (data + 5 > data_end)
-        return 0;
+    struct ethhdr *eth = data;
+    if ((void *)(eth + 1) > data_end)
+        return PARSE_DROP;
+    pi->frame_len = data_end - data;
     
-    __u8 *pkt = (__u8 *)data;
-    __u32 offset = 0;
-    
-    // Parse VarInt length (first byte)
-    __u32 length = 0;
-    __u32 length_bytes = 0;
-    __u8 byte = pkt[offset++];
-    
-    if (byte & 0x80) {
-        // Multi-byte VarInt
-        length = byte & 0x7F;
-        while (offset < 5 && (pkt[offset] & 0x80)) {
-            if (offset + 1 > data_end)
-                return 0;
-            length |= (pkt[offset] & 0x7F) << (7 * (offset - length_bytes));
-            offset++;
-        }
-        if (offset < 5) {
-            length |= pkt[offset] << (7 * (offset - length_bytes));
-            offset++;
-        }
-    } else {
-        length = byte;
-    }
+    __be16 proto = eth->h_proto;
+    void *pos = eth + 1;
     
-    // Validate length (reasonable bounds for handshake)
-    if (length < 5 || length > 100)
-        return 0;
+#pragma unroll
+    for (int i = 0; i < VLAN_MAX_DEPTH; i++) {
+        if (!is_vlan_proto(proto))
+            break;
+        struct vlan_hdr *vlan = pos;
+        if ((void *)(vlan + 1) > data_end)
+            return PARSE_DROP;
+        proto = vlan->h_vlan_encapsulated_proto;
+        pos = vlan + 1;
+    }
     
-    // Check packet ID (should be 0x00 for handshake)
-    if (offset >= data_end || pkt[offset] != 0x00)
-        return 0;
-    offset++;
+    // Deeper tag stacks would hide the IP header from filtering
+    if (is_vlan_proto(proto))
+        return PARSE_DROP;
     
-    // Check protocol version (should be reasonable Minecraft version)
-    if (offset >= data_end)
-        return 0;
+    pi->l3_off = pos - data;
     
-    __u32 protocol_version = 0;
-    __u8 ver_byte = pkt[offset++];
-    if (ver_byte & 0x80) {
-        // Multi-byte protocol version
-        protocol_version = ver_byte & 0x7F;
-        while (offset < data_end && (pkt[offset] & 0x80)) {
-            protocol_version |= (pkt[offset] & 0x7F) << (7 * (offset - 1));
-            offset++;
-        }
-        if (offset < data_end) {
-            protocol_version |= pkt[offset] << (7 * (offset - 1));
-            offset++;
-        }
+    if (proto == bpf_htons(ETH_P_IP)) {
+        struct iphdr *ip = pos;
+        if ((void *)(ip + 1) > data_end)
+            return PARSE_DROP;
+        
+        __u32 ihl = ip->ihl * 4;
+        if (ihl < sizeof(struct iphdr))
+            return PARSE_DROP;
+        
+        pi->family = AF_INET;
+        ip_addr_set_v4(&pi->saddr, ip->saddr);
+        ip_addr_set_v4(&pi->daddr, ip->daddr);
+        pi->l3_end = pi->l3_off + bpf_ntohs(ip->tot_len);
+        pi->l4_off = pi->l3_off + ihl;
+        pi->l4_proto = ip->protocol;
+        // Non-initial fragments start mid-datagram, with no transport header
+        if (ip->frag_off & bpf_htons(IPV4_FRAG_OFFSET))
+            pi->l4_proto = IPPROTO_FRAGMENT;
+    } else if (proto == bpf_htons(ETH_P_IPV6)) {
+        struct ipv6hdr *ip6 = pos;
+        if ((void *)(ip6 + 1) > data_end)
+            return PARSE_DROP;
+        
+        int ret = parse_ipv6(ctx, ip6, pi);
+        if (ret != PARSE_OK)
+            return ret;
     } else {
-        protocol_version = ver_byte;
+        return PARSE_PASS;
     }
     
-    // Validate protocol version (Minecraft versions typically 4-760+)
-    if (protocol_version < 4 || protocol_version > 1000)
-        return 0;
+    if (pi->l4_proto == IPPROTO_TCP) {
+        struct tcphdr *tcp = pkt_at(ctx, pi->l4_off, sizeof(*tcp));
+        if (!tcp || tcp->doff < 5)
+            return PARSE_DROP;
+        pi->sport = bpf_ntohs(tcp->source);
+        pi->dport = bpf_ntohs(tcp->dest);
+        pi->payload_off = pi->l4_off + tcp->doff * 4;
+    } else if (pi->l4_proto == IPPROTO_UDP) {
+        struct udphdr *udp = pkt_at(ctx, pi->l4_off, sizeof(*udp));
+        if (!udp)
+            return PARSE_DROP;
+        pi->sport = bpf_ntohs(udp->source);
+        pi->dport = bpf_ntohs(udp->dest);
+        pi->payload_off = pi->l4_off + sizeof(*udp);
+    }
     
-    return 1; // Valid Minecraft Java handshake
+    return PARSE_OK;
+}
+
+static __always_inline __u64 ip_addr_fold(const struct ip_addr *a)
+{
+    return (((__u64)a->w[0] << 32) | a->w[1]) ^ (((__u64)a->w[2] << 32) | a->w[3]);
+}
+
+static __always_inline __u64 hash_flow(const struct pkt_info *pi)
+{
+    __u64 h = ip_addr_fold(&pi->saddr) * 0x9e3779b97f4a7c15ULL;
+    h ^= ip_addr_fold(&pi->daddr);
+    h *= 0x9e3779b97f4a7c15ULL;
+    return h ^ ((__u64)pi->sport << 48) ^ ((__u64)pi->dport << 32) ^
+           ((__u64)pi->l4_proto << 24);
+}
+
+static __always_inline struct dataplane_config *get_config(void)
+{
+    __u32 key = 0;
+    return bpf_map_lookup_elem(&map_config, &key);
 }
 
-static __always_inline int validate_minecraft_bedrock(struct xdp_md *ctx, void *data, void *data_end)
+static __always_inline struct endpoint_info *lookup_endpoint(const struct pkt_info *pi)
 {
-    // Enhanced Minecraft Bedrock UDP validation
-    // Bedrock uses RakNet protocol with specific packet structure
+    struct endpoint_key key = {
+        .ip = pi->daddr,
+        .port = pi->dport,
+        .protocol = pi->l4_proto
+    };
     
-    if (data + 4 > data_end)
-        return 0;
+    __u32 zero = 0;
+    __u32 *gen = bpf_map_lookup_elem(&map_endpoint_gen, &zero);
+    __u32 slot = gen ? *gen % ENDPOINT_TABLES : 0;
+    void *table = bpf_map_lookup_elem(&map_endpoint_tables, &slot);
     
-    __u8 *pkt = (__u8 *)data;
-    
-    // RakNet packet types for Minecraft Bedrock
-    // 0x05: UNCONNECTED_PING
-    // 0x06: UNCONNECTED_PONG  
-    // 0x07: OPEN_CONNECTION_REQUEST_1
-    // 0x08: OPEN_CONNECTION_REPLY_1
-    // 0x09: OPEN_CONNECTION_REQUEST_2
-    // 0x10: OPEN_CONNECTION_REPLY_2
-    // 0x13: INCOMPATIBLE_PROTOCOL_VERSION
-    // 0x15: UNCONNECTED_PING_OPEN_CONNECTIONS
-    // 0x1c: OPEN_CONNECTION_REQUEST_1_BROADCAST
-    
-    __u8 packet_type = pkt[0];
-    
-    // Validate common RakNet packet types
-    if (packet_type == 0x05 || packet_type == 0x06 || packet_type == 0x07 || 
-        packet_type == 0x08 || packet_type == 0x09 || packet_type == 0x10 ||
-        packet_type == 0x13 || packet_type == 0x15 || packet_type == 0x1c) {
-        
-        // Additional validation for specific packet types
-        if (packet_type == 0x05 || packet_type == 0x15) { // UNCONNECTED_PING variants
-            // Should have RakNet magic bytes at offset 1-16
-            if (data + 17 > data_end)
-                return 0;
-            
-            // Check for RakNet magic: 0x00, 0xFF, 0xFF, 0x00, 0xFE, 0xFE, 0xFE, 0xFE, 0xFD, 0xFD, 0xFD, 0xFD, 0x12, 0x34, 0x56, 0x78
-            if (pkt[1] == 0x00 && pkt[2] == 0xFF && pkt[3] == 0xFF && pkt[4] == 0x00 &&
-                pkt[5] == 0xFE && pkt[6] == 0xFE && pkt[7] == 0xFE && pkt[8] == 0xFE &&
-                pkt[9] == 0xFD && pkt[10] == 0xFD && pkt[11] == 0xFD && pkt[12] == 0xFD &&
-                pkt[13] == 0x12 && pkt[14] == 0x34 && pkt[15] == 0x56 && pkt[16] == 0x78) {
-                return 1;
-            }
-        }
-        
-        // For other packet types, basic validation
-        return 1;
-    }
+    struct endpoint_info *endpoint = table ? bpf_map_lookup_elem(table, &key) : NULL;
+    if (endpoint)
+        return endpoint;
     
-    return 0;
+    struct dataplane_config *cfg = get_config();
+    if (!cfg || !cfg->endpoint_prefixes)
+        return NULL;
+    
+    struct endpoint_prefix_key pkey = {
+        .prefix_len = ENDPOINT_PREFIX_HDR_BITS + 128,
+        .port = pi->dport,
+        .protocol = pi->l4_proto,
+        .ip = pi->daddr
+    };
+    return bpf_map_lookup_elem(&map_protected_prefixes, &pkey);
 }
 
-static __always_inline void update_stats(__u32 stat_type)
+// Insert a new entry into an LRU state map. Every insert into a full map
+// evicts its coldest entry, so STAT_STATE_INSERTS against the map size is
+// the eviction pressure. A failed insert admits the packet without state
+// rather than failing closed on legitimate new sources.
+static __always_inline void insert_state(void *map, const void *key, const void *value)
 {
-    __u64 *count = bpf_map_lookup_elem(&map_stats, &stat_type);
-    if (count) {
-        __sync_fetch_and_add(count, 1);
+    update_stats(STAT_STATE_INSERTS);
+    if (bpf_map_update_elem(map, key, value, BPF_ANY) < 0)
+        update_stats(STAT_STATE_INSERT_FAILED);
+}
+
+// Per-source limits in effect for one packet, already split per CPU in
+// per-CPU mode
+struct rate_limits {
+    __u32 rate;
+    __u32 burst;
+    __u32 byte_rate;   // 0 = no byte budget
+    __u32 byte_burst;
+};
+
+// Refill a fixed-point bucket for elapsed ns of rate. Longer gaps are cut
+// to RATE_MAX_GAP_NS so the multiply cannot overflow; that only matters
+// for bursts worth more than two seconds of rate, which then refill a
+// little slower.
+static __always_inline __u64 bucket_refill(__u64 tokens, __u64 elapsed, __u32 rate, __u32 burst)
+{
+    __u64 cap = (__u64)burst * RATE_TOKEN_SCALE;
+    
+    if (elapsed > RATE_MAX_GAP_NS)
+        elapsed = RATE_MAX_GAP_NS;
+    tokens += elapsed * rate;
+    return tokens > cap ? cap : tokens;
+}
+
+// Take one packet of len bytes from both buckets, or from neither. A packet
+// larger than the whole byte burst drains the byte bucket instead.
+static __always_inline int consume_token(struct rate_limit_state *state, __u64 now,
+                                         const struct rate_limits *lim, __u32 len)
+{
+    __u64 elapsed = now > state->last_update ? now - state->last_update : 0;
+    __u64 tokens = bucket_refill(state->tokens, elapsed, lim->rate, lim->burst);
+    __u64 byte_tokens = state->byte_tokens;
+    __u64 byte_cost = 0;
+    int allow = tokens >= RATE_TOKEN_SCALE;
+    
+    if (lim->byte_rate) {
+        __u64 cap = (__u64)lim->byte_burst * RATE_TOKEN_SCALE;
+        byte_cost = (__u64)len * RATE_TOKEN_SCALE;
+        if (byte_cost > cap)
+            byte_cost = cap;
+        byte_tokens = bucket_refill(byte_tokens, elapsed, lim->byte_rate, lim->byte_burst);
+        if (byte_tokens < byte_cost)
+            allow = 0;
+    }
+    
+    if (allow) {
+        tokens -= RATE_TOKEN_SCALE;
+        byte_tokens -= byte_cost;
     }
+    
+    state->tokens = tokens;
+    state->byte_tokens = byte_tokens;
+    state->last_update = now;
+    return allow;
+}
+
+// Start a source with full buckets
+static __always_inline void fill_buckets(struct rate_limit_state *state, __u64 now,
+                                         const struct rate_limits *lim)
+{
+    state->last_update = now;
+    state->tokens = (__u64)lim->burst * RATE_TOKEN_SCALE;
+    state->byte_tokens = (__u64)lim->byte_burst * RATE_TOKEN_SCALE;
+}
+
+// Slice of an endpoint limit granted to the current CPU. The loader
+// rebalances shares towards the CPUs a source actually hashes to; until
+// then every CPU gets an even split.
+static __always_inline __u32 percpu_budget(__u32 limit, __u32 share, __u32 nr_cpus)
+{
+    __u32 budget;
+    
+    if (share)
+        budget = ((__u64)limit * share) / RATE_SHARE_SCALE;
+    else
+        budget = nr_cpus ? limit / nr_cpus : limit;
+    
+    return budget ? budget : 1;
 }
 
-static __always_inline int handle_udp_challenge(__u32 src_ip, void *data, void *data_end)
+static __always_inline int update_rate_limit_percpu(const struct ip_addr *src,
+                                                    const struct endpoint_info *endpoint,
+                                                    __u32 len, __u64 now, __u32 nr_cpus)
 {
-    // Check if this IP already has a challenge
-    struct udp_challenge_state *challenge = bpf_map_lookup_elem(&map_udp_challenges, &src_ip);
-    __u64 current_time = bpf_ktime_get_ns() / 1000000;
+    // Per-CPU lookups return this CPU's private copy, so no atomics are
+    // needed and RX queues never share the bucket's cache line.
+    struct rate_limit_state *state = bpf_map_lookup_elem(&map_src_rate_percpu, src);
+    __u32 share = state ? state->share : 0;
+    
+    struct rate_limits lim = {
+        .rate = percpu_budget(endpoint->rate_limit, share, nr_cpus),
+        .burst = percpu_budget(endpoint->burst_limit, share, nr_cpus)
+    };
+    if (endpoint->byte_rate_limit) {
+        lim.byte_rate = percpu_budget(endpoint->byte_rate_limit, share, nr_cpus);
+        lim.byte_burst = percpu_budget(endpoint->byte_burst_limit, share, nr_cpus);
+    }
     
-    if (!challenge) {
-        // First packet from this IP - send challenge
-        struct udp_challenge_state new_challenge = {
-            .timestamp = current_time,
-            .challenge_cookie = (__u32)(current_time ^ src_ip), // Simple cookie generation
-            .challenge_sent = 1
+    if (!state) {
+        // First packet from this IP. The kernel zeroes the other CPUs'
+        // copies, which are treated as full buckets on their first packet.
+        struct rate_limit_state new_state = {
+            .hits = 1
         };
-        
-        if (bpf_map_update_elem(&map_udp_challenges, &src_ip, &new_challenge, BPF_ANY) < 0)
-            return 0; // Failed to store challenge
-        
-        update_stats(STAT_UDP_CHALLENGES_SENT);
-        return 0; // Drop packet, challenge sent
+        fill_buckets(&new_state, now, &lim);
+        int allow = consume_token(&new_state, now, &lim, len);
+        insert_state(&map_src_rate_percpu, src, &new_state);
+        return allow;
     }
     
-    // Check if challenge is expired (5 seconds)
-    if (current_time - challenge->timestamp > 5000) {
-        // Challenge expired, remove and send new one
-        bpf_map_delete_elem(&map_udp_challenges, &src_ip);
-        return handle_udp_challenge(src_ip, data, data_end);
+    // The loader publishes shares in map_src_share; each CPU picks up its
+    // own every RATE_SHARE_REFRESH packets
+    state->hits++;
+    if (state->hits % RATE_SHARE_REFRESH == 0) {
+        struct rate_share *rs = bpf_map_lookup_elem(&map_src_share, src);
+        state->share = rs ? rs->share : 0;
     }
+    if (state->last_update == 0)
+        fill_buckets(state, now, &lim);
     
-    // Check if this packet contains the challenge response
-    if (data + 8 > data_end)
-        return 0;
+    return consume_token(state, now, &lim, len);
+}
+
+// Subnet bucket shared by every source in src's /24 (IPv6 /48). In per-CPU
+// mode each CPU enforces an even share, as for endpoint budgets.
+static __always_inline int update_subnet_rate_limit(const struct ip_addr *src,
+                                                    const struct endpoint_info *endpoint,
+                                                    __u32 len, __u64 now,
+                                                    const struct dataplane_config *cfg)
+{
+    if (!endpoint->subnet_rate_limit)
+        return 1;
     
-    __u8 *pkt = (__u8 *)data;
+    struct ip_addr net = *src;
+    ip_addr_subnet_key(&net);
     
-    // Look for challenge cookie in packet (simplified - real implementation would be more sophisticated)
-    // This is a placeholder - in reality, we'd need to modify the packet or use a different approach
-    // For now, we'll accept packets after a short delay to simulate challenge completion
+    int percpu = cfg && cfg->rate_limit_mode == RATE_LIMIT_PERCPU;
+    struct rate_limit_state *state;
+    struct rate_limits lim = {
+        .rate = endpoint->subnet_rate_limit,
+        .burst = endpoint->subnet_burst_limit
+    };
     
-    if (current_time - challenge->timestamp > 100) { // 100ms delay
-        // Challenge passed
-        bpf_map_delete_elem(&map_udp_challenges, &src_ip);
-        update_stats(STAT_UDP_CHALLENGES_PASSED);
-        return 1; // Allow packet
+    if (percpu) {
+        lim.rate = percpu_budget(lim.rate, 0, cfg->nr_cpus);
+        lim.burst = percpu_budget(lim.burst, 0, cfg->nr_cpus);
+        state = bpf_map_lookup_elem(&map_subnet_rate_percpu, &net);
+    } else {
+        state = bpf_map_lookup_elem(&map_subnet_rate, &net);
     }
     
-    return 0; // Still waiting for challenge response
+    if (!state) {
+        struct rate_limit_state new_state = {};
+        fill_buckets(&new_state, now, &lim);
+        int allow = consume_token(&new_state, now, &lim, len);
+        if (percpu)
+            insert_state(&map_subnet_rate_percpu, &net, &new_state);
+        else
+            insert_state(&map_subnet_rate, &net, &new_state);
+        return allow;
+    }
+    
+    // Other CPUs' copies of a per-CPU entry start zeroed
+    if (state->last_update == 0)
+        fill_buckets(state, now, &lim);
+    
+    return consume_token(state, now, &lim, len);
 }
 
-// Main XDP program
-SEC("xdp")
-int xdp_minecraft_protection(struct xdp_md *ctx)
+static __always_inline int update_source_rate_limit(const struct ip_addr *src,
+                                                    const struct endpoint_info *endpoint,
+                                                    __u32 len, __u64 now,
+                                                    const struct dataplane_config *cfg)
 {
-    void *data_end = (void *)(long)ctx->data_end;
-    void *data = (void *)(long)ctx->data;
+    if (cfg && cfg->rate_limit_mode == RATE_LIMIT_PERCPU)
+        return update_rate_limit_percpu(src, endpoint, len, now, cfg->nr_cpus);
     
-    update_stats(STAT_TOTAL_PACKETS);
+    struct rate_limit_state *state = bpf_map_lookup_elem(&map_src_rate, src);
+    struct rate_limits lim = {
+        .rate = endpoint->rate_limit,
+        .burst = endpoint->burst_limit,
+        .byte_rate = endpoint->byte_rate_limit,
+        .byte_burst = endpoint->byte_burst_limit
+    };
     
-    // Parse Ethernet header
-    struct ethhdr *eth = data;
-    if ((void *)(eth + 1) > data_end)
-        return XDP_DROP;
+    if (!state) {
+        // First packet from this IP
+        struct rate_limit_state new_state = {};
+        fill_buckets(&new_state, now, &lim);
+        int allow = consume_token(&new_state, now, &lim, len);
+        insert_state(&map_src_rate, src, &new_state);
+        return allow;
+    }
     
-    // Only handle IPv4 for now (IPv6 support can be added later)
-    if (eth->h_proto != bpf_htons(ETH_P_IP))
-        return XDP_PASS;
+    return consume_token(state, now, &lim, len);
+}
+
+// Hierarchical limit: the source bucket (an IPv6 /64), then the subnet
+// bucket (/24, IPv6 /48). Only packets their source may send are charged
+// to the subnet, so one source over its limit cannot starve its
+// neighbours. len is the frame length charged against the byte budget.
+static __always_inline int update_rate_limit(const struct ip_addr *src,
+                                             const struct endpoint_info *endpoint, __u32 len)
+{
+    struct dataplane_config *cfg = get_config();
+    __u64 now = get_time_ns();
     
-    // Parse IP header
-    struct iphdr *ip = (struct iphdr *)(eth + 1);
-    if ((void *)(ip + 1) > data_end)
-        return XDP_DROP;
+    if (!update_source_rate_limit(src, endpoint, len, now, cfg))
+        return 0;
+    return update_subnet_rate_limit(src, endpoint, len, now, cfg);
+}
+
+// Endpoint-wide byte budget. This CPU gets an even share; RSS spreads a
+// flood's sources over all queues, so shares fill at about the same rate.
+static __always_inline int update_endpoint_byte_limit(const struct endpoint_info *endpoint,
+                                                      struct endpoint_state *state, __u32 len,
+                                                      __u64 now, __u32 nr_cpus)
+{
+    if (!endpoint->endpoint_byte_rate_limit || !state)
+        return 1;
     
-    // Check if source is blacklisted
-    if (is_blacklisted(ip->saddr)) {
-        update_stats(STAT_BLOCKED_BLACKLIST);
-        return XDP_DROP;
-    }
+    __u32 rate = percpu_budget(endpoint->endpoint_byte_rate_limit, 0, nr_cpus);
+    __u32 burst = percpu_budget(endpoint->endpoint_byte_burst_limit, 0, nr_cpus);
     
-    // Look up protected endpoint
-    struct endpoint_key key = {
-        .prefix_len = 32,
-        .ip = ip->daddr,
-        .port = 0,  // Will be set based on protocol
-        .protocol = ip->protocol
-    };
+    // A zeroed slot (new or reassigned endpoint) starts full
+    __u64 tokens = (__u64)burst * RATE_TOKEN_SCALE;
+    if (state->last_update)
+        tokens = bucket_refill(state->byte_tokens, now - state->last_update, rate, burst);
+    state->last_update = now;
     
-    // Set port based on protocol
-    if (ip->protocol == IPPROTO_TCP) {
-        struct tcphdr *tcp = (struct tcphdr *)(ip + 1);
-        if ((void *)(tcp + 1) > data_end)
-            return XDP_DROP;
-        key.port = bpf_ntohs(tcp->dest);
-    } else if (ip->protocol == IPPROTO_UDP) {
-        struct udphdr *udp = (struct udphdr *)(ip + 1);
-        if ((void *)(udp + 1) > data_end)
-            return XDP_DROP;
-        key.port = bpf_ntohs(udp->dest);
-    } else {
-        return XDP_PASS; // Not TCP/UDP
+    __u64 cost = (__u64)len * RATE_TOKEN_SCALE;
+    if (cost > (__u64)burst * RATE_TOKEN_SCALE)
+        cost = (__u64)burst * RATE_TOKEN_SCALE;
+    if (tokens < cost) {
+        state->byte_tokens = tokens;
+        return 0;
+    }
+    state->byte_tokens = tokens - cost;
+    return 1;
+}
+
+// Reserve and fill the common part of an event. Ring buffer records are
+// not zeroed, so every field is written. A full ring buffer is counted in
+// STAT_EVENTS_LOST.
+static __always_inline struct dp_event *reserve_event(__u32 type, __u32 endpoint_id,
+                                                      __u64 value, __u64 now)
+{
+    struct dp_event *ev = bpf_ringbuf_reserve(&map_events, sizeof(*ev), 0);
+    if (!ev) {
+        update_stats(STAT_EVENTS_LOST);
+        return NULL;
+    }
+    __builtin_memset(ev, 0, sizeof(*ev));
+    ev->timestamp = now;
+    ev->type = type;
+    ev->endpoint_id = endpoint_id;
+    ev->value = value;
+    return ev;
+}
+
+static __always_inline void emit_event(__u32 type, __u32 endpoint_id, __u64 value, __u64 now)
+{
+    struct dp_event *ev = reserve_event(type, endpoint_id, value, now);
+    if (ev)
+        bpf_ringbuf_submit(ev, 0);
+}
+
+static __always_inline int endpoint_drop_reason(__u32 reason)
+{
+    switch (reason) {
+    case STAT_BLOCKED_RATE_LIMIT:
+        return ENDPOINT_DROP_RATE_LIMIT;
+    case STAT_BLOCKED_INVALID_PROTOCOL:
+        return ENDPOINT_DROP_INVALID_PROTOCOL;
+    case STAT_BLOCKED_CHALLENGE_FAILED:
+        return ENDPOINT_DROP_CHALLENGE_FAILED;
+    case STAT_BLOCKED_MAINTENANCE:
+        return ENDPOINT_DROP_MAINTENANCE;
+    case STAT_SYNCOOKIES_FAILED:
+        return ENDPOINT_DROP_SYNCOOKIE_FAILED;
+    case STAT_ATTACK_NEW_FLOWS_DROPPED:
+        return ENDPOINT_DROP_ATTACK_NEW_FLOWS;
     }
+    return -1;
+}
+
+// Count a drop under reason (STAT_*), globally and for the endpoint, and
+// report one in N of them, per map_event_sample, to the loader. The
+// counters stay exact; the sampled events attribute them to sources.
+static __always_inline int drop_packet(__u32 reason, const struct pkt_info *pi,
+                                       __u32 endpoint_id)
+{
+    update_stats(reason);
     
-    struct endpoint_info *endpoint = bpf_map_lookup_elem(&map_protected_endpoints, &key);
-    if (!endpoint) {
-        return XDP_PASS; // Not a protected endpoint
+    struct endpoint_counters *counters = bpf_map_lookup_elem(&map_endpoint_counters,
+                                                             &endpoint_id);
+    int idx = endpoint_drop_reason(reason);
+    if (counters && idx >= 0 && idx < ENDPOINT_DROP_MAX) {
+        counters->dropped[idx]++;
+        counters->dropped_bytes += pi->frame_len;
     }
     
-    // Check maintenance mode
-    if (endpoint->maintenance_mode) {
-        update_stats(STAT_BLOCKED_MAINTENANCE);
+    __u32 *rate = bpf_map_lookup_elem(&map_event_sample, &reason);
+    if (!rate || !*rate)
+        return XDP_DROP;
+    if (*rate > 1 && bpf_get_prandom_u32() % *rate)
         return XDP_DROP;
-    }
     
-    // Apply rate limiting
-    int rate_result = update_rate_limit(ip->saddr, endpoint->rate_limit, endpoint->burst_limit);
-    if (rate_result < 0) {
-        return XDP_DROP; // Error updating rate limit
-    } else if (rate_result == 0) {
-        update_stats(STAT_BLOCKED_RATE_LIMIT);
-        return XDP_DROP; // Rate limited
+    struct dp_event *ev = reserve_event(EVENT_DROP, endpoint_id, reason, get_time_ns());
+    if (ev) {
+        ev->src = pi->saddr;
+        ev->dst = pi->daddr;
+        ev->dport = pi->dport;
+        ev->protocol = pi->l4_proto;
+        bpf_ringbuf_submit(ev, 0);
     }
+    return XDP_DROP;
+}
+
+// Attack detection over ATTACK_WINDOW_NS windows. Each CPU counts its own
+// packets and extrapolates by nr_cpus when its window ends, so no counter
+// is shared between RX queues. Two CPUs may race on a transition and both
+// report it; the loader ignores the repeat. Returns whether the endpoint
+// is under attack.
+static __always_inline int update_attack_mode(const struct endpoint_info *endpoint,
+                                              struct endpoint_state *state, __u64 now,
+                                              __u32 nr_cpus)
+{
+    __u32 id = endpoint->endpoint_id;
+    struct endpoint_mode *mode = bpf_map_lookup_elem(&map_endpoint_mode, &id);
+    if (!mode || !state)
+        return 0;
     
-    // Protocol-specific validation
-    int valid_protocol = 0;
-    if (ip->protocol == IPPROTO_TCP && endpoint->protocol_type == 0) {
-        // Java Minecraft (TCP)
-        valid_protocol = validate_minecraft_java(ctx, data, data_end);
-    } else if (ip->protocol == IPPROTO_UDP && endpoint->protocol_type == 1) {
-        // Bedrock Minecraft (UDP) - apply challenge-response
-        if (validate_minecraft_bedrock(ctx, data, data_end)) {
-            // Valid Bedrock packet, now check UDP challenge
-            int challenge_result = handle_udp_challenge(ip->saddr, data, data_end);
-            if (challenge_result == 0) {
-                update_stats(STAT_BLOCKED_CHALLENGE_FAILED);
-                return XDP_DROP; // Challenge failed or in progress
+    __u64 elapsed = now - state->window_start;
+    if (elapsed >= ATTACK_WINDOW_NS) {
+        // A window that ran long because the endpoint went quiet counts as quiet
+        __u64 pps = 0;
+        if (elapsed < 2 * ATTACK_WINDOW_NS)
+            pps = (__u64)state->window_packets * nr_cpus;
+        
+        if (endpoint->attack_pps && pps > endpoint->attack_pps) {
+            mode->last_trigger = now;
+            if (!mode->under_attack) {
+                mode->under_attack = 1;
+                emit_event(EVENT_ATTACK_START, id, pps, now);
             }
-            valid_protocol = 1;
+        } else if (mode->under_attack && now - mode->last_trigger >= ATTACK_HOLD_NS) {
+            mode->under_attack = 0;
+            emit_event(EVENT_ATTACK_END, id, pps, now);
         }
+        
+        state->window_start = now;
+        state->window_packets = 0;
+        state->window_new_flows = 0;
     }
+    state->window_packets++;
     
-    if (!valid_protocol) {
-        update_stats(STAT_BLOCKED_INVALID_PROTOCOL);
+    return mode->under_attack;
+}
+
+// Attack mode as seen by the protocol handlers for one packet
+struct attack_guard {
+    struct endpoint_state *state;
+    __u32 endpoint_id;     // for drop events
+    __u32 new_flow_limit;  // this CPU's share of attack_new_flows per window
+    int under_attack;
+};
+
+// Called where a packet would start a new flow (SYN, RakNet ping or open
+// connection request). Outside attack mode every flow is admitted.
+static __always_inline int admit_new_flow(const struct pkt_info *pi, struct attack_guard *guard)
+{
+    if (!guard->under_attack || !guard->state)
+        return 1;
+    if (guard->state->window_new_flows >= guard->new_flow_limit) {
+        drop_packet(STAT_ATTACK_NEW_FLOWS_DROPPED, pi, guard->endpoint_id);
+        return 0;
+    }
+    guard->state->window_new_flows++;
+    return 1;
+}
+
+static __always_inline int is_blacklisted(const struct ip_addr *src)
+{
+    struct blacklist_key key = {
+        .prefix_len = 128,
+        .ip = *src
+    };
+    __u64 *blocked_until = bpf_map_lookup_elem(&map_blacklist, &key);
+    if (!blocked_until)
+        return 0;
+    
+    // The lookup does not say which prefix matched, so expired entries are
+    // left for the loader to remove
+    return get_current_time() < *blocked_until;
+}
+
+// Minecraft VarInt (at most 5 bytes). Returns the bytes consumed, 0 if the
+// value is truncated or overlong.
+static __always_inline int read_varint(__u8 *p, void *data_end, __u32 *value)
+{
+    __u32 result = 0;
+    
+#pragma unroll
+    for (int i = 0; i < 5; i++) {
+        if ((void *)(p + i + 1) > data_end)
+            return 0;
+        result |= (__u32)(p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// Handshake: length, packet ID 0x00, protocol version, server address
+// (up to 255 characters of UTF-8), port, next state
+#define MC_HANDSHAKE_MAX_LEN (1 + 5 + 2 + 255 * 3 + 2 + 1)
+#define MC_HOST_MAX_LEN (255 * 3)
+
+// Snapshot protocol versions have bit 30 set
+#define MC_SNAPSHOT_PROTOCOL_BIT 0x40000000
+
+static __always_inline int validate_minecraft_java(__u8 *payload, void *data_end)
+{
+    // The first segment of a Java connection is either a handshake or a
+    // legacy (pre-1.7) server list ping
+    if ((void *)(payload + 1) > data_end)
+        return 0;
+    if (payload[0] == 0xfe)
+        return 1;
+    
+    __u32 length, packet_id, protocol_version, host_len;
+    int n = read_varint(payload, data_end, &length);
+    if (!n || length < 5 || length > MC_HANDSHAKE_MAX_LEN)
+        return 0;
+    __u8 *p = payload + n;
+    
+    // Check packet ID (should be 0x00 for handshake)
+    n = read_varint(p, data_end, &packet_id);
+    if (!n || packet_id != 0x00)
+        return 0;
+    p += n;
+    
+    // Validate protocol version (Minecraft versions typically 4-1000, plus snapshots)
+    n = read_varint(p, data_end, &protocol_version);
+    if (!n)
+        return 0;
+    if (!(protocol_version & MC_SNAPSHOT_PROTOCOL_BIT) &&
+        (protocol_version < 4 || protocol_version > 1000))
+        return 0;
+    p += n;
+    
+    n = read_varint(p, data_end, &host_len);
+    if (!n || host_len == 0 || host_len > MC_HOST_MAX_LEN)
+        return 0;
+    p += n + (host_len & 0x3ff);
+    
+    // Port and next state; a handshake cut short by the segment boundary
+    // is judged on what arrived
+    if ((void *)(p + 3) > data_end)
+        return 1;
+    
+    // Next state: 1=status, 2=login, 3=transfer
+    return p[2] >= 1 && p[2] <= 3;
+}
+
+// Incremental checksum updates (RFC 1624). Values are taken exactly as they
+// sit in the packet, so no byte swapping is needed.
+static __always_inline __u16 csum_fold(__u32 csum)
+{
+    csum = (csum & 0xffff) + (csum >> 16);
+    csum = (csum & 0xffff) + (csum >> 16);
+    return (__u16)~csum;
+}
+
+static __always_inline void csum_replace4(__u16 *sum, __u32 from, __u32 to)
+{
+    __u32 csum = (__u16)~*sum;
+    csum += (__u16)~(from >> 16) + (__u16)~from;
+    csum += (to >> 16) + (to & 0xffff);
+    *sum = csum_fold(csum);
+}
+
+static __always_inline void csum_replace2(__u16 *sum, __u16 from, __u16 to)
+{
+    __u32 csum = (__u16)~*sum;
+    csum += (__u16)~from + to;
+    *sum = csum_fold(csum);
+}
+
+static __always_inline __u32 csum_add_words(__u32 sum, __u16 *words, int count)
+{
+#pragma unroll
+    for (int i = 0; i < count; i++)
+        sum += words[i];
+    return sum;
+}
+
+// TCP/UDP pseudo-header sum. It is symmetric in the two addresses, so it
+// also serves replies built with them swapped.
+static __always_inline __u32 pseudo_hdr_sum(const struct pkt_info *pi, __u8 proto, __u16 len)
+{
+    __u32 sum = bpf_htons(proto) + bpf_htons(len);
+    
+    if (pi->family == AF_INET) {
+        sum += (pi->saddr.w[3] >> 16) + (pi->saddr.w[3] & 0xffff);
+        sum += (pi->daddr.w[3] >> 16) + (pi->daddr.w[3] & 0xffff);
+        return sum;
+    }
+    
+#pragma unroll
+    for (int i = 0; i < 4; i++) {
+        sum += (pi->saddr.w[i] >> 16) + (pi->saddr.w[i] & 0xffff);
+        sum += (pi->daddr.w[i] >> 16) + (pi->daddr.w[i] & 0xffff);
+    }
+    return sum;
+}
+
+// Rewrite one address/port pair of a UDP datagram, keeping both checksums valid
+static __always_inline void rewrite_udp_addr(struct iphdr *ip, struct udphdr *udp,
+                                             __u32 *addr, __u16 *port,
+                                             __u32 new_addr, __u16 new_port)
+{
+    if (udp->check) {
+        csum_replace4(&udp->check, *addr, new_addr);
+        csum_replace2(&udp->check, *port, new_port);
+        if (!udp->check)
+            udp->check = 0xffff;
+    }
+    csum_replace4(&ip->check, *addr, new_addr);
+    *addr = new_addr;
+    *port = new_port;
+}
+
+// Resolve the next hop for a rewritten packet and send it straight out.
+// Anything the FIB cannot resolve is handed to the kernel, which also
+// takes care of ICMP for expiring TTLs.
+static __always_inline int fib_forward(struct xdp_md *ctx, struct ethhdr *eth, struct iphdr *ip)
+{
+    struct bpf_fib_lookup fib = {
+        .family = AF_INET,
+        .tos = ip->tos,
+        .l4_protocol = ip->protocol,
+        .tot_len = bpf_ntohs(ip->tot_len),
+        .ipv4_src = ip->saddr,
+        .ipv4_dst = ip->daddr,
+        .ifindex = ctx->ingress_ifindex
+    };
+    
+    if (ip->ttl <= 1)
+        return XDP_PASS;
+    
+    if (bpf_fib_lookup(ctx, &fib, sizeof(fib), 0) != BPF_FIB_LKUP_RET_SUCCESS)
+        return XDP_PASS;
+    
+    // Decrement TTL (same incremental update as ip_decrease_ttl())
+    __u32 check = ip->check;
+    check += bpf_htons(0x0100);
+    ip->check = (__u16)(check + (check >= 0xffff));
+    ip->ttl--;
+    
+    __builtin_memcpy(eth->h_dest, fib.dmac, ETH_ALEN);
+    __builtin_memcpy(eth->h_source, fib.smac, ETH_ALEN);
+    
+    update_stats(STAT_FAST_PATH_FORWARDED);
+    if (fib.ifindex == ctx->ingress_ifindex)
+        return XDP_TX;
+    return bpf_redirect(fib.ifindex, 0);
+}
+
+// Fast path: DNAT a validated Bedrock datagram to the origin. The client's
+// source address is preserved, so the origin must route replies back
+// through this node, where forward_from_origin() restores the front address.
+// IPv4 only; callers check both addresses first.
+static __always_inline int forward_to_origin(struct xdp_md *ctx, const struct pkt_info *pi,
+                                             const struct endpoint_info *endpoint)
+{
+    struct ethhdr *eth = pkt_at(ctx, 0, sizeof(*eth));
+    struct iphdr *ip = pkt_at(ctx, pi->l3_off, sizeof(*ip));
+    struct udphdr *udp = pkt_at(ctx, pi->l4_off, sizeof(*udp));
+    if (!eth || !ip || !udp)
         return XDP_DROP;
+    
+    rewrite_udp_addr(ip, udp, &ip->daddr, &udp->dest,
+                     endpoint->origin_ip.w[3], bpf_htons(endpoint->origin_port));
+    return fib_forward(ctx, eth, ip);
+}
+
+// Reverse path: SNAT an origin reply back to the front address
+static __always_inline int forward_from_origin(struct xdp_md *ctx, const struct pkt_info *pi)
+{
+    struct origin_key key = {
+        .ip = pi->saddr.w[3],
+        .port = pi->sport,
+        .protocol = IPPROTO_UDP
+    };
+    
+    struct front_addr *front = bpf_map_lookup_elem(&map_origin_reverse, &key);
+    if (!front)
+        return XDP_PASS;
+    
+    struct ethhdr *eth = pkt_at(ctx, 0, sizeof(*eth));
+    struct iphdr *ip = pkt_at(ctx, pi->l3_off, sizeof(*ip));
+    struct udphdr *udp = pkt_at(ctx, pi->l4_off, sizeof(*udp));
+    if (!eth || !ip || !udp)
+        return XDP_DROP;
+    
+    rewrite_udp_addr(ip, udp, &ip->saddr, &udp->source,
+                     front->ip, bpf_htons(front->port));
+    return fib_forward(ctx, eth, ip);
+}
+
+// SipHash-2-4 over a fixed number of 64-bit words, used for stateless cookies
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND                                                    \
+    do {                                                            \
+        v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+        v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;                    \
+        v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;                    \
+        v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+    } while (0)
+
+static __always_inline __u64 siphash_u64s(const struct cookie_secret *key,
+                                          const __u64 *words, int count)
+{
+    __u64 v0 = 0x736f6d6570736575ULL ^ key->k0;
+    __u64 v1 = 0x646f72616e646f6dULL ^ key->k1;
+    __u64 v2 = 0x6c7967656e657261ULL ^ key->k0;
+    __u64 v3 = 0x7465646279746573ULL ^ key->k1;
+    __u64 last = (__u64)(count * 8) << 56;
+    
+#pragma unroll
+    for (int i = 0; i < count; i++) {
+        v3 ^= words[i]; SIPROUND; SIPROUND; v0 ^= words[i];
     }
+    v3 ^= last; SIPROUND; SIPROUND; v0 ^= last;
+    v2 ^= 0xff;
+    SIPROUND; SIPROUND; SIPROUND; SIPROUND;
     
-    // Update connection tracking for established flows
-    __u64 flow_hash = hash_5tuple(ip->saddr, ip->daddr, 
-                                 (ip->protocol == IPPROTO_TCP) ? 
-                                 bpf_ntohs(((struct tcphdr *)(ip + 1))->source) : 
-                                 bpf_ntohs(((struct udphdr *)(ip + 1))->source),
-                                 key.port, ip->protocol);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static __always_inline struct cookie_secret *get_cookie_secret(__u32 index)
+{
+    return bpf_map_lookup_elem(&map_cookie_secrets, &index);
+}
+
+// Cookie bound to both addresses and ports of a flow, so it cannot be
+// replayed from another source; extra mixes in protocol-specific input
+#define FLOW_COOKIE_WORDS 5
+
+static __always_inline __u32 flow_cookie(const struct cookie_secret *secret,
+                                         const struct pkt_info *pi, __u32 extra)
+{
+    __u64 words[FLOW_COOKIE_WORDS] = {
+        ((__u64)pi->saddr.w[0] << 32) | pi->saddr.w[1],
+        ((__u64)pi->saddr.w[2] << 32) | pi->saddr.w[3],
+        ((__u64)pi->daddr.w[0] << 32) | pi->daddr.w[1],
+        ((__u64)pi->daddr.w[2] << 32) | pi->daddr.w[3],
+        ((__u64)pi->sport << 48) | ((__u64)pi->dport << 32) | extra
+    };
+    return (__u32)siphash_u64s(secret, words, FLOW_COOKIE_WORDS);
+}
+
+// Reuse the received frame for a reply to its sender: swap the MAC and IP
+// addresses and size the frame for l4_len bytes of transport header and
+// payload. VLAN tags stay in place so the reply leaves on the same VLAN;
+// extension headers and IP options are not carried over. Returns the L4
+// offset of the reply, or -1.
+static __always_inline int reflect_l3(struct xdp_md *ctx, const struct pkt_info *pi,
+                                      __u8 proto, __u16 l4_len)
+{
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+    __u16 l3_len = pi->family == AF_INET ? sizeof(struct iphdr) : sizeof(struct ipv6hdr);
+    __u16 l4_off = pi->l3_off + l3_len;
+    
+    int delta = (int)(l4_off + l4_len) - (int)(data_end - data);
+    if (bpf_xdp_adjust_tail(ctx, delta))
+        return -1;
+    
+    struct ethhdr *eth = pkt_at(ctx, 0, sizeof(*eth));
+    if (!eth)
+        return -1;
+    __u8 mac[ETH_ALEN];
+    __builtin_memcpy(mac, eth->h_source, ETH_ALEN);
+    __builtin_memcpy(eth->h_source, eth->h_dest, ETH_ALEN);
+    __builtin_memcpy(eth->h_dest, mac, ETH_ALEN);
+    
+    if (pi->family == AF_INET) {
+        struct iphdr *ip = pkt_at(ctx, pi->l3_off, sizeof(*ip));
+        if (!ip)
+            return -1;
+        ip->version = 4;
+        ip->ihl = 5;
+        ip->tos = 0;
+        ip->tot_len = bpf_htons(sizeof(struct iphdr) + l4_len);
+        ip->id = 0;
+        ip->frag_off = bpf_htons(0x4000);  // DF
+        ip->ttl = 64;
+        ip->protocol = proto;
+        ip->saddr = pi->daddr.w[3];
+        ip->daddr = pi->saddr.w[3];
+        ip->check = 0;
+        ip->check = csum_fold(csum_add_words(0, (__u16 *)ip, sizeof(struct iphdr) / 2));
+    } else {
+        struct ipv6hdr *ip6 = pkt_at(ctx, pi->l3_off, sizeof(*ip6));
+        if (!ip6)
+            return -1;
+        ip6->version = 6;
+        ip6->priority = 0;
+        __builtin_memset(ip6->flow_lbl, 0, sizeof(ip6->flow_lbl));
+        ip6->payload_len = bpf_htons(l4_len);
+        ip6->nexthdr = proto;
+        ip6->hop_limit = 64;
+        __builtin_memcpy(&ip6->saddr, &pi->daddr, sizeof(ip6->saddr));
+        __builtin_memcpy(&ip6->daddr, &pi->saddr, sizeof(ip6->daddr));
+    }
+    
+    return l4_off;
+}
+
+static __always_inline __u32 payload_len(const struct pkt_info *pi)
+{
+    return pi->l3_end > pi->payload_off ? pi->l3_end - pi->payload_off : 0;
+}
+
+// Reply segments carry exactly one 4-byte option (MSS or NOP padding)
+#define TCP_REPLY_OPT_LEN 4
+#define TCP_REPLY_L4_LEN (sizeof(struct tcphdr) + TCP_REPLY_OPT_LEN)
+
+enum {
+    TCP_REPLY_SYNACK,
+    TCP_REPLY_RST
+};
+
+// Turn the received segment into a SYN-ACK (carrying an MSS option) or a
+// RST and bounce it back out of the receiving interface
+static __always_inline int tcp_reflect(struct xdp_md *ctx, const struct pkt_info *pi, int type,
+                                       __u32 seq, __u32 ack_seq, __u16 mss)
+{
+    int l4_off = reflect_l3(ctx, pi, IPPROTO_TCP, TCP_REPLY_L4_LEN);
+    if (l4_off < 0)
+        return XDP_DROP;
+    
+    struct tcphdr *tcp = pkt_at(ctx, l4_off, TCP_REPLY_L4_LEN);
+    if (!tcp)
+        return XDP_DROP;
+    __u8 *opt = (__u8 *)(tcp + 1);
+    
+    __builtin_memset(tcp, 0, sizeof(struct tcphdr));
+    tcp->source = bpf_htons(pi->dport);
+    tcp->dest = bpf_htons(pi->sport);
+    tcp->seq = bpf_htonl(seq);
+    tcp->doff = TCP_REPLY_L4_LEN / 4;
+    if (type == TCP_REPLY_SYNACK) {
+        tcp->ack_seq = bpf_htonl(ack_seq);
+        tcp->syn = 1;
+        tcp->ack = 1;
+        tcp->window = bpf_htons(65535);
+        opt[0] = 2;  // MSS
+        opt[1] = 4;
+        opt[2] = mss >> 8;
+        opt[3] = mss & 0xff;
+    } else {
+        tcp->rst = 1;
+        opt[0] = 1;  // NOP padding
+        opt[1] = 1;
+        opt[2] = 1;
+        opt[3] = 1;
+    }
+    
+    __u32 sum = pseudo_hdr_sum(pi, IPPROTO_TCP, TCP_REPLY_L4_LEN);
+    sum = csum_add_words(sum, (__u16 *)tcp, TCP_REPLY_L4_LEN / 2);
+    tcp->check = csum_fold(sum);
+    
+    return XDP_TX;
+}
+
+#ifdef SYNCOOKIE_SIPHASH
+static __always_inline int is_verified_source(const struct ip_addr *src)
+{
+    __u64 *until = bpf_map_lookup_elem(&map_syncookie_verified, src);
+    return until && get_current_time() < *until;
+}
+#endif
+
+// Answer a SYN with a SYN-ACK whose sequence number is the cookie
+static __always_inline int send_syn_cookie(struct xdp_md *ctx, const struct pkt_info *pi,
+                                           struct tcphdr *tcp)
+{
+    __u32 cookie;
+    __u16 mss;
+    
+#ifdef SYNCOOKIE_SIPHASH
+    struct cookie_secret *secret = get_cookie_secret(COOKIE_SECRET_CURRENT);
+    if (!secret)
+        return XDP_DROP;
+    cookie = flow_cookie(secret, pi, bpf_ntohl(tcp->seq));
+    mss = SYNCOOKIE_FALLBACK_MSS;
+#else
+    // Kernel-format cookies, so the netfilter SYNPROXY target can check
+    // the client's ACK and replay the SYN to the listener. The listener
+    // itself would refuse the ACK: it never saw the SYN, so no backlog
+    // overflow was recorded and cookie_v4_check() ignores the cookie.
+    void *data_end = (void *)(long)ctx->data_end;
+    __u32 th_len = tcp->doff * 4;
+    if (th_len < sizeof(struct tcphdr) || th_len > 60)
+        return XDP_DROP;
+    if ((void *)tcp + th_len > data_end)
+        return XDP_DROP;
+    
+    __s64 value;
+    if (pi->family == AF_INET) {
+        struct iphdr *ip = pkt_at(ctx, pi->l3_off, sizeof(*ip));
+        if (!ip)
+            return XDP_DROP;
+        value = bpf_tcp_raw_gen_syncookie_ipv4(ip, tcp, th_len);
+    } else {
+        struct ipv6hdr *ip6 = pkt_at(ctx, pi->l3_off, sizeof(*ip6));
+        if (!ip6)
+            return XDP_DROP;
+        value = bpf_tcp_raw_gen_syncookie_ipv6(ip6, tcp, th_len);
+    }
+    if (value < 0)
+        return XDP_DROP;
+    cookie = (__u32)value;
+    mss = value >> 32;
+#endif
+
+    update_stats(STAT_SYNCOOKIES_SENT);
+    return tcp_reflect(ctx, pi, TCP_REPLY_SYNACK, cookie, bpf_ntohl(tcp->seq) + 1, mss);
+}
+
+static __always_inline int check_syn_cookie(struct xdp_md *ctx, const struct pkt_info *pi,
+                                            struct tcphdr *tcp)
+{
+#ifdef SYNCOOKIE_SIPHASH
+    __u32 isn = bpf_ntohl(tcp->seq) - 1;
+    __u32 cookie = bpf_ntohl(tcp->ack_seq) - 1;
+    
+#pragma unroll
+    for (__u32 i = 0; i < COOKIE_SECRET_MAX; i++) {
+        struct cookie_secret *secret = get_cookie_secret(i);
+        if (secret && flow_cookie(secret, pi, isn) == cookie)
+            return 1;
+    }
+    return 0;
+#else
+    if (pi->family == AF_INET) {
+        struct iphdr *ip = pkt_at(ctx, pi->l3_off, sizeof(*ip));
+        return ip && bpf_tcp_raw_check_syncookie_ipv4(ip, tcp) == 0;
+    }
+    struct ipv6hdr *ip6 = pkt_at(ctx, pi->l3_off, sizeof(*ip6));
+    return ip6 && bpf_tcp_raw_check_syncookie_ipv6(ip6, tcp) == 0;
+#endif
+}
+
+static __always_inline int is_java_handshake(struct xdp_md *ctx, const struct pkt_info *pi)
+{
+    void *data_end = (void *)(long)ctx->data_end;
+    __u8 *payload = pkt_at(ctx, pi->payload_off, 1);
+    return payload && validate_minecraft_java(payload, data_end);
+}
+
+// Java TCP path. By default SYNs go to the kernel, whose own cookies guard
+// the backlog, and a flow gets a conntrack entry only once its first data
+// segment is a Minecraft handshake. With syn_cookies (ENDPOINT_F_SYN_COOKIES)
+// SYNs are answered from XDP and only an ACK carrying a valid cookie
+// creates state; the port then needs a SYNPROXY rule to finish the
+// handshake with the listener.
+static __always_inline int handle_java_tcp(struct xdp_md *ctx, const struct pkt_info *pi,
+                                           struct attack_guard *guard, int syn_cookies)
+{
+    struct tcphdr *tcp = pkt_at(ctx, pi->l4_off, sizeof(*tcp));
+    if (!tcp)
+        return XDP_DROP;
+    
+    __u64 flow_hash = hash_flow(pi);
+    struct conntrack_entry new_conn = {
+        .src_ip = pi->saddr,
+        .dst_ip = pi->daddr,
+        .src_port = pi->sport,
+        .dst_port = pi->dport,
+        .protocol = IPPROTO_TCP,
+        .state = CT_STATE_SYN_VERIFIED,
+        .last_seen = get_current_time()
+    };
+    
+#ifdef SYNCOOKIE_SIPHASH
+    struct ip_addr src = pi->saddr;
+    ip_addr_source_key(&src);
+#endif
+
+    if (tcp->syn && !tcp->ack) {
+        // Without cookies, attack mode only caps new flows here
+        if (!admit_new_flow(pi, guard))
+            return XDP_DROP;
+        if (!syn_cookies)
+            return XDP_PASS;
+#ifdef SYNCOOKIE_SIPHASH
+        // Sources that already proved themselves handshake with the kernel,
+        // unless the endpoint is under attack
+        if (!guard->under_attack && is_verified_source(&src)) {
+            insert_state(&map_conntrack, &flow_hash, &new_conn);
+            return XDP_PASS;
+        }
+#endif
+        return send_syn_cookie(ctx, pi, tcp);
+    }
     
     struct conntrack_entry *conn = bpf_map_lookup_elem(&map_conntrack, &flow_hash);
     if (!conn) {
+        // Without state, only ACKs completing a handshake are valid
+        if (!tcp->ack || tcp->syn || tcp->rst)
+            return drop_packet(STAT_BLOCKED_INVALID_PROTOCOL, pi, guard->endpoint_id);
+        
+        if (!syn_cookies) {
+            if (payload_len(pi) == 0)
+                return XDP_PASS;
+            if (!is_java_handshake(ctx, pi))
+                return drop_packet(STAT_BLOCKED_INVALID_PROTOCOL, pi, guard->endpoint_id);
+            new_conn.state = CT_STATE_ESTABLISHED;
+            insert_state(&map_conntrack, &flow_hash, &new_conn);
+            return XDP_PASS;
+        }
+        
+        if (!check_syn_cookie(ctx, pi, tcp))
+            return drop_packet(STAT_SYNCOOKIES_FAILED, pi, guard->endpoint_id);
+        update_stats(STAT_SYNCOOKIES_PASSED);
+        
+#ifdef SYNCOOKIE_SIPHASH
+        // The kernel did not mint this cookie and cannot finish the
+        // handshake, so trust the source and reset; the client's retry
+        // goes straight through.
+        __u64 until = get_current_time() + SYNCOOKIE_VERIFIED_MS;
+        bpf_map_update_elem(&map_syncookie_verified, &src, &until, BPF_ANY);
+        return tcp_reflect(ctx, pi, TCP_REPLY_RST, bpf_ntohl(tcp->ack_seq), 0, 0);
+#else
+        insert_state(&map_conntrack, &flow_hash, &new_conn);
+        return XDP_PASS;
+#endif
+    }
+    
+    if (conn->state == CT_STATE_SYN_VERIFIED && payload_len(pi) > 0) {
+        if (!is_java_handshake(ctx, pi)) {
+            bpf_map_delete_elem(&map_conntrack, &flow_hash);
+            return drop_packet(STAT_BLOCKED_INVALID_PROTOCOL, pi, guard->endpoint_id);
+        }
+        conn->state = CT_STATE_ESTABLISHED;
+    }
+    
+    return XDP_PASS;
+}
+
+// RakNet offline message IDs used by the Bedrock handshake
+#define RAKNET_UNCONNECTED_PING          0x01
+#define RAKNET_UNCONNECTED_PING_OPEN     0x02
+#define RAKNET_OPEN_CONNECTION_REQUEST_1 0x05
+#define RAKNET_OPEN_CONNECTION_REPLY_1   0x06
+#define RAKNET_OPEN_CONNECTION_REQUEST_2 0x07
+
+// Connected (online) datagrams
+#define RAKNET_FRAME_SET_MIN 0x80
+#define RAKNET_FRAME_SET_MAX 0x8d
+#define RAKNET_NACK          0xa0
+#define RAKNET_ACK           0xc0
+
+#define RAKNET_MAGIC_LEN 16
+
+// OPEN_CONNECTION_REPLY_1 with security: id, magic, server GUID,
+// use_security, cookie, MTU
+#define RAKNET_OCR1_REPLY_LEN (1 + RAKNET_MAGIC_LEN + 8 + 1 + 4 + 2)
+
+// OPEN_CONNECTION_REQUEST_2 carries the echoed cookie and a
+// "client wrote challenge" flag right after the magic
+#define RAKNET_OCR2_COOKIE_OFF (1 + RAKNET_MAGIC_LEN)
+#define RAKNET_OCR2_COOKIE_LEN 5
+
+// What follows the cookie: server address (up to 29 bytes for IPv6),
+// MTU and client GUID
+#define RAKNET_OCR2_MAX_TAIL 48
+
+// Largest UDP datagram whose checksum is recomputed in full
+#define UDP_CSUM_MAX_LEN (sizeof(struct udphdr) + RAKNET_OCR2_COOKIE_OFF + RAKNET_OCR2_MAX_TAIL)
+
+static const __u8 raknet_magic[RAKNET_MAGIC_LEN] = {
+    0x00, 0xff, 0xff, 0x00, 0xfe, 0xfe, 0xfe, 0xfe,
+    0xfd, 0xfd, 0xfd, 0xfd, 0x12, 0x34, 0x56, 0x78
+};
+
+static __always_inline int raknet_has_magic(__u8 *p, void *data_end)
+{
+    if ((void *)(p + RAKNET_MAGIC_LEN) > data_end)
+        return 0;
+        
+#pragma unroll
+    for (int i = 0; i < RAKNET_MAGIC_LEN; i++) {
+        if (p[i] != raknet_magic[i])
+            return 0;
+    }
+    return 1;
+}
+
+// RakNet as sent by Bedrock clients: unconnected pings and the two open
+// connection requests carry the offline magic, everything after that is a
+// frame set (0x80-0x8d), ACK (0xc0) or NACK (0xa0). IDs only a server sends
+// are rejected.
+static __always_inline int validate_minecraft_bedrock(__u8 *payload, void *data_end)
+{
+    if ((void *)(payload + 1) > data_end)
+        return 0;
+    
+    __u8 packet_type = payload[0];
+    
+    switch (packet_type) {
+    case RAKNET_UNCONNECTED_PING:
+    case RAKNET_UNCONNECTED_PING_OPEN:
+        // ID, client time (8 bytes), magic
+        return raknet_has_magic(payload + 9, data_end);
+    
+    case RAKNET_OPEN_CONNECTION_REQUEST_1:
+    case RAKNET_OPEN_CONNECTION_REQUEST_2:
+        return raknet_has_magic(payload + 1, data_end);
+    
+    case RAKNET_ACK:
+    case RAKNET_NACK:
+        return 1;
+    }
+    
+    return packet_type >= RAKNET_FRAME_SET_MIN && packet_type <= RAKNET_FRAME_SET_MAX;
+}
+
+static __always_inline void put_be32(__u8 *p, __u32 v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// Recompute the checksum of a short UDP datagram in full
+static __always_inline int udp_csum_short(struct xdp_md *ctx, const struct pkt_info *pi)
+{
+    void *data_end = (void *)(long)ctx->data_end;
+    struct udphdr *udp = pkt_at(ctx, pi->l4_off, sizeof(*udp));
+    if (!udp)
+        return -1;
+    
+    __u16 len = bpf_ntohs(udp->len);
+    if (len > UDP_CSUM_MAX_LEN)
+        return -1;
+    
+    __u8 *p = (__u8 *)udp;
+    __u32 sum = pseudo_hdr_sum(pi, IPPROTO_UDP, len);
+    udp->check = 0;
+    
+#pragma unroll
+    for (int i = 0; i < UDP_CSUM_MAX_LEN / 2; i++) {
+        if (2 * i + 2 > len)
+            break;
+        if ((void *)(p + 2 * i + 2) > data_end)
+            return -1;
+        sum += *(__u16 *)(p + 2 * i);
+    }
+    if (len & 1) {
+        __u8 *last = p + (len - 1);
+        if ((void *)(last + 1) > data_end)
+            return -1;
+        sum += *last;
+    }
+    
+    udp->check = csum_fold(sum);
+    if (!udp->check)
+        udp->check = 0xffff;
+    return 0;
+}
+
+// Answer OPEN_CONNECTION_REQUEST_1 with a reply that sets use_security and
+// carries a cookie, reusing the received frame
+static __always_inline int raknet_send_cookie(struct xdp_md *ctx, const struct pkt_info *pi,
+                                              __u32 cookie, __u16 mtu)
+{
+    struct dataplane_config *config = get_config();
+    __u64 guid = config ? config->raknet_guid : 0;
+    __u16 udp_len = sizeof(struct udphdr) + RAKNET_OCR1_REPLY_LEN;
+    
+    int l4_off = reflect_l3(ctx, pi, IPPROTO_UDP, udp_len);
+    if (l4_off < 0)
+        return XDP_DROP;
+    
+    struct udphdr *udp = pkt_at(ctx, l4_off, sizeof(struct udphdr) + RAKNET_OCR1_REPLY_LEN);
+    if (!udp)
+        return XDP_DROP;
+    __u8 *msg = (__u8 *)(udp + 1);
+    
+    udp->source = bpf_htons(pi->dport);
+    udp->dest = bpf_htons(pi->sport);
+    udp->len = bpf_htons(udp_len);
+    udp->check = 0;
+    
+    msg[0] = RAKNET_OPEN_CONNECTION_REPLY_1;
+    __builtin_memcpy(msg + 1, raknet_magic, RAKNET_MAGIC_LEN);
+    put_be32(msg + 17, guid >> 32);
+    put_be32(msg + 21, (__u32)guid);
+    msg[25] = 1;  // use_security
+    put_be32(msg + 26, cookie);
+    msg[30] = mtu >> 8;
+    msg[31] = mtu & 0xff;
+    
+    __u32 sum = pseudo_hdr_sum(pi, IPPROTO_UDP, udp_len);
+    sum = csum_add_words(sum, (__u16 *)udp, (sizeof(struct udphdr) + RAKNET_OCR1_REPLY_LEN) / 2);
+    udp->check = csum_fold(sum);
+    if (udp->check == 0)
+        udp->check = 0xffff;
+    
+    update_stats(STAT_UDP_CHALLENGES_SENT);
+    return XDP_TX;
+}
+
+// Remove the cookie and challenge flag from OPEN_CONNECTION_REQUEST_2 so the
+// origin, which runs without RakNet security, sees a plain request. Only the
+// short tail after the cookie has to move.
+static __always_inline int raknet_strip_cookie(struct xdp_md *ctx, struct pkt_info *pi)
+{
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+    __u32 cookie_off = pi->payload_off + RAKNET_OCR2_COOKIE_OFF;
+    __u32 tail_off = cookie_off + RAKNET_OCR2_COOKIE_LEN;
+    
+    if (pi->l3_end > data_end - data || pi->l3_end < tail_off ||
+        pi->l3_end - tail_off > RAKNET_OCR2_MAX_TAIL)
+        return -1;
+    __u32 tail_len = pi->l3_end - tail_off;
+    
+    __u8 *dst = pkt_at(ctx, cookie_off, RAKNET_OCR2_COOKIE_LEN);
+    if (!dst)
+        return -1;
+        
+#pragma unroll
+    for (int i = 0; i < RAKNET_OCR2_MAX_TAIL; i++) {
+        if (i >= tail_len)
+            break;
+        __u8 *src = dst + RAKNET_OCR2_COOKIE_LEN + i;
+        if ((void *)(src + 1) > data_end)
+            return -1;
+        dst[i] = *src;
+    }
+    
+    // Trimming to the datagram end also drops any Ethernet padding
+    int delta = (int)(pi->l3_end - RAKNET_OCR2_COOKIE_LEN) - (int)(data_end - data);
+    if (bpf_xdp_adjust_tail(ctx, delta))
+        return -1;
+    pi->l3_end -= RAKNET_OCR2_COOKIE_LEN;
+    
+    if (pi->family == AF_INET) {
+        struct iphdr *ip = pkt_at(ctx, pi->l3_off, sizeof(*ip));
+        if (!ip)
+            return -1;
+        __u16 old_len = ip->tot_len;
+        ip->tot_len = bpf_htons(bpf_ntohs(old_len) - RAKNET_OCR2_COOKIE_LEN);
+        csum_replace2(&ip->check, old_len, ip->tot_len);
+    } else {
+        struct ipv6hdr *ip6 = pkt_at(ctx, pi->l3_off, sizeof(*ip6));
+        if (!ip6)
+            return -1;
+        ip6->payload_len = bpf_htons(bpf_ntohs(ip6->payload_len) - RAKNET_OCR2_COOKIE_LEN);
+    }
+    
+    struct udphdr *udp = pkt_at(ctx, pi->l4_off, sizeof(*udp));
+    if (!udp)
+        return -1;
+    udp->len = bpf_htons(bpf_ntohs(udp->len) - RAKNET_OCR2_COOKIE_LEN);
+    
+    // The shift moves the tail to an odd offset, so the checksum is redone
+    return udp_csum_short(ctx, pi);
+}
+
+// Bedrock handshake challenge. Unknown flows may only ping or open a
+// connection; OPEN_CONNECTION_REQUEST_1 is answered from XDP with a cookie,
+// and OPEN_CONNECTION_REQUEST_2 must echo it before anything reaches the
+// origin. Nothing is stored until the cookie verifies.
+static __always_inline int handle_raknet_challenge(struct xdp_md *ctx, struct pkt_info *pi,
+                                                   struct attack_guard *guard, int *new_flow)
+{
+    void *data_end = (void *)(long)ctx->data_end;
+    struct udphdr *udp = pkt_at(ctx, pi->l4_off, sizeof(*udp));
+    __u8 *msg = pkt_at(ctx, pi->payload_off, 1);
+    if (!udp || !msg)
+        return XDP_DROP;
+    
+    // Connected sessions have already passed the challenge
+    __u64 flow_hash = hash_flow(pi);
+    if (bpf_map_lookup_elem(&map_conntrack, &flow_hash))
+        return XDP_PASS;
+    
+    switch (msg[0]) {
+    // Pings are answered by the server but never open a session, so they
+    // pass without creating state
+    case RAKNET_UNCONNECTED_PING:
+    case RAKNET_UNCONNECTED_PING_OPEN:
+        return admit_new_flow(pi, guard) ? XDP_PASS : XDP_DROP;
+    
+    // validate_minecraft_bedrock() has already checked the magic
+    case RAKNET_OPEN_CONNECTION_REQUEST_1: {
+        if (!admit_new_flow(pi, guard))
+            return XDP_DROP;
+        struct cookie_secret *secret = get_cookie_secret(COOKIE_SECRET_CURRENT);
+        if (!secret)
+            return XDP_DROP;
+        // The request is padded to the client's MTU (payload + IP/UDP headers)
+        __u16 mtu = (pi->l4_off - pi->l3_off) + bpf_ntohs(udp->len);
+        return raknet_send_cookie(ctx, pi, flow_cookie(secret, pi, 0), mtu);
+    }
+    
+    case RAKNET_OPEN_CONNECTION_REQUEST_2: {
+        __u8 *echo = msg + RAKNET_OCR2_COOKIE_OFF;
+        if ((void *)(echo + RAKNET_OCR2_COOKIE_LEN) > data_end)
+            break;
+        // Clients that wrote a challenge expect a real RakNet security handshake
+        if (echo[4] != 0)
+            break;
+        
+        __u32 cookie = ((__u32)echo[0] << 24) | ((__u32)echo[1] << 16) |
+                       ((__u32)echo[2] << 8) | echo[3];
+        int valid = 0;
+#pragma unroll
+        for (__u32 i = 0; i < COOKIE_SECRET_MAX; i++) {
+            struct cookie_secret *secret = get_cookie_secret(i);
+            if (secret && flow_cookie(secret, pi, 0) == cookie)
+                valid = 1;
+        }
+        if (!valid || raknet_strip_cookie(ctx, pi))
+            break;
+        
+        update_stats(STAT_UDP_CHALLENGES_PASSED);
+        *new_flow = 1;
+        return XDP_PASS;
+    }
+    }
+    
+    return drop_packet(STAT_BLOCKED_CHALLENGE_FAILED, pi, guard->endpoint_id);
+}
+
+// Per-packet state handed from stage to stage. Tail calls stay on the same
+// CPU and XDP does not nest on a CPU, so one per-CPU slot is enough. Map
+// pointers do not survive a tail call, so the endpoint is copied.
+struct pkt_ctx {
+    struct pkt_info pi;
+    struct endpoint_info endpoint;
+    __u32 new_flow_limit;  // attack_guard fields computed by the policy stage
+    __u32 under_attack;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, __u32);
+    __type(value, struct pkt_ctx);
+    __uint(max_entries, 1);
+} map_pkt_ctx SEC(".maps");
+
+// Stage programs, installed by the loader. Updating a slot swaps that stage
+// for every following packet without touching the others.
+struct {
+    __uint(type, BPF_MAP_TYPE_PROG_ARRAY);
+    __type(key, __u32);
+    __type(value, __u32);
+    __uint(max_entries, STAGE_MAX);
+} map_stages SEC(".maps");
+
+static __always_inline struct pkt_ctx *get_pkt_ctx(void)
+{
+    __u32 key = 0;
+    return bpf_map_lookup_elem(&map_pkt_ctx, &key);
+}
+
+// Only returns when the stage is not installed; callers then fail open
+// for unprotected traffic and closed for protected traffic
+static __always_inline void tail_call_stage(struct xdp_md *ctx, __u32 stage)
+{
+    bpf_tail_call(ctx, &map_stages, stage);
+    update_stats(STAT_STAGE_MISSING);
+}
+
+static __always_inline void load_attack_guard(const struct pkt_ctx *pc, struct attack_guard *guard)
+{
+    __u32 endpoint_id = pc->endpoint.endpoint_id;
+    
+    guard->state = bpf_map_lookup_elem(&map_endpoint_state, &endpoint_id);
+    guard->endpoint_id = endpoint_id;
+    guard->new_flow_limit = pc->new_flow_limit;
+    guard->under_attack = pc->under_attack;
+}
+
+// Common end of the protocol stages for packets that passed validation
+// new_flow is set by the stage when the packet proved the flow (a valid
+// RakNet cookie); any other packet only refreshes existing state.
+static __always_inline int accept_packet(struct xdp_md *ctx, struct pkt_ctx *pc, int new_flow)
+{
+    struct pkt_info *pi = &pc->pi;
+    const struct endpoint_info *endpoint = &pc->endpoint;
+    __u32 endpoint_id = endpoint->endpoint_id;
+    
+    // Update connection tracking for established flows
+    __u64 flow_hash = hash_flow(pi);
+    struct conntrack_entry *conn = bpf_map_lookup_elem(&map_conntrack, &flow_hash);
+    if (conn) {
+        // Idle flows are reclaimed by the loader's sweeper
+        __u32 now = get_current_time();
+        if ((__u32)(now - conn->last_seen) >= CT_TOUCH_MS)
+            conn->last_seen = now;
+    } else if (new_flow) {
         // New connection - add to conntrack
         struct conntrack_entry new_conn = {
-            .src_ip = ip->saddr,
-            .dst_ip = ip->daddr,
-            .src_port = (ip->protocol == IPPROTO_TCP) ? 
-                       bpf_ntohs(((struct tcphdr *)(ip + 1))->source) : 
-                       bpf_ntohs(((struct udphdr *)(ip + 1))->source),
-            .dst_port = key.port,
-            .protocol = ip->protocol,
-            .state = 1, // established
-            .challenge_id = 0
+            .src_ip = pi->saddr,
+            .dst_ip = pi->daddr,
+            .src_port = pi->sport,
+            .dst_port = pi->dport,
+            .protocol = pi->l4_proto,
+            .state = CT_STATE_ESTABLISHED,
+            .challenge_id = 0,
+            .last_seen = get_current_time()
         };
-        bpf_map_update_elem(&map_conntrack, &flow_hash, &new_conn, BPF_ANY);
+        insert_state(&map_conntrack, &flow_hash, &new_conn);
     }
     
     update_stats(STAT_ALLOWED_PACKETS);
-    return XDP_REDIRECT; // Redirect to user-space proxy
+    struct endpoint_counters *counters = bpf_map_lookup_elem(&map_endpoint_counters,
+                                                             &endpoint_id);
+    if (counters) {
+        counters->allowed_packets++;
+        counters->allowed_bytes += pi->frame_len;
+    }
+    
+    // Java traffic must go through the kernel TCP stack to reach the proxy's
+    // listener; only Bedrock datagrams can be handed off to AF_XDP.
+    if (pi->l4_proto != IPPROTO_UDP) {
+        update_stats(STAT_XDP_PASS);
+        return XDP_PASS;
+    }
+    
+    // Fast-path endpoints never leave the driver. The FIB result has no VLAN
+    // information, so only untagged IPv4 is forwarded here.
+    if ((endpoint->flags & ENDPOINT_F_FAST_PATH) && pi->family == AF_INET &&
+        pi->l3_off == sizeof(struct ethhdr) && ip_addr_is_v4(&endpoint->origin_ip))
+        return forward_to_origin(ctx, pi, endpoint);
+    
+    // Hand clean Bedrock traffic to the AF_XDP consumer bound to this queue,
+    // falling back to the kernel stack when no socket is registered
+    int action = bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+    update_stats(action == XDP_REDIRECT ? STAT_XDP_REDIRECT : STAT_XDP_PASS);
+    return action;
+}
+
+// Parse stage, the program attached to the interface
+SEC("xdp")
+int xdp_minecraft_protection(struct xdp_md *ctx)
+{
+    update_stats(STAT_TOTAL_PACKETS);
+    
+    struct pkt_ctx *pc = get_pkt_ctx();
+    if (!pc)
+        return XDP_PASS;
+    
+    // Parse Ethernet/VLAN, IPv4/IPv6 and transport headers
+    struct pkt_info *pi = &pc->pi;
+    __builtin_memset(pi, 0, sizeof(*pi));
+    int parsed = parse_packet(ctx, pi);
+    if (parsed == PARSE_DROP)
+        return XDP_DROP;
+    if (parsed == PARSE_PASS)
+        return XDP_PASS;
+    
+    // Check if source is blacklisted
+    if (is_blacklisted(&pi->saddr))
+        return drop_packet(STAT_BLOCKED_BLACKLIST, pi, ENDPOINT_ID_NONE);
+    
+    if (pi->l4_proto != IPPROTO_TCP && pi->l4_proto != IPPROTO_UDP)
+        return XDP_PASS; // Not TCP/UDP
+    
+    tail_call_stage(ctx, STAGE_POLICY);
+    return XDP_PASS;
+}
+
+// Policy stage: endpoint lookup, attack mode and rate limits, then the
+// validator for the endpoint's protocol
+SEC("xdp")
+int xdp_stage_policy(struct xdp_md *ctx)
+{
+    struct pkt_ctx *pc = get_pkt_ctx();
+    if (!pc)
+        return XDP_PASS;
+    struct pkt_info *pi = &pc->pi;
+    
+    // Look up protected endpoint
+    struct endpoint_info *endpoint = lookup_endpoint(pi);
+    if (!endpoint) {
+        // Replies from fast-path origins are translated back in XDP
+        if (pi->l4_proto == IPPROTO_UDP && pi->family == AF_INET &&
+            pi->l3_off == sizeof(struct ethhdr))
+            return forward_from_origin(ctx, pi);
+        return XDP_PASS; // Not a protected endpoint
+    }
+    
+    // Check maintenance mode
+    __u32 endpoint_id = endpoint->endpoint_id;
+    if (endpoint->maintenance_mode)
+        return drop_packet(STAT_BLOCKED_MAINTENANCE, pi, endpoint_id);
+    
+    // Endpoint-wide state: attack detection sees all offered load
+    struct endpoint_state *est = bpf_map_lookup_elem(&map_endpoint_state, &endpoint_id);
+    struct dataplane_config *cfg = get_config();
+    __u32 nr_cpus = cfg ? cfg->nr_cpus : 1;
+    __u64 now = get_time_ns();
+    
+    pc->endpoint = *endpoint;
+    pc->new_flow_limit = endpoint->attack_new_flows ?
+                         percpu_budget(endpoint->attack_new_flows, 0, nr_cpus) : ~0U;
+    pc->under_attack = update_attack_mode(endpoint, est, now, nr_cpus);
+    
+    // Apply rate limiting
+    struct ip_addr src = pi->saddr;
+    ip_addr_source_key(&src);
+    // Charge what was received, not the length the IP header claims
+    int rate_result = update_rate_limit(&src, endpoint, pi->frame_len) &&
+                      update_endpoint_byte_limit(endpoint, est, pi->frame_len, now, nr_cpus);
+    if (rate_result == 0)
+        return drop_packet(STAT_BLOCKED_RATE_LIMIT, pi, endpoint_id);
+    
+    // Protocol-specific validation
+    __u32 stage = STAGE_MAX;
+    if (pi->l4_proto == IPPROTO_TCP && endpoint->protocol_type == 0)
+        stage = STAGE_JAVA_TCP;
+    else if (pi->l4_proto == IPPROTO_UDP && endpoint->protocol_type == 1)
+        stage = STAGE_BEDROCK_UDP;
+    if (stage == STAGE_MAX)
+        return drop_packet(STAT_BLOCKED_INVALID_PROTOCOL, pi, endpoint_id);
+    
+    tail_call_stage(ctx, stage);
+    return XDP_DROP;
+}
+
+// Java Minecraft (TCP) - optional SYN cookies, then handshake validation
+SEC("xdp")
+int xdp_stage_java_tcp(struct xdp_md *ctx)
+{
+    struct pkt_ctx *pc = get_pkt_ctx();
+    if (!pc)
+        return XDP_DROP;
+    
+    struct attack_guard guard;
+    load_attack_guard(pc, &guard);
+    int verdict = handle_java_tcp(ctx, &pc->pi, &guard,
+                                  pc->endpoint.flags & ENDPOINT_F_SYN_COOKIES);
+    if (verdict != XDP_PASS)
+        return verdict;
+    
+    // handle_java_tcp() inserts the flow itself once the handshake checks out
+    return accept_packet(ctx, pc, 0);
+}
+
+// Bedrock Minecraft (UDP) - RakNet validation, then the cookie challenge
+SEC("xdp")
+int xdp_stage_bedrock_udp(struct xdp_md *ctx)
+{
+    struct pkt_ctx *pc = get_pkt_ctx();
+    if (!pc)
+        return XDP_DROP;
+    
+    void *data_end = (void *)(long)ctx->data_end;
+    __u8 *payload = pkt_at(ctx, pc->pi.payload_off, 1);
+    if (!payload || !validate_minecraft_bedrock(payload, data_end))
+        return drop_packet(STAT_BLOCKED_INVALID_PROTOCOL, &pc->pi, pc->endpoint.endpoint_id);
+    
+    struct attack_guard guard;
+    load_attack_guard(pc, &guard);
+    int new_flow = 0;
+    int verdict = handle_raknet_challenge(ctx, &pc->pi, &guard, &new_flow);
+    if (verdict != XDP_PASS)
+        return verdict;
+    
+    return accept_packet(ctx, pc, new_flow);
 }
 
 char _license[] SEC("license") = "GPL";
@@ -0,0 +1,383 @@
+/*
+ * CloudNordSP Minecraft DDoS Protection - Shared Definitions
+ *
+ * Map key/value layouts and constants shared between the XDP program
+ * and the user-space loader. Both sides must agree on these byte for byte.
+ */
+
+#ifndef __MINECRAFT_PROTECTION_H
+#define __MINECRAFT_PROTECTION_H
+
+#include <linux/types.h>
+
+// Rate limiter modes (dataplane_config.rate_limit_mode)
+enum {
+    RATE_LIMIT_SHARED,  // one bucket per source shared by all CPUs
+    RATE_LIMIT_PERCPU   // one bucket per source per CPU, budget split across CPUs
+};
+
+// Fixed-point scale for per-CPU budget shares (struct rate_share)
+#define RATE_SHARE_SCALE 1024
+
+// Packets a CPU passes for one source between reads of map_src_share
+#define RATE_SHARE_REFRESH 64
+
+// Token buckets hold one packet (or byte) as RATE_TOKEN_SCALE units, so a
+// refill is elapsed_ns * rate with no division and no lost remainder
+#define RATE_TOKEN_SCALE 1000000000ULL
+
+// endpoint_info.endpoint_id range, indexes per-endpoint state
+#define ENDPOINT_ID_MAX 16384
+#define ENDPOINT_ID_NONE ENDPOINT_ID_MAX  // events for packets not matched to an endpoint
+
+// Exact endpoint tables behind map_endpoint_tables, flipped by generation
+#define ENDPOINT_TABLES 2
+
+// Upper bound on RX queues that can have an AF_XDP socket attached
+#define XSK_MAX_QUEUES 64
+
+// bpffs locations shared by the loader and the AF_XDP consumer. State maps
+// are pinned under PIN_BASE_DIR by map name and survive a reload.
+#define PIN_BASE_DIR "/sys/fs/bpf/cloudnordsp"
+#define XSKMAP_PIN_PATH PIN_BASE_DIR "/xsks"
+
+// Tail-call pipeline stages (map_stages). The parse stage is the program
+// attached to the interface; it jumps to STAGE_POLICY, which jumps to the
+// validator for the endpoint's protocol.
+enum {
+    STAGE_POLICY,       // endpoint lookup, attack mode, rate limits
+    STAGE_JAVA_TCP,     // SYN cookies and Java handshake validation
+    STAGE_BEDROCK_UDP,  // RakNet validation and cookie challenge
+    STAGE_MAX
+};
+
+// Cookie secrets (map_cookie_secrets) for TCP SYN and RakNet cookies, rotated
+// by the loader. Cookies minted with the previous secret stay valid for one
+// more rotation period.
+enum {
+    COOKIE_SECRET_CURRENT,
+    COOKIE_SECRET_PREVIOUS,
+    COOKIE_SECRET_MAX
+};
+
+// conntrack_entry.state
+enum {
+    CT_STATE_UNKNOWN,
+    CT_STATE_ESTABLISHED,
+    CT_STATE_CHALLENGE_SENT,
+    CT_STATE_SYN_VERIFIED  // TCP handshake completed via SYN cookie, awaiting Minecraft handshake
+};
+
+// Granularity of conntrack_entry.last_seen; coarser refreshes keep packets
+// of busy flows from rewriting the entry every time
+#define CT_TOUCH_MS 1000
+
+// endpoint_info.flags
+#define ENDPOINT_F_FAST_PATH (1 << 0)  // forward Bedrock UDP to the origin in XDP
+#define ENDPOINT_F_SYN_COOKIES (1 << 1)  // answer Java SYNs from XDP; needs a SYNPROXY rule
+
+// Addresses are 128 bits wide. IPv4 is stored IPv4-mapped (::ffff:a.b.c.d)
+// so both families share one key layout.
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define IP_ADDR_V4_MAPPED 0xffff0000U  // htonl(0x0000ffff)
+#define IP_ADDR_V4_SUBNET_MASK 0x00ffffffU  // htonl(0xffffff00), /24
+#define IP_ADDR_V6_SUBNET_MASK 0x0000ffffU  // htonl(0xffff0000), /48 of w[1]
+#else
+#define IP_ADDR_V4_MAPPED 0x0000ffffU
+#define IP_ADDR_V4_SUBNET_MASK 0xffffff00U
+#define IP_ADDR_V6_SUBNET_MASK 0xffff0000U
+#endif
+
+// Bits of endpoint_prefix_key covered before the address: port, protocol
+// and padding always match exactly
+#define ENDPOINT_PREFIX_HDR_BITS 32
+
+// Data structures. Addresses are in network byte order, ports in host order.
+struct ip_addr {
+    __u32 w[4];
+};
+
+// Exact (address, port, protocol) match, map_protected_endpoints
+struct endpoint_key {
+    struct ip_addr ip;
+    __u16 port;
+    __u8 protocol;
+    __u8 padding[1];
+};
+
+// Whole-prefix protection, map_protected_prefixes. The LPM trie matches
+// from the first byte, so port and protocol come before the address and
+// prefix_len is ENDPOINT_PREFIX_HDR_BITS plus the address prefix length.
+struct endpoint_prefix_key {
+    __u32 prefix_len;
+    __u16 port;
+    __u8 protocol;
+    __u8 padding[1];
+    struct ip_addr ip;
+};
+
+struct endpoint_info {
+    struct ip_addr origin_ip;
+    __u16 origin_port;
+    __u32 rate_limit;        // packets/s per source
+    __u32 burst_limit;       // packets
+    __u32 byte_rate_limit;   // bytes/s per source, 0 = unlimited
+    __u32 byte_burst_limit;  // bytes
+    __u32 endpoint_id;       // assigned by the loader, < ENDPOINT_ID_MAX
+    __u32 endpoint_byte_rate_limit;   // bytes/s across all sources, 0 = unlimited
+    __u32 endpoint_byte_burst_limit;  // bytes
+    __u32 attack_pps;        // packets/s across all sources that start attack mode, 0 = never
+    __u32 attack_new_flows;  // new flows/s admitted while under attack
+    __u32 subnet_rate_limit;   // packets/s per source subnet, 0 = unlimited
+    __u32 subnet_burst_limit;  // packets
+    __u8 protocol_type;  // 0=Java, 1=Bedrock
+    __u8 maintenance_mode;
+    __u8 flags;          // ENDPOINT_F_*
+    __u8 padding[1];
+};
+
+// Reverse NAT for fast-path endpoints: replies from the origin are
+// rewritten to come from the front address the client talked to. The fast
+// path is IPv4-only, so these keep plain 32-bit addresses.
+struct origin_key {
+    __u32 ip;
+    __u16 port;
+    __u8 protocol;
+    __u8 padding[1];
+};
+
+struct front_addr {
+    __u32 ip;
+    __u16 port;
+    __u8 padding[2];
+};
+
+struct rate_limit_state {
+    __u64 last_update;  // ns, CLOCK_MONOTONIC
+    __u64 tokens;       // packets, RATE_TOKEN_SCALE units
+    __u64 byte_tokens;  // bytes, RATE_TOKEN_SCALE units
+    __u32 hits;   // packets seen on this CPU (per-CPU mode), wraps
+    __u32 share;  // copy of this CPU's rate_share.share, refreshed by the datapath
+};
+
+// A source's budget share on one CPU (map_src_share), written only by the
+// loader so rebalancing never overwrites token state the datapath owns.
+// hits is rate_limit_state.hits when the share was computed; the next
+// rebalance weighs only the packets seen since.
+struct rate_share {
+    __u32 share;  // RATE_SHARE_SCALE units, 0 = even split
+    __u32 hits;
+};
+
+// Per-endpoint state (map_endpoint_state), one copy per CPU
+struct endpoint_state {
+    __u64 last_update;  // ns, CLOCK_MONOTONIC
+    __u64 byte_tokens;  // bytes, RATE_TOKEN_SCALE units
+    __u64 window_start;      // ns, start of the current attack detection window
+    __u32 window_packets;    // packets to the endpoint in the window
+    __u32 window_new_flows;  // new flows admitted in the window while under attack
+};
+
+// Endpoint attack mode (map_endpoint_mode), shared by all CPUs. Under
+// attack, every new flow is challenged and new flows are capped at
+// endpoint_info.attack_new_flows.
+struct endpoint_mode {
+    __u64 last_trigger;  // ns, last window over attack_pps
+    __u32 under_attack;
+    __u32 padding;
+};
+
+// Drop reasons broken out per endpoint (endpoint_counters.dropped). Blacklist
+// drops happen before the endpoint lookup and are only counted globally.
+enum {
+    ENDPOINT_DROP_RATE_LIMIT,
+    ENDPOINT_DROP_INVALID_PROTOCOL,
+    ENDPOINT_DROP_CHALLENGE_FAILED,
+    ENDPOINT_DROP_MAINTENANCE,
+    ENDPOINT_DROP_SYNCOOKIE_FAILED,
+    ENDPOINT_DROP_ATTACK_NEW_FLOWS,
+    ENDPOINT_DROP_MAX
+};
+
+// Per-endpoint traffic counters (map_endpoint_counters), one copy per CPU
+struct endpoint_counters {
+    __u64 allowed_packets;
+    __u64 allowed_bytes;   // IP datagram bytes
+    __u64 dropped_bytes;
+    __u64 dropped[ENDPOINT_DROP_MAX];  // packets
+};
+
+// Ring buffer events (map_events)
+enum {
+    EVENT_ATTACK_START,  // value: estimated packets/s
+    EVENT_ATTACK_END,
+    EVENT_DROP           // sampled drop, value: the STAT_* counter it was counted under
+};
+
+struct dp_event {
+    __u64 timestamp;  // ns, CLOCK_MONOTONIC
+    __u32 type;       // EVENT_*
+    __u32 endpoint_id;
+    __u64 value;
+    // EVENT_DROP only: the dropped packet's addresses
+    struct ip_addr src;
+    struct ip_addr dst;
+    __u16 dport;
+    __u8 protocol;
+    __u8 padding[5];
+};
+
+struct conntrack_entry {
+    struct ip_addr src_ip;
+    struct ip_addr dst_ip;
+    __u16 src_port;
+    __u16 dst_port;
+    __u8 protocol;
+    __u8 state;  // CT_STATE_*
+    __u16 challenge_id;
+    __u32 last_seen;  // ms, refreshed at most every CT_TOUCH_MS
+};
+
+// Blacklisted prefix, map_blacklist. prefix_len counts bits of ip, so an
+// IPv4 /24 is 120. The value is the block expiry in CLOCK_MONOTONIC ms,
+// BLACKLIST_FOREVER for feed entries without one.
+struct blacklist_key {
+    __u32 prefix_len;
+    struct ip_addr ip;
+};
+
+#define BLACKLIST_FOREVER ((__u64)-1)
+
+struct cookie_secret {
+    __u64 k0;
+    __u64 k1;
+};
+
+// Global dataplane settings, written once by the loader (map_config[0])
+struct dataplane_config {
+    __u32 nr_cpus;
+    __u32 rate_limit_mode;
+    __u64 raknet_guid;  // server GUID in XDP-generated RakNet replies
+    __u32 endpoint_prefixes;  // entries in map_protected_prefixes, 0 skips the LPM lookup
+    __u32 padding;
+};
+
+// Statistics counters
+enum {
+    STAT_ALLOWED_PACKETS,
+    STAT_BLOCKED_RATE_LIMIT,
+    STAT_BLOCKED_BLACKLIST,
+    STAT_BLOCKED_INVALID_PROTOCOL,
+    STAT_BLOCKED_CHALLENGE_FAILED,
+    STAT_BLOCKED_MAINTENANCE,
+    STAT_TOTAL_PACKETS,
+    STAT_XDP_DROP,
+    STAT_XDP_PASS,
+    STAT_XDP_REDIRECT,
+    STAT_UDP_CHALLENGES_SENT,
+    STAT_UDP_CHALLENGES_PASSED,
+    STAT_STATE_INSERTS,        // new rate/conntrack entries (LRU eviction pressure)
+    STAT_STATE_INSERT_FAILED,  // packets admitted without state after a failed insert
+    STAT_FAST_PATH_FORWARDED,  // packets forwarded to/from the origin inside XDP
+    STAT_SYNCOOKIES_SENT,
+    STAT_SYNCOOKIES_PASSED,
+    STAT_SYNCOOKIES_FAILED,
+    STAT_ATTACK_NEW_FLOWS_DROPPED,  // new flows over the cap while under attack
+    STAT_EVENTS_LOST,               // events not reported because map_events was full
+    STAT_STAGE_MISSING,             // tail calls into an empty map_stages slot
+    STAT_MAX
+};
+
+// Control socket of the running loader (SOCK_SEQPACKET). A request is one
+// message: a ctl_header and count records of the op's type, applied in
+// order until one fails. The reply is a ctl_reply and its records.
+#define CONTROL_SOCK_PATH "/run/cloudnordsp-loader.sock"
+#define CTL_MSG_MAX 65536
+
+enum {
+    CTL_OP_ADD_ENDPOINT = 1,  // struct ctl_endpoint records
+    CTL_OP_REMOVE_ENDPOINT,   // struct ctl_endpoint records, key and prefix_len only
+    CTL_OP_BLACKLIST_ADD,     // struct ctl_blacklist records
+    CTL_OP_BLACKLIST_REMOVE,  // struct ctl_blacklist records, duration ignored
+    CTL_OP_STATS,             // no records; count is the CPU count and the reply
+                              // holds STAT_MAX rows of count per-CPU __u64s
+    CTL_OP_REPLACE_STAGE,     // one struct ctl_stage record
+    CTL_OP_BEGIN,             // no records; hold exact endpoint changes until commit;
+                              // a failed add or remove aborts the transaction
+    CTL_OP_COMMIT,            // no records; publish them in one generation flip
+    CTL_OP_ABORT,             // no records; drop them
+    CTL_OP_HANDOVER,          // no records; from a new loader: quiesce, then exit
+    CTL_OP_MAX
+};
+
+struct ctl_header {
+    __u32 op;
+    __u32 seq;    // echoed in the reply
+    __u32 count;  // records after the header
+    __u32 padding;
+};
+
+struct ctl_reply {
+    __u32 seq;
+    __s32 status;   // 0, or -errno of the record that failed
+    __u32 applied;  // records applied before it
+    __u32 count;    // records after the reply
+};
+
+// The loader assigns endpoint_id; bursts left at 0 default to the rate
+struct ctl_endpoint {
+    struct endpoint_key key;
+    __u32 prefix_len;  // of key.ip as a 128-bit address, 128 for one address
+    struct endpoint_info info;
+};
+
+struct ctl_blacklist {
+    struct blacklist_key key;
+    __u32 padding;
+    __u64 duration_ms;  // 0 blocks until removed
+};
+
+struct ctl_stage {
+    __u32 stage;  // STAGE_*
+    char path[252];  // object file, as the loader sees it
+};
+
+static inline int ip_addr_is_v4(const struct ip_addr *a)
+{
+    return a->w[0] == 0 && a->w[1] == 0 && a->w[2] == IP_ADDR_V4_MAPPED;
+}
+
+static inline void ip_addr_set_v4(struct ip_addr *a, __u32 v4)
+{
+    a->w[0] = 0;
+    a->w[1] = 0;
+    a->w[2] = IP_ADDR_V4_MAPPED;
+    a->w[3] = v4;
+}
+
+// Per-source state (rate limits, blacklist) keys IPv6 sources by their /64,
+// the smallest block routinely assigned to a site, so rotating addresses
+// inside it cannot exhaust the maps or dodge a block
+static inline void ip_addr_source_key(struct ip_addr *a)
+{
+    if (!ip_addr_is_v4(a)) {
+        a->w[2] = 0;
+        a->w[3] = 0;
+    }
+}
+
+// Subnet state (map_subnet_rate) aggregates the source keys of an IPv4 /24
+// or an IPv6 /48, catching floods that rotate through neighbouring
+// addresses with a single entry
+static inline void ip_addr_subnet_key(struct ip_addr *a)
+{
+    if (ip_addr_is_v4(a)) {
+        a->w[3] &= IP_ADDR_V4_SUBNET_MASK;
+    } else {
+        a->w[1] &= IP_ADDR_V6_SUBNET_MASK;
+        a->w[2] = 0;
+        a->w[3] = 0;
+    }
+}
+
+#endif /* __MINECRAFT_PROTECTION_H */
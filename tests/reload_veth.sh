@@ -0,0 +1,90 @@
+#!/bin/bash
+#
+# CloudNordSP XDP Tests - Zero-Loss Reload on a veth Pair
+#
+# Attaches the real loader to one end of a veth pair, pings across it from
+# a network namespace and loads a second loader mid-stream. The swap is a
+# bpf_link_update and the new program reuses the pinned maps, so the ping
+# must lose nothing and a source blacklisted before the reload must stay
+# blocked after it. Requires root; run from the repository root after make.
+
+set -eu
+
+NS=cnsp-reload
+HOST_IF=cnsp-veth0
+PEER_IF=cnsp-veth1
+HOST_IP=10.77.0.1
+PEER_IP=10.77.0.2
+BLOCKED_IP=10.77.0.3
+LOADER=./loader
+XDP_OBJ=./minecraft_protection.o
+LOG=$(mktemp -d)
+
+old_pid=
+new_pid=
+
+cleanup() {
+    [ -n "$new_pid" ] && kill "$new_pid" 2>/dev/null
+    [ -n "$old_pid" ] && kill "$old_pid" 2>/dev/null
+    wait 2>/dev/null
+    $LOADER $HOST_IF unload >/dev/null 2>&1 || true
+    ip link del $HOST_IF 2>/dev/null || true
+    ip netns del $NS 2>/dev/null || true
+    rm -rf "$LOG"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# Start a loader in the background and wait for it to come up
+start_loader() {
+    local out=$1
+    $LOADER $HOST_IF load $XDP_OBJ >"$out" 2>&1 &
+    for _ in $(seq 50); do
+        grep -q "XDP program loaded" "$out" && return 0
+        sleep 0.1
+    done
+    cat "$out" >&2
+    fail "loader did not start"
+}
+
+ip netns add $NS
+ip link add $HOST_IF type veth peer name $PEER_IF
+ip link set $PEER_IF netns $NS
+ip addr add $HOST_IP/24 dev $HOST_IF
+ip link set $HOST_IF up
+ip -n $NS addr add $PEER_IP/24 dev $PEER_IF
+ip -n $NS addr add $BLOCKED_IP/24 dev $PEER_IF
+ip -n $NS link set $PEER_IF up
+ip -n $NS link set lo up
+
+start_loader "$LOG/old"
+old_pid=$!
+$LOADER $HOST_IF blacklist $BLOCKED_IP 0 >/dev/null
+
+ip netns exec $NS ping -q -c 2 -W 1 -I $BLOCKED_IP $HOST_IP >/dev/null &&
+    fail "blacklisted source got through before the reload"
+
+# 2000 pings, 2ms apart, spanning the reload
+ip netns exec $NS ping -q -c 2000 -i 0.002 -W 1 -I $PEER_IP $HOST_IP >"$LOG/ping" &
+ping_pid=$!
+sleep 1
+start_loader "$LOG/new"
+new_pid=$!
+wait $ping_pid || true
+
+wait "$old_pid" 2>/dev/null || true
+old_pid=
+kill -0 "$new_pid" 2>/dev/null || fail "new loader exited"
+
+loss=$(grep -o '[0-9.]*% packet loss' "$LOG/ping")
+echo "reload: $loss"
+[ "$loss" = "0% packet loss" ] || fail "packets lost across the reload"
+
+ip netns exec $NS ping -q -c 2 -W 1 -I $BLOCKED_IP $HOST_IP >/dev/null &&
+    fail "blacklist lost across the reload"
+
+echo "PASS"
@@ -0,0 +1,77 @@
+/*
+ * CloudNordSP XDP Tests - Blacklist Expiry
+ *
+ * Blacklist entries hold an absolute CLOCK_MONOTONIC time in ms, the time
+ * base the datapath reads, so an entry written from user space must expire
+ * exactly when user space expects. The datapath clock is coarse and may lag
+ * by a tick, so timings keep a wide margin.
+ */
+
+#include <unistd.h>
+#include <linux/in.h>
+
+#include "xdp_test.h"
+
+#define SERVER "192.0.2.1"
+
+// Lifetime of the short entry and how long to wait for it to lapse
+#define SHORT_BLOCK_MS 200
+#define SHORT_WAIT_MS 400
+
+static const __u8 raknet_ping[] = {
+    0x01,
+    0, 0, 0, 0, 0, 0, 0, 1,  // client time
+    0x00, 0xff, 0xff, 0x00, 0xfe, 0xfe, 0xfe, 0xfe,
+    0xfd, 0xfd, 0xfd, 0xfd, 0x12, 0x34, 0x56, 0x78,
+    0, 0, 0, 0, 0, 0, 0, 2   // client GUID
+};
+
+static __u32 send_ping(const char *src)
+{
+    struct pkt p;
+    __u32 verdict;
+    
+    pkt_udp4(&p, src, 50000, SERVER, TEST_BEDROCK_PORT, raknet_ping, sizeof(raknet_ping));
+    return run_pkt(&p, &verdict) ? (__u32)-1 : verdict;
+}
+
+int test_expiry(const char *obj_path)
+{
+    struct endpoint_info info;
+    __u32 verdict;
+    
+    if (env_open(obj_path, RATE_LIMIT_SHARED))
+        return -1;
+    endpoint_defaults(&info, 1);
+    CHECK(env_add_endpoint(SERVER, TEST_BEDROCK_PORT, IPPROTO_UDP, &info) == 0,
+          "adding endpoint failed");
+    
+    __u64 now = mono_ms();
+    CHECK(env_blacklist("198.51.100.1", 32, BLACKLIST_FOREVER) == 0 &&
+          env_blacklist("198.51.100.2", 32, now + 60000) == 0 &&
+          env_blacklist("198.51.100.3", 32, now - 1000) == 0 &&
+          env_blacklist("198.51.100.4", 32, now + SHORT_BLOCK_MS) == 0,
+          "blacklisting failed");
+    
+    verdict = send_ping("198.51.100.1");
+    CHECK(verdict == XDP_DROP, "permanent entry verdict %u, want XDP_DROP", verdict);
+    verdict = send_ping("198.51.100.2");
+    CHECK(verdict == XDP_DROP, "entry a minute out verdict %u, want XDP_DROP", verdict);
+    verdict = send_ping("198.51.100.3");
+    CHECK(verdict == XDP_PASS, "entry a second past verdict %u, want XDP_PASS", verdict);
+    verdict = send_ping("198.51.100.4");
+    CHECK(verdict == XDP_DROP, "short entry verdict %u, want XDP_DROP", verdict);
+    
+    usleep(SHORT_WAIT_MS * 1000);
+    
+    verdict = send_ping("198.51.100.4");
+    CHECK(verdict == XDP_PASS, "short entry verdict %u after %d ms, want XDP_PASS",
+          verdict, SHORT_WAIT_MS);
+    verdict = send_ping("198.51.100.1");
+    CHECK(verdict == XDP_DROP, "permanent entry verdict %u later, want XDP_DROP", verdict);
+    verdict = send_ping("198.51.100.2");
+    CHECK(verdict == XDP_DROP, "entry a minute out verdict %u later, want XDP_DROP", verdict);
+    
+    env_close();
+    return 0;
+}
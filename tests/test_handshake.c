@@ -0,0 +1,263 @@
+/*
+ * CloudNordSP XDP Tests - Handshake Validation
+ *
+ * Regression suite for the protocol validators. Both read the L4 payload
+ * at the offset the parser computed, so TCP options must be skipped and
+ * nothing may be read from the Ethernet or IP headers. Java first segments
+ * are sent as stateless ACKs, which pass only when the payload is a
+ * handshake; the Bedrock cases walk the RakNet open connection challenge
+ * through XDP_TX and back.
+ */
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <linux/in.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#include "xdp_test.h"
+
+#define CLIENT "198.51.100.7"
+#define SERVER "192.0.2.1"
+
+// Status handshake, 1.20.4 (protocol 765) to localhost:25565
+static const __u8 java_status[] = {
+    0x10, 0x00, 0xfd, 0x05,
+    0x09, 'l', 'o', 'c', 'a', 'l', 'h', 'o', 's', 't',
+    0x63, 0xdd, 0x01
+};
+
+// Login handshake, 1.21 (protocol 767), followed in the same segment by
+// Login Start for "Steve"
+static const __u8 java_login[] = {
+    0x17, 0x00, 0xff, 0x05,
+    0x10, 'p', 'l', 'a', 'y', '.', 'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'n', 'e', 't',
+    0x63, 0xdd, 0x02,
+    0x17, 0x00, 0x05, 'S', 't', 'e', 'v', 'e',
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+// Snapshot protocol numbers carry bit 30
+static const __u8 java_snapshot[] = {
+    0x13, 0x00, 0xb0, 0x81, 0x80, 0x80, 0x04,
+    0x09, 'l', 'o', 'c', 'a', 'l', 'h', 'o', 's', 't',
+    0x63, 0xdd, 0x01
+};
+
+// Pre-1.7 server list ping
+static const __u8 java_legacy_ping[] = {0xfe, 0x01, 0xfa};
+
+static const __u8 java_http[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+static const __u8 java_bad_state[] = {
+    0x10, 0x00, 0xfd, 0x05,
+    0x09, 'l', 'o', 'c', 'a', 'l', 'h', 'o', 's', 't',
+    0x63, 0xdd, 0x05
+};
+
+static const __u8 java_old_protocol[] = {
+    0x0f, 0x00, 0x02,
+    0x09, 'l', 'o', 'c', 'a', 'l', 'h', 'o', 's', 't',
+    0x63, 0xdd, 0x01
+};
+
+static const __u8 java_empty_host[] = {0x06, 0x00, 0xfd, 0x05, 0x00, 0x63, 0xdd, 0x01};
+
+static const __u8 java_wrong_id[] = {
+    0x10, 0x01, 0xfd, 0x05,
+    0x09, 'l', 'o', 'c', 'a', 'l', 'h', 'o', 's', 't',
+    0x63, 0xdd, 0x01
+};
+
+// NOP, NOP, timestamp: what Linux clients put on every segment
+static const __u8 tcp_timestamp_opt[] = {
+    0x01, 0x01, 0x08, 0x0a, 0x00, 0x01, 0x02, 0x03, 0x00, 0x04, 0x05, 0x06
+};
+
+struct java_case {
+    const char *name;
+    const __u8 *payload;
+    __u32 len;
+    __u32 verdict;
+};
+
+static const struct java_case java_cases[] = {
+    {"status handshake", java_status, sizeof(java_status), XDP_PASS},
+    {"login handshake", java_login, sizeof(java_login), XDP_PASS},
+    {"snapshot handshake", java_snapshot, sizeof(java_snapshot), XDP_PASS},
+    {"legacy ping", java_legacy_ping, sizeof(java_legacy_ping), XDP_PASS},
+    {"handshake cut after the host", java_status, 14, XDP_PASS},
+    {"HTTP request", java_http, sizeof(java_http) - 1, XDP_DROP},
+    {"next state 5", java_bad_state, sizeof(java_bad_state), XDP_DROP},
+    {"protocol 2", java_old_protocol, sizeof(java_old_protocol), XDP_DROP},
+    {"empty host", java_empty_host, sizeof(java_empty_host), XDP_DROP},
+    {"packet id 1", java_wrong_id, sizeof(java_wrong_id), XDP_DROP},
+};
+
+#define JAVA_CASES (sizeof(java_cases) / sizeof(java_cases[0]))
+
+// Turn the first opt_len payload bytes of a pkt_tcp4() segment into TCP
+// options, patching the checksum for the new data offset
+static void tcp_take_options(struct pkt *p, __u32 opt_len)
+{
+    __u8 *tcp = p->data + sizeof(struct ethhdr) + sizeof(struct iphdr);
+    __u16 old_word = (tcp[12] << 8) | tcp[13];
+    
+    tcp[12] = ((20 + opt_len) / 4) << 4;
+    __u16 new_word = (tcp[12] << 8) | tcp[13];
+    __u32 sum = (__u16)~((tcp[16] << 8) | tcp[17]);
+    sum += (__u16)~old_word + new_word;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    tcp[16] = (__u16)~sum >> 8;
+    tcp[17] = (__u16)~sum & 0xff;
+}
+
+static int test_java(void)
+{
+    struct pkt p;
+    __u32 verdict;
+    
+    for (__u32 i = 0; i < JAVA_CASES; i++) {
+        const struct java_case *c = &java_cases[i];
+        pkt_tcp4(&p, CLIENT, 40000 + i, SERVER, TEST_JAVA_PORT, TH_ACK | TH_PSH,
+                 1001, 2001, c->payload, c->len);
+        CHECK(run_pkt(&p, &verdict) == 0 && verdict == c->verdict,
+              "%s: verdict %u, want %u", c->name, verdict, c->verdict);
+    }
+    
+    __u8 seg[sizeof(tcp_timestamp_opt) + sizeof(java_status)];
+    memcpy(seg, tcp_timestamp_opt, sizeof(tcp_timestamp_opt));
+    memcpy(seg + sizeof(tcp_timestamp_opt), java_status, sizeof(java_status));
+    pkt_tcp4(&p, CLIENT, 41000, SERVER, TEST_JAVA_PORT, TH_ACK | TH_PSH,
+             1001, 2001, seg, sizeof(seg));
+    tcp_take_options(&p, sizeof(tcp_timestamp_opt));
+    CHECK(run_pkt(&p, &verdict) == 0 && verdict == XDP_PASS,
+          "handshake after TCP options: verdict %u, want XDP_PASS", verdict);
+    return 0;
+}
+
+static const __u8 raknet_magic[] = {
+    0x00, 0xff, 0xff, 0x00, 0xfe, 0xfe, 0xfe, 0xfe,
+    0xfd, 0xfd, 0xfd, 0xfd, 0x12, 0x34, 0x56, 0x78
+};
+
+// UDP payload offset of a pkt_udp4() datagram and of its XDP_TX reply
+#define UDP_PAYLOAD_OFF (sizeof(struct ethhdr) + sizeof(struct iphdr) + sizeof(struct udphdr))
+
+static __u32 send_udp(struct pkt *p, __u16 sport, const void *payload, __u32 len)
+{
+    __u32 verdict;
+    
+    pkt_udp4(p, CLIENT, sport, SERVER, TEST_BEDROCK_PORT, payload, len);
+    return run_pkt(p, &verdict) ? (__u32)-1 : verdict;
+}
+
+// OPEN_CONNECTION_REQUEST_2 echoing cookie: id, magic, cookie, no client
+// challenge, server address 192.0.2.1:19132, MTU 1400, client GUID
+static __u32 build_ocr2(__u8 *msg, __u32 cookie)
+{
+    __u32 n = 0;
+    
+    msg[n++] = 0x07;
+    memcpy(msg + n, raknet_magic, sizeof(raknet_magic));
+    n += sizeof(raknet_magic);
+    msg[n++] = cookie >> 24;
+    msg[n++] = cookie >> 16;
+    msg[n++] = cookie >> 8;
+    msg[n++] = cookie;
+    msg[n++] = 0;
+    const __u8 tail[] = {
+        0x04, 0x3f, 0xff, 0xfd, 0xfe, 0x4a, 0xbc,
+        0x05, 0x78,
+        0, 0, 0, 0, 0, 0, 0, 2
+    };
+    memcpy(msg + n, tail, sizeof(tail));
+    return n + sizeof(tail);
+}
+
+static int test_bedrock(void)
+{
+    struct pkt p;
+    __u8 msg[128];
+    __u32 verdict;
+    
+    __u8 ping[1 + 8 + sizeof(raknet_magic) + 8] = {0x01, 0, 0, 0, 0, 0, 0, 0, 1};
+    memcpy(ping + 9, raknet_magic, sizeof(raknet_magic));
+    ping[sizeof(ping) - 1] = 2;
+    verdict = send_udp(&p, 50000, ping, sizeof(ping));
+    CHECK(verdict == XDP_PASS, "ping: verdict %u, want XDP_PASS", verdict);
+    
+    // A ping opens no session, so connected traffic still needs the challenge
+    const __u8 frame_set[] = {0x84, 0x00, 0x00, 0x00, 0x40, 0x00, 0x08, 0x13};
+    verdict = send_udp(&p, 50000, frame_set, sizeof(frame_set));
+    CHECK(verdict == XDP_DROP, "frame set after ping: verdict %u, want XDP_DROP", verdict);
+    
+    // Unconnected pong is only ever sent by a server
+    const __u8 pong[] = {0x1c, 0, 0, 0, 0, 0, 0, 0, 1};
+    verdict = send_udp(&p, 50001, pong, sizeof(pong));
+    CHECK(verdict == XDP_DROP, "server-only id: verdict %u, want XDP_DROP", verdict);
+    
+    // OPEN_CONNECTION_REQUEST_1: id, magic, protocol 11, MTU padding
+    memset(msg, 0, sizeof(msg));
+    msg[0] = 0x05;
+    memcpy(msg + 1, raknet_magic, sizeof(raknet_magic));
+    msg[17] = 11;
+    verdict = send_udp(&p, 50000, msg, sizeof(msg));
+    CHECK(verdict == XDP_TX, "request 1: verdict %u, want XDP_TX", verdict);
+    const __u8 *reply = p.data + UDP_PAYLOAD_OFF;
+    const struct udphdr *udp = (const void *)(p.data + UDP_PAYLOAD_OFF - sizeof(*udp));
+    CHECK(p.len >= UDP_PAYLOAD_OFF + 32 && reply[0] == 0x06 && reply[25] == 1 &&
+          ntohs(udp->dest) == 50000 && ntohs(udp->source) == TEST_BEDROCK_PORT,
+          "request 1: reply is not a secured OPEN_CONNECTION_REPLY_1");
+    CHECK(memcmp(reply + 1, raknet_magic, sizeof(raknet_magic)) == 0,
+          "request 1: reply lacks the offline magic");
+    __u32 cookie = ((__u32)reply[26] << 24) | (reply[27] << 16) | (reply[28] << 8) | reply[29];
+    
+    __u64 failed = stat_total(STAT_BLOCKED_CHALLENGE_FAILED);
+    __u32 len = build_ocr2(msg, cookie ^ 1);
+    verdict = send_udp(&p, 50000, msg, len);
+    CHECK(verdict == XDP_DROP, "request 2 with a bad cookie: verdict %u, want XDP_DROP",
+          verdict);
+    CHECK(stat_total(STAT_BLOCKED_CHALLENGE_FAILED) == failed + 1,
+          "bad cookie not counted as a failed challenge");
+    
+    // The cookie is bound to the flow
+    len = build_ocr2(msg, cookie);
+    verdict = send_udp(&p, 50002, msg, len);
+    CHECK(verdict == XDP_DROP, "request 2 from another port: verdict %u, want XDP_DROP",
+          verdict);
+    
+    __u64 passed = stat_total(STAT_UDP_CHALLENGES_PASSED);
+    verdict = send_udp(&p, 50000, msg, len);
+    CHECK(verdict == XDP_PASS, "request 2: verdict %u, want XDP_PASS", verdict);
+    CHECK(stat_total(STAT_UDP_CHALLENGES_PASSED) == passed + 1,
+          "request 2 not counted as a passed challenge");
+    CHECK(p.len == UDP_PAYLOAD_OFF + len - 5 && p.data[UDP_PAYLOAD_OFF] == 0x07 &&
+          memcmp(p.data + UDP_PAYLOAD_OFF + 17, msg + 22, len - 22) == 0,
+          "request 2 reached the origin with the cookie still in it");
+    
+    verdict = send_udp(&p, 50000, frame_set, sizeof(frame_set));
+    CHECK(verdict == XDP_PASS, "frame set after the challenge: verdict %u, want XDP_PASS",
+          verdict);
+    return 0;
+}
+
+int test_handshake(const char *obj_path)
+{
+    struct endpoint_info info;
+    
+    if (env_open(obj_path, RATE_LIMIT_SHARED))
+        return -1;
+    endpoint_defaults(&info, 0);
+    CHECK(env_add_endpoint(SERVER, TEST_JAVA_PORT, IPPROTO_TCP, &info) == 0,
+          "adding Java endpoint failed");
+    endpoint_defaults(&info, 1);
+    CHECK(env_add_endpoint(SERVER, TEST_BEDROCK_PORT, IPPROTO_UDP, &info) == 0,
+          "adding Bedrock endpoint failed");
+    
+    int err = test_java() || test_bedrock();
+    env_close();
+    return err ? -1 : 0;
+}
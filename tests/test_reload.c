@@ -0,0 +1,111 @@
+/*
+ * CloudNordSP XDP Tests - Reload
+ *
+ * A loader upgrade swaps the program but reuses the pinned state maps, so
+ * what the old program learned must keep applying to the new one: the
+ * blacklist, the rate buckets and established conntrack entries. Each check
+ * builds the state, reloads with env_reload() and sends a packet whose
+ * verdict depends on that state surviving.
+ */
+
+#include <string.h>
+#include <linux/in.h>
+
+#include "xdp_test.h"
+
+#define CLIENT "198.51.100.7"
+#define SERVER "192.0.2.1"
+
+static const __u8 raknet_ping[] = {
+    0x01,
+    0, 0, 0, 0, 0, 0, 0, 1,  // client time
+    0x00, 0xff, 0xff, 0x00, 0xfe, 0xfe, 0xfe, 0xfe,
+    0xfd, 0xfd, 0xfd, 0xfd, 0x12, 0x34, 0x56, 0x78,
+    0, 0, 0, 0, 0, 0, 0, 2   // client GUID
+};
+
+// Status handshake: protocol 765, "localhost":25565, next state 1
+static const __u8 java_handshake[] = {
+    16, 0x00, 0xfd, 0x05,
+    9, 'l', 'o', 'c', 'a', 'l', 'h', 'o', 's', 't',
+    0x63, 0xdd, 0x01
+};
+
+// Not a handshake, so only an established flow may send it
+static const __u8 java_data[] = {0x01, 0x00};
+
+static __u32 send_ping(__u16 sport)
+{
+    struct pkt p;
+    __u32 verdict;
+    
+    pkt_udp4(&p, CLIENT, sport, SERVER, TEST_BEDROCK_PORT, raknet_ping, sizeof(raknet_ping));
+    return run_pkt(&p, &verdict) ? (__u32)-1 : verdict;
+}
+
+static __u32 send_java(__u8 flags, const void *payload, __u32 len)
+{
+    struct pkt p;
+    __u32 verdict;
+    
+    pkt_tcp4(&p, CLIENT, 40000, SERVER, TEST_JAVA_PORT, flags, 1001, 2001, payload, len);
+    return run_pkt(&p, &verdict) ? (__u32)-1 : verdict;
+}
+
+int test_reload(const char *obj_path)
+{
+    struct endpoint_info info;
+    __u32 verdict;
+    
+    if (env_open(obj_path, RATE_LIMIT_SHARED))
+        return -1;
+    
+    // One ping per second with a burst of 3; the reload takes far less
+    // than the second it would need to refill
+    endpoint_defaults(&info, 1);
+    info.rate_limit = 1;
+    info.burst_limit = 3;
+    CHECK(env_add_endpoint(SERVER, TEST_BEDROCK_PORT, IPPROTO_UDP, &info) == 0,
+          "adding Bedrock endpoint failed");
+    endpoint_defaults(&info, 0);
+    CHECK(env_add_endpoint(SERVER, TEST_JAVA_PORT, IPPROTO_TCP, &info) == 0,
+          "adding Java endpoint failed");
+    
+    for (int i = 0; i < 3; i++) {
+        verdict = send_ping(50000);
+        CHECK(verdict == XDP_PASS, "ping %d verdict %u, want XDP_PASS", i, verdict);
+    }
+    
+    verdict = send_java(TH_SYN, NULL, 0);
+    CHECK(verdict == XDP_PASS, "SYN verdict %u, want XDP_PASS", verdict);
+    verdict = send_java(TH_ACK | TH_PSH, java_handshake, sizeof(java_handshake));
+    CHECK(verdict == XDP_PASS, "handshake verdict %u, want XDP_PASS", verdict);
+    
+    CHECK(env_blacklist("203.0.113.0", 24, BLACKLIST_FOREVER) == 0, "blacklisting failed");
+    struct pkt p;
+    pkt_udp4(&p, "203.0.113.9", 50000, SERVER, TEST_BEDROCK_PORT,
+             raknet_ping, sizeof(raknet_ping));
+    CHECK(run_pkt(&p, &verdict) == 0 && verdict == XDP_DROP,
+          "blacklisted verdict %u, want XDP_DROP", verdict);
+    
+    CHECK(env_reload(obj_path) == 0, "reload failed");
+    
+    __u64 blocked = stat_total(STAT_BLOCKED_BLACKLIST);
+    pkt_udp4(&p, "203.0.113.9", 50000, SERVER, TEST_BEDROCK_PORT,
+             raknet_ping, sizeof(raknet_ping));
+    CHECK(run_pkt(&p, &verdict) == 0 && verdict == XDP_DROP,
+          "blacklisted verdict %u after reload, want XDP_DROP", verdict);
+    CHECK(stat_total(STAT_BLOCKED_BLACKLIST) == blocked + 1,
+          "blacklist drop not counted after reload");
+    
+    verdict = send_ping(50000);
+    CHECK(verdict == XDP_DROP, "ping past the burst verdict %u after reload, want XDP_DROP",
+          verdict);
+    
+    verdict = send_java(TH_ACK | TH_PSH, java_data, sizeof(java_data));
+    CHECK(verdict == XDP_PASS, "established data verdict %u after reload, want XDP_PASS",
+          verdict);
+    
+    env_close();
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * CloudNordSP XDP Tests - Multi-CPU Throughput
+ *
+ * One source floods a Bedrock endpoint from every RX queue at once, the
+ * worst case for the shared rate bucket. Worker threads are pinned one per
+ * CPU and each drives BPF_PROG_TEST_RUN, which runs the program on the
+ * calling CPU. Aggregate packets/s is reported per worker count for the
+ * shared and per-CPU rate limiter; per-CPU should scale about linearly.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/in.h>
+
+#include "xdp_test.h"
+
+// Runs per BPF_PROG_TEST_RUN call and calls per worker
+#define BENCH_REPEAT 100000
+#define BENCH_CALLS 20
+
+struct bench_worker {
+    pthread_t thread;
+    int cpu;
+    const struct pkt *p;
+    pthread_barrier_t *start;
+    int err;
+};
+
+static void *bench_worker_run(void *arg)
+{
+    struct bench_worker *w = arg;
+    cpu_set_t set;
+    __u32 verdict;
+    
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    w->err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    pthread_barrier_wait(w->start);
+    for (int i = 0; i < BENCH_CALLS && !w->err; i++)
+        w->err = run_repeat(w->p, BENCH_REPEAT, &verdict, NULL);
+    return NULL;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Aggregate packets/s with workers on CPUs 0..workers-1
+static double bench_pps(const struct pkt *p, int workers)
+{
+    struct bench_worker *w = calloc(workers, sizeof(*w));
+    pthread_barrier_t start;
+    int err = 0;
+    
+    if (!w)
+        return -1;
+    pthread_barrier_init(&start, NULL, workers + 1);
+    for (int i = 0; i < workers; i++) {
+        w[i] = (struct bench_worker){.cpu = i, .p = p, .start = &start};
+        pthread_create(&w[i].thread, NULL, bench_worker_run, &w[i]);
+    }
+    
+    pthread_barrier_wait(&start);
+    double t0 = now_s();
+    for (int i = 0; i < workers; i++) {
+        pthread_join(w[i].thread, NULL);
+        err |= w[i].err;
+    }
+    double elapsed = now_s() - t0;
+    
+    pthread_barrier_destroy(&start);
+    free(w);
+    if (err)
+        return -1;
+    return (double)workers * BENCH_CALLS * BENCH_REPEAT / elapsed;
+}
+
+static const __u8 raknet_ping[] = {
+    0x01,
+    0, 0, 0, 0, 0, 0, 0, 1,  // client time
+    0x00, 0xff, 0xff, 0x00, 0xfe, 0xfe, 0xfe, 0xfe,
+    0xfd, 0xfd, 0xfd, 0xfd, 0x12, 0x34, 0x56, 0x78,
+    0, 0, 0, 0, 0, 0, 0, 2   // client GUID
+};
+
+static int bench_mode(const char *obj_path, __u32 mode, int max_workers)
+{
+    struct endpoint_info info;
+    struct pkt p;
+    __u32 verdict;
+    
+    if (env_open(obj_path, mode))
+        return -1;
+    endpoint_defaults(&info, 1);
+    CHECK(env_add_endpoint("192.0.2.1", TEST_BEDROCK_PORT, IPPROTO_UDP, &info) == 0,
+          "adding endpoint failed");
+    
+    pkt_udp4(&p, "198.51.100.7", 50000, "192.0.2.1", TEST_BEDROCK_PORT,
+             raknet_ping, sizeof(raknet_ping));
+    CHECK(run_pkt(&p, &verdict) == 0 && verdict == XDP_PASS,
+          "ping verdict %u, want XDP_PASS", verdict);
+    pkt_udp4(&p, "198.51.100.7", 50000, "192.0.2.1", TEST_BEDROCK_PORT,
+             raknet_ping, sizeof(raknet_ping));
+    
+    printf("  %-8s workers      Mpps  scaling\n",
+           mode == RATE_LIMIT_PERCPU ? "per-CPU" : "shared");
+    double base = 0;
+    for (int workers = 1; workers <= max_workers; workers *= 2) {
+        double pps = bench_pps(&p, workers);
+        CHECK(pps > 0, "benchmark run failed");
+        if (workers == 1)
+            base = pps;
+        printf("  %16d %9.2f %7.2f\n", workers, pps / 1e6, pps / (base * workers));
+        if (workers < max_workers && workers * 2 > max_workers)
+            workers = max_workers / 2;
+    }
+    env_close();
+    return 0;
+}
+
+int test_throughput(const char *obj_path)
+{
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    if (bench_mode(obj_path, RATE_LIMIT_SHARED, cpus))
+        return -1;
+    return bench_mode(obj_path, RATE_LIMIT_PERCPU, cpus);
+}
@@ -0,0 +1,138 @@
+/*
+ * CloudNordSP XDP Tests - Rate Limiter Trace Replay
+ *
+ * Timestamped traces are replayed through BPF_PROG_TEST_RUN with the
+ * datapath clock pinned to each packet's time (map_test_clock, TEST_CLOCK
+ * builds), so every verdict is exact and the run is deterministic. Times
+ * start 50 days after boot, past where a 32-bit millisecond clock wraps.
+ */
+
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <linux/in.h>
+
+#include "xdp_test.h"
+
+#define SERVER "192.0.2.1"
+
+#define TRACE_BASE_NS (50ULL * 86400 * 1000000000)
+
+// Frame length of the ping below, what the byte budget is charged
+#define PING_FRAME_LEN 75
+
+static const __u8 raknet_ping[] = {
+    0x01,
+    0, 0, 0, 0, 0, 0, 0, 1,  // client time
+    0x00, 0xff, 0xff, 0x00, 0xfe, 0xfe, 0xfe, 0xfe,
+    0xfd, 0xfd, 0xfd, 0xfd, 0x12, 0x34, 0x56, 0x78,
+    0, 0, 0, 0, 0, 0, 0, 2   // client GUID
+};
+
+struct trace_pkt {
+    __u64 t_us;     // since the start of the trace
+    __u8 src;       // source 198.51.100.<src>
+    __u32 verdict;
+};
+
+struct trace {
+    const char *name;
+    __u32 rate, burst;
+    __u32 byte_rate, byte_burst;
+    __u32 subnet_rate, subnet_burst;
+    const struct trace_pkt *pkts;
+    __u32 len;
+};
+
+// 100k pkt/s refills half a packet every 5 us; whole-ms arithmetic
+// would never refill at all
+static const struct trace_pkt sub_ms_refill[] = {
+    {0, 1, XDP_PASS}, {5, 1, XDP_DROP}, {10, 1, XDP_PASS}, {15, 1, XDP_DROP}, {20, 1, XDP_PASS},
+};
+
+static const struct trace_pkt burst_refill[] = {
+    {0, 1, XDP_PASS}, {0, 1, XDP_PASS}, {0, 1, XDP_PASS}, {0, 1, XDP_DROP},
+    {50000, 1, XDP_DROP}, {100000, 1, XDP_PASS}, {100000, 1, XDP_DROP},
+    // 300 ms is three packets, capped at the burst
+    {400000, 1, XDP_PASS}, {400000, 1, XDP_PASS}, {400000, 1, XDP_PASS}, {400000, 1, XDP_DROP},
+};
+
+static const struct trace_pkt per_source[] = {
+    {0, 1, XDP_PASS}, {0, 2, XDP_PASS}, {0, 1, XDP_DROP}, {50000, 2, XDP_DROP},
+    {100000, 1, XDP_PASS}, {100000, 2, XDP_PASS},
+};
+
+// Two frames fill the byte burst; 10 ms at 7500 B/s buys the next one
+static const struct trace_pkt byte_budget[] = {
+    {0, 1, XDP_PASS}, {0, 1, XDP_PASS}, {0, 1, XDP_DROP},
+    {5000, 1, XDP_DROP}, {10000, 1, XDP_PASS}, {10000, 1, XDP_DROP},
+};
+
+// Three idle days refill to the burst and no further
+static const struct trace_pkt idle_gap[] = {
+    {0, 1, XDP_PASS}, {0, 1, XDP_PASS}, {0, 1, XDP_DROP},
+    {259200000000ULL, 1, XDP_PASS}, {259200000000ULL, 1, XDP_PASS},
+    {259200000000ULL, 1, XDP_DROP},
+};
+
+// A source's own drops are not charged to its /24; the subnet's are
+static const struct trace_pkt subnet_tier[] = {
+    {0, 1, XDP_PASS}, {0, 1, XDP_PASS}, {0, 1, XDP_DROP},
+    {0, 2, XDP_PASS}, {0, 3, XDP_DROP}, {100000, 3, XDP_PASS},
+};
+
+#define TRACE(pkts) pkts, sizeof(pkts) / sizeof(pkts[0])
+
+static const struct trace traces[] = {
+    {"sub-ms refill", 100000, 1, 0, 0, 0, 0, TRACE(sub_ms_refill)},
+    {"burst and refill", 10, 3, 0, 0, 0, 0, TRACE(burst_refill)},
+    {"per source", 10, 1, 0, 0, 0, 0, TRACE(per_source)},
+    {"byte budget", 1000000, 1000000, 7500, 2 * PING_FRAME_LEN, 0, 0, TRACE(byte_budget)},
+    {"idle gap", 1, 2, 0, 0, 0, 0, TRACE(idle_gap)},
+    {"subnet tier", 10, 2, 0, 0, 10, 3, TRACE(subnet_tier)},
+};
+
+#define TRACE_COUNT (sizeof(traces) / sizeof(traces[0]))
+
+static int replay(const char *obj_path, const struct trace *t)
+{
+    struct endpoint_info info;
+    char src[INET_ADDRSTRLEN];
+    struct pkt p;
+    __u32 verdict;
+    
+    if (env_open(obj_path, RATE_LIMIT_SHARED))
+        return -1;
+    endpoint_defaults(&info, 1);
+    info.rate_limit = t->rate;
+    info.burst_limit = t->burst;
+    info.byte_rate_limit = t->byte_rate;
+    info.byte_burst_limit = t->byte_burst;
+    info.subnet_rate_limit = t->subnet_rate;
+    info.subnet_burst_limit = t->subnet_burst;
+    CHECK(env_add_endpoint(SERVER, TEST_BEDROCK_PORT, IPPROTO_UDP, &info) == 0,
+          "%s: adding endpoint failed", t->name);
+    
+    for (__u32 i = 0; i < t->len; i++) {
+        const struct trace_pkt *tp = &t->pkts[i];
+        snprintf(src, sizeof(src), "198.51.100.%u", tp->src);
+        pkt_udp4(&p, src, 50000, SERVER, TEST_BEDROCK_PORT, raknet_ping, sizeof(raknet_ping));
+        CHECK(p.len == PING_FRAME_LEN, "%s: ping frame is %u bytes", t->name, p.len);
+        CHECK(env_set_clock(TRACE_BASE_NS + tp->t_us * 1000) == 0,
+              "%s: setting the clock failed", t->name);
+        CHECK(run_pkt(&p, &verdict) == 0 && verdict == tp->verdict,
+              "%s: packet %u (%s at %llu us) verdict %u, want %u", t->name, i, src,
+              (unsigned long long)tp->t_us, verdict, tp->verdict);
+    }
+    
+    env_close();
+    return 0;
+}
+
+int test_trace(const char *obj_path)
+{
+    for (__u32 i = 0; i < TRACE_COUNT; i++) {
+        if (replay(obj_path, &traces[i]))
+            return -1;
+    }
+    return 0;
+}
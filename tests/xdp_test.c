@@ -0,0 +1,457 @@
+/*
+ * CloudNordSP XDP Tests - Runner
+ *
+ * Usage: xdp_test [-o <xdp_file>] [-b] [test...]
+ * Runs the named tests, or every test. Benchmarks only run when named or
+ * with -b, and report numbers rather than pass or fail.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/in.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "xdp_test.h"
+
+struct test_env env;
+
+static const char *const stage_prog_names[STAGE_MAX] = {
+    [STAGE_POLICY] = "xdp_stage_policy",
+    [STAGE_JAVA_TCP] = "xdp_stage_java_tcp",
+    [STAGE_BEDROCK_UDP] = "xdp_stage_bedrock_udp"
+};
+
+struct test_case {
+    const char *name;
+    int (*fn)(const char *obj_path);
+    int bench;  // reports numbers, only run on request
+};
+
+static const struct test_case tests[] = {
+    {"expiry", test_expiry, 0},
+    {"handshake", test_handshake, 0},
+    {"lookup", test_lookup, 1},
+    {"reload", test_reload, 0},
+    {"throughput", test_throughput, 1},
+    {"trace", test_trace, 0},
+};
+
+#define TEST_COUNT (sizeof(tests) / sizeof(tests[0]))
+
+__u64 mono_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (__u64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static __u16 csum_finish(__u32 sum)
+{
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (__u16)~sum;
+}
+
+static __u32 csum_add(__u32 sum, const void *data, __u32 len)
+{
+    const __u8 *p = data;
+    
+    for (__u32 i = 0; i + 1 < len; i += 2)
+        sum += (p[i] << 8) | p[i + 1];
+    if (len & 1)
+        sum += p[len - 1] << 8;
+    return sum;
+}
+
+// Ethernet and IPv4 headers for an l4_len byte transport segment. Returns
+// the transport header.
+static void *pkt_ip4(struct pkt *p, const char *src, const char *dst, __u8 proto, __u32 l4_len)
+{
+    struct ethhdr *eth = (struct ethhdr *)p->data;
+    struct iphdr *ip = (struct iphdr *)(eth + 1);
+    
+    memset(p->data, 0, sizeof(p->data));
+    memcpy(eth->h_dest, "\x02\x00\x00\x00\x00\x01", ETH_ALEN);
+    memcpy(eth->h_source, "\x02\x00\x00\x00\x00\x02", ETH_ALEN);
+    eth->h_proto = htons(ETH_P_IP);
+    
+    ip->version = 4;
+    ip->ihl = 5;
+    ip->tot_len = htons(sizeof(*ip) + l4_len);
+    ip->ttl = 64;
+    ip->protocol = proto;
+    inet_pton(AF_INET, src, &ip->saddr);
+    inet_pton(AF_INET, dst, &ip->daddr);
+    ip->check = htons(csum_finish(csum_add(0, ip, sizeof(*ip))));
+    
+    p->len = sizeof(*eth) + sizeof(*ip) + l4_len;
+    return ip + 1;
+}
+
+static __u32 pseudo_sum(const struct pkt *p, __u8 proto, __u32 l4_len)
+{
+    const struct iphdr *ip = (const struct iphdr *)(p->data + sizeof(struct ethhdr));
+    __u32 sum = csum_add(0, &ip->saddr, 8);
+    return sum + proto + l4_len;
+}
+
+void pkt_udp4(struct pkt *p, const char *src, __u16 sport, const char *dst, __u16 dport,
+              const void *payload, __u32 len)
+{
+    struct udphdr *udp = pkt_ip4(p, src, dst, IPPROTO_UDP, sizeof(*udp) + len);
+    
+    udp->source = htons(sport);
+    udp->dest = htons(dport);
+    udp->len = htons(sizeof(*udp) + len);
+    memcpy(udp + 1, payload, len);
+    
+    __u16 check = csum_finish(csum_add(pseudo_sum(p, IPPROTO_UDP, sizeof(*udp) + len),
+                                       udp, sizeof(*udp) + len));
+    udp->check = htons(check ? check : 0xffff);
+}
+
+void pkt_tcp4(struct pkt *p, const char *src, __u16 sport, const char *dst, __u16 dport,
+              __u8 flags, __u32 seq, __u32 ack_seq, const void *payload, __u32 len)
+{
+    struct tcphdr *tcp = pkt_ip4(p, src, dst, IPPROTO_TCP, sizeof(*tcp) + len);
+    
+    tcp->source = htons(sport);
+    tcp->dest = htons(dport);
+    tcp->seq = htonl(seq);
+    tcp->ack_seq = htonl(ack_seq);
+    tcp->doff = sizeof(*tcp) / 4;
+    ((__u8 *)tcp)[13] = flags;
+    tcp->window = htons(65535);
+    memcpy(tcp + 1, payload, len);
+    tcp->check = htons(csum_finish(csum_add(pseudo_sum(p, IPPROTO_TCP, sizeof(*tcp) + len),
+                                            tcp, sizeof(*tcp) + len)));
+}
+
+int env_map_fd(const char *name)
+{
+    int fd = bpf_object__find_map_fd_by_name(env.obj, name);
+    if (fd < 0)
+        fprintf(stderr, "  map %s not found\n", name);
+    return fd;
+}
+
+// Point map_stages at o's stage programs and return its parse program
+static int install_stages(struct bpf_object *o)
+{
+    struct bpf_program *prog = bpf_object__find_program_by_name(o, "xdp_minecraft_protection");
+    int prog_fd = prog ? bpf_program__fd(prog) : -1;
+    int stages_fd = bpf_object__find_map_fd_by_name(o, "map_stages");
+    
+    if (prog_fd < 0 || stages_fd < 0)
+        return -1;
+    for (__u32 stage = 0; stage < STAGE_MAX; stage++) {
+        prog = bpf_object__find_program_by_name(o, stage_prog_names[stage]);
+        int fd = prog ? bpf_program__fd(prog) : -1;
+        if (fd < 0 || bpf_map_update_elem(stages_fd, &stage, &fd, BPF_ANY)) {
+            fprintf(stderr, "  failed to install stage %s\n", stage_prog_names[stage]);
+            return -1;
+        }
+    }
+    return prog_fd;
+}
+
+int env_open(const char *obj_path, __u32 rate_limit_mode)
+{
+    memset(&env, 0, sizeof(env));
+    env.nr_cpus = libbpf_num_possible_cpus();
+    env.obj = bpf_object__open_file(obj_path, NULL);
+    if (libbpf_get_error(env.obj)) {
+        fprintf(stderr, "  failed to open %s: %s\n", obj_path,
+                strerror(-libbpf_get_error(env.obj)));
+        env.obj = NULL;
+        return -1;
+    }
+    int err = bpf_object__load(env.obj);
+    if (err) {
+        fprintf(stderr, "  failed to load %s: %s\n", obj_path, strerror(-err));
+        env_close();
+        return -1;
+    }
+    
+    env.prog_fd = install_stages(env.obj);
+    int config_fd = env_map_fd("map_config");
+    if (env.prog_fd < 0 || config_fd < 0) {
+        env_close();
+        return -1;
+    }
+    
+    __u32 key = 0;
+    struct dataplane_config config = {
+        .nr_cpus = env.nr_cpus,
+        .rate_limit_mode = rate_limit_mode,
+        .raknet_guid = 0x1122334455667788ULL
+    };
+    if (bpf_map_update_elem(config_fd, &key, &config, BPF_ANY)) {
+        env_close();
+        return -1;
+    }
+    
+    struct cookie_secret secrets[COOKIE_SECRET_MAX] = {
+        {0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL},
+        {0x1716151413121110ULL, 0x1f1e1d1c1b1a1918ULL}
+    };
+    int secrets_fd = env_map_fd("map_cookie_secrets");
+    for (__u32 i = 0; i < COOKIE_SECRET_MAX; i++) {
+        if (secrets_fd < 0 || bpf_map_update_elem(secrets_fd, &i, &secrets[i], BPF_ANY)) {
+            env_close();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void env_close(void)
+{
+    bpf_object__close(env.obj);
+    env.obj = NULL;
+}
+
+int env_reload(const char *obj_path)
+{
+    struct bpf_object *next = bpf_object__open_file(obj_path, NULL);
+    struct bpf_map *map;
+    
+    if (libbpf_get_error(next)) {
+        fprintf(stderr, "  failed to open %s\n", obj_path);
+        return -1;
+    }
+    // The loader's map_is_per_object(): everything else is state
+    bpf_object__for_each_map(map, next) {
+        const char *name = bpf_map__name(map);
+        if (bpf_map__is_internal(map) || strcmp(name, "map_stages") == 0 ||
+            strcmp(name, "map_pkt_ctx") == 0)
+            continue;
+        int fd = bpf_object__find_map_fd_by_name(env.obj, name);
+        if (fd < 0 || bpf_map__reuse_fd(map, fd)) {
+            fprintf(stderr, "  failed to reuse map %s\n", name);
+            bpf_object__close(next);
+            return -1;
+        }
+    }
+    
+    int err = bpf_object__load(next);
+    int prog_fd = err ? -1 : install_stages(next);
+    if (prog_fd < 0) {
+        fprintf(stderr, "  failed to load the reloaded copy of %s\n", obj_path);
+        bpf_object__close(next);
+        return -1;
+    }
+    bpf_object__close(env.obj);
+    env.obj = next;
+    env.prog_fd = prog_fd;
+    return 0;
+}
+
+void endpoint_defaults(struct endpoint_info *info, __u8 protocol_type)
+{
+    memset(info, 0, sizeof(*info));
+    info->rate_limit = 1000000000;
+    info->burst_limit = 1000000000;
+    info->protocol_type = protocol_type;
+}
+
+// Per-endpoint state starts zeroed, as after the loader assigns an id
+static int assign_endpoint_id(struct endpoint_info *info)
+{
+    struct endpoint_counters *counters = calloc(env.nr_cpus, sizeof(*counters));
+    int counters_fd = env_map_fd("map_endpoint_counters");
+    
+    info->endpoint_id = env.next_endpoint_id++;
+    int err = !counters || counters_fd < 0 ||
+              bpf_map_update_elem(counters_fd, &info->endpoint_id, counters, BPF_ANY);
+    free(counters);
+    return err ? -1 : 0;
+}
+
+int env_add_endpoint(const char *ip, __u16 port, __u8 protocol, struct endpoint_info *info)
+{
+    struct endpoint_key key = {
+        .port = port,
+        .protocol = protocol
+    };
+    __u32 v4;
+    
+    if (inet_pton(AF_INET, ip, &v4) != 1)
+        return -1;
+    ip_addr_set_v4(&key.ip, v4);
+    
+    int endpoints_fd = env_map_fd("map_protected_endpoints");
+    return endpoints_fd < 0 || assign_endpoint_id(info) ||
+           bpf_map_update_elem(endpoints_fd, &key, info, BPF_ANY) ? -1 : 0;
+}
+
+int env_add_prefix_endpoint(const char *ip, __u32 prefix_len, __u16 port, __u8 protocol,
+                            struct endpoint_info *info)
+{
+    struct endpoint_prefix_key key = {
+        .prefix_len = ENDPOINT_PREFIX_HDR_BITS + 96 + prefix_len,
+        .port = port,
+        .protocol = protocol
+    };
+    struct dataplane_config config;
+    __u32 zero = 0;
+    __u32 v4;
+    
+    if (inet_pton(AF_INET, ip, &v4) != 1)
+        return -1;
+    ip_addr_set_v4(&key.ip, v4);
+    
+    // The datapath skips the trie while the config says it is empty
+    int prefixes_fd = env_map_fd("map_protected_prefixes");
+    int config_fd = env_map_fd("map_config");
+    if (prefixes_fd < 0 || config_fd < 0 || assign_endpoint_id(info) ||
+        bpf_map_update_elem(prefixes_fd, &key, info, BPF_NOEXIST) ||
+        bpf_map_lookup_elem(config_fd, &zero, &config))
+        return -1;
+    config.endpoint_prefixes++;
+    return bpf_map_update_elem(config_fd, &zero, &config, BPF_ANY) ? -1 : 0;
+}
+
+int run_pkt(struct pkt *p, __u32 *verdict)
+{
+    __u8 out[PKT_MAX];
+    LIBBPF_OPTS(bpf_test_run_opts, opts,
+        .data_in = p->data,
+        .data_size_in = p->len,
+        .data_out = out,
+        .data_size_out = sizeof(out),
+        .repeat = 1
+    );
+    
+    if (bpf_prog_test_run_opts(env.prog_fd, &opts)) {
+        fprintf(stderr, "  BPF_PROG_TEST_RUN failed: %s\n", strerror(errno));
+        return -1;
+    }
+    *verdict = opts.retval;
+    memcpy(p->data, out, opts.data_size_out);
+    p->len = opts.data_size_out;
+    return 0;
+}
+
+int run_repeat(const struct pkt *p, __u32 repeat, __u32 *verdict, __u32 *duration_ns)
+{
+    LIBBPF_OPTS(bpf_test_run_opts, opts,
+        .data_in = p->data,
+        .data_size_in = p->len,
+        .repeat = repeat
+    );
+    
+    if (bpf_prog_test_run_opts(env.prog_fd, &opts)) {
+        fprintf(stderr, "  BPF_PROG_TEST_RUN failed: %s\n", strerror(errno));
+        return -1;
+    }
+    *verdict = opts.retval;
+    if (duration_ns)
+        *duration_ns = opts.duration;
+    return 0;
+}
+
+int env_blacklist(const char *ip, __u32 prefix_len, __u64 until_ms)
+{
+    struct blacklist_key key = {
+        .prefix_len = 96 + prefix_len
+    };
+    __u32 v4;
+    
+    if (inet_pton(AF_INET, ip, &v4) != 1)
+        return -1;
+    ip_addr_set_v4(&key.ip, v4);
+    int fd = env_map_fd("map_blacklist");
+    return fd < 0 || bpf_map_update_elem(fd, &key, &until_ms, BPF_ANY) ? -1 : 0;
+}
+
+int env_set_clock(__u64 now_ns)
+{
+    __u32 zero = 0;
+    int fd = bpf_object__find_map_fd_by_name(env.obj, "map_test_clock");
+    
+    if (fd < 0) {
+        fprintf(stderr, "  object has no map_test_clock, build it with -DTEST_CLOCK\n");
+        return -1;
+    }
+    return bpf_map_update_elem(fd, &zero, &now_ns, BPF_ANY) ? -1 : 0;
+}
+
+__u64 stat_total(__u32 stat)
+{
+    int fd = env_map_fd("map_stats");
+    __u64 *values = calloc(env.nr_cpus, sizeof(*values));
+    __u64 total = 0;
+    
+    if (values && fd >= 0 && bpf_map_lookup_elem(fd, &stat, values) == 0) {
+        for (int cpu = 0; cpu < env.nr_cpus; cpu++)
+            total += values[cpu];
+    }
+    free(values);
+    return total;
+}
+
+static int should_run(const struct test_case *t, int argc, char **argv, int first, int benches)
+{
+    if (first == argc)
+        return !t->bench || benches;
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], t->name) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *obj_path = "minecraft_protection.o";
+    int benches = 0, opt;
+    
+    while ((opt = getopt(argc, argv, "o:b")) != -1) {
+        switch (opt) {
+        case 'o':
+            obj_path = optarg;
+            break;
+        case 'b':
+            benches = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-o <xdp_file>] [-b] [test...]\n", argv[0]);
+            return 2;
+        }
+    }
+    
+    struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+    setrlimit(RLIMIT_MEMLOCK, &r);
+    
+    int run = 0, failed = 0;
+    for (size_t i = 0; i < TEST_COUNT; i++) {
+        if (!should_run(&tests[i], argc, argv, optind, benches))
+            continue;
+        printf("%s\n", tests[i].name);
+        fflush(stdout);
+        int err = tests[i].fn(obj_path);
+        env_close();
+        printf("%s %s\n", err ? "FAIL" : "ok  ", tests[i].name);
+        run++;
+        failed += err != 0;
+    }
+    
+    if (run == 0) {
+        fprintf(stderr, "No matching tests\n");
+        return 2;
+    }
+    printf("%d of %d passed\n", run - failed, run);
+    return failed ? 1 : 0;
+}
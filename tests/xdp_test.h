@@ -0,0 +1,110 @@
+/*
+ * CloudNordSP XDP Tests - Shared Helpers
+ *
+ * Tests load minecraft_protection.o into the kernel without attaching it
+ * and drive the pipeline with BPF_PROG_TEST_RUN. Each test opens its own
+ * copy of the object, so no state leaks from one test into the next.
+ * Requires root.
+ */
+
+#ifndef __XDP_TEST_H
+#define __XDP_TEST_H
+
+#include <stdio.h>
+#include <linux/types.h>
+#include <linux/bpf.h>
+
+#include "../minecraft_protection.h"
+
+#define PKT_MAX 2048
+
+// Bedrock and Java ports used by the test endpoints
+#define TEST_BEDROCK_PORT 19132
+#define TEST_JAVA_PORT 25565
+
+struct test_env {
+    struct bpf_object *obj;
+    int prog_fd;  // parse stage, the program a NIC would run
+    int nr_cpus;  // possible CPUs, the length of per-CPU map values
+    __u32 next_endpoint_id;
+};
+
+extern struct test_env env;
+
+struct pkt {
+    __u8 data[PKT_MAX];
+    __u32 len;
+};
+
+// TCP flags for pkt_tcp4()
+#define TH_FIN 0x01
+#define TH_SYN 0x02
+#define TH_RST 0x04
+#define TH_PSH 0x08
+#define TH_ACK 0x10
+
+// IPv4 packet builders. Addresses are dotted quads, ports host order.
+void pkt_udp4(struct pkt *p, const char *src, __u16 sport, const char *dst, __u16 dport,
+              const void *payload, __u32 len);
+void pkt_tcp4(struct pkt *p, const char *src, __u16 sport, const char *dst, __u16 dport,
+              __u8 flags, __u32 seq, __u32 ack_seq, const void *payload, __u32 len);
+
+// Open and load a fresh copy of the object with every stage installed
+int env_open(const char *obj_path, __u32 rate_limit_mode);
+void env_close(void);
+int env_map_fd(const char *name);
+
+// Replace the program with a fresh copy of obj_path that reuses every state
+// map, as a loader upgrade does with the pinned maps
+int env_reload(const char *obj_path);
+
+// Install an exact endpoint, assigning its id and per-endpoint state the
+// way the loader does. info->endpoint_id is filled in.
+int env_add_endpoint(const char *ip, __u16 port, __u8 protocol, struct endpoint_info *info);
+
+// The same for a whole IPv4 prefix, in the LPM tier
+int env_add_prefix_endpoint(const char *ip, __u32 prefix_len, __u16 port, __u8 protocol,
+                            struct endpoint_info *info);
+
+// Blacklist an IPv4 prefix until the CLOCK_MONOTONIC time until_ms
+// (BLACKLIST_FOREVER for no expiry)
+int env_blacklist(const char *ip, __u32 prefix_len, __u64 until_ms);
+
+// Pin the datapath clock to now_ns (0 returns it to the real clock). Needs
+// an object built with -DTEST_CLOCK.
+int env_set_clock(__u64 now_ns);
+
+// A permissive endpoint: limits far above anything a test sends
+void endpoint_defaults(struct endpoint_info *info, __u8 protocol_type);
+
+// Run p through the pipeline once. p is replaced by the packet as the
+// program left it (a reply for XDP_TX).
+int run_pkt(struct pkt *p, __u32 *verdict);
+
+// Run p repeat times in one syscall; duration is the kernel's per-run average
+int run_repeat(const struct pkt *p, __u32 repeat, __u32 *verdict, __u32 *duration_ns);
+
+__u64 stat_total(__u32 stat);
+
+// CLOCK_MONOTONIC, the datapath's time base
+__u64 mono_ms(void);
+
+#define CHECK(cond, ...)                                                 \
+    do {                                                                 \
+        if (!(cond)) {                                                   \
+            fprintf(stderr, "  %s:%d: ", __FILE__, __LINE__);            \
+            fprintf(stderr, __VA_ARGS__);                                \
+            fputc('\n', stderr);                                         \
+            return -1;                                                   \
+        }                                                                \
+    } while (0)
+
+// Test cases, one per file. They return 0 on success.
+int test_expiry(const char *obj_path);
+int test_handshake(const char *obj_path);
+int test_lookup(const char *obj_path);
+int test_reload(const char *obj_path);
+int test_throughput(const char *obj_path);
+int test_trace(const char *obj_path);
+
+#endif /* __XDP_TEST_H */
@@ -0,0 +1,383 @@
+/*
+ * CloudNordSP AF_XDP Consumer
+ *
+ * Binds an AF_XDP socket to one RX queue, registers it in the XDP
+ * program's XSKMAP and hands every clean Bedrock datagram the program
+ * redirects to it over to the user-space proxy. Frames land in a UMEM
+ * shared with the driver, so nothing passes through the kernel stack.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_xdp.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <netinet/in.h>
+#include <bpf/bpf.h>
+
+#include "minecraft_protection.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define RING_SIZE 2048
+#define NUM_FRAMES RING_SIZE  // RX only: every frame is either filled or being read
+#define FRAME_SIZE 2048
+#define RX_BATCH 64
+
+#define DEFAULT_PROXY_SOCKET "/run/cloudnordsp/xsk.sock"
+
+// Datagram header prepended to each payload sent to the proxy.
+// Addresses are IPv6 (IPv4-mapped for IPv4), ports in network byte order.
+struct xsk_frame_hdr {
+    __u8 version;
+    __u8 protocol;
+    __u16 src_port;
+    __u16 dst_port;
+    __u8 padding[2];
+    __u8 src_addr[16];
+    __u8 dst_addr[16];
+};
+
+#define XSK_FRAME_HDR_VERSION 1
+
+// Producer/consumer ring mapped from the kernel
+struct xsk_ring {
+    __u32 *producer;
+    __u32 *consumer;
+    __u32 *flags;
+    void *desc;
+    __u32 size;
+    void *map;
+    size_t map_len;
+};
+
+static int xsk_fd = -1;
+static int proxy_fd = -1;
+static void *umem_area;
+static struct xsk_ring fill_ring, comp_ring, rx_ring;
+static struct sockaddr_un proxy_addr;
+static volatile sig_atomic_t exiting;
+
+static void handle_signal(int sig)
+{
+    exiting = 1;
+}
+
+static int map_ring(struct xsk_ring *ring, const struct xdp_ring_offset *off,
+                    size_t desc_size, off_t pgoff)
+{
+    ring->size = RING_SIZE;
+    ring->map_len = off->desc + RING_SIZE * desc_size;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, xsk_fd, pgoff);
+    if (ring->map == MAP_FAILED)
+        return -1;
+
+    ring->producer = (__u32 *)((char *)ring->map + off->producer);
+    ring->consumer = (__u32 *)((char *)ring->map + off->consumer);
+    ring->flags = (__u32 *)((char *)ring->map + off->flags);
+    ring->desc = (char *)ring->map + off->desc;
+    return 0;
+}
+
+// Create the UMEM and AF_XDP socket and bind it to ifindex/queue_id
+static int setup_xsk(int ifindex, __u32 queue_id, int force_copy)
+{
+    struct xdp_umem_reg mr = {0};
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp = {0};
+    socklen_t optlen = sizeof(off);
+    int ring_size = RING_SIZE;
+
+    umem_area = mmap(NULL, (size_t)NUM_FRAMES * FRAME_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (umem_area == MAP_FAILED) {
+        fprintf(stderr, "Failed to allocate UMEM: %s\n", strerror(errno));
+        return -1;
+    }
+
+    xsk_fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (xsk_fd < 0) {
+        fprintf(stderr, "Failed to create AF_XDP socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    mr.addr = (__u64)(unsigned long)umem_area;
+    mr.len = (__u64)NUM_FRAMES * FRAME_SIZE;
+    mr.chunk_size = FRAME_SIZE;
+    mr.headroom = 0;
+    if (setsockopt(xsk_fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) ||
+        setsockopt(xsk_fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) ||
+        setsockopt(xsk_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) ||
+        setsockopt(xsk_fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size))) {
+        fprintf(stderr, "Failed to configure UMEM rings: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (getsockopt(xsk_fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen)) {
+        fprintf(stderr, "Failed to get ring offsets: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (map_ring(&fill_ring, &off.fr, sizeof(__u64), XDP_UMEM_PGOFF_FILL_RING) ||
+        map_ring(&comp_ring, &off.cr, sizeof(__u64), XDP_UMEM_PGOFF_COMPLETION_RING) ||
+        map_ring(&rx_ring, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING)) {
+        fprintf(stderr, "Failed to map rings: %s\n", strerror(errno));
+        return -1;
+    }
+
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = queue_id;
+    sxdp.sxdp_flags = (force_copy ? XDP_COPY : XDP_ZEROCOPY) | XDP_USE_NEED_WAKEUP;
+    if (bind(xsk_fd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+        if (force_copy || errno != EOPNOTSUPP) {
+            fprintf(stderr, "Failed to bind AF_XDP socket: %s\n", strerror(errno));
+            return -1;
+        }
+        // Driver lacks zero-copy support, fall back to copy mode
+        sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+        if (bind(xsk_fd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+            fprintf(stderr, "Failed to bind AF_XDP socket: %s\n", strerror(errno));
+            return -1;
+        }
+        printf("Zero-copy unsupported, using copy mode\n");
+    }
+
+    // Hand every frame to the kernel up front
+    __u64 *fill = fill_ring.desc;
+    __u32 prod = *fill_ring.producer;
+    for (__u32 i = 0; i < RING_SIZE; i++)
+        fill[(prod + i) & (RING_SIZE - 1)] = (__u64)i * FRAME_SIZE;
+    __atomic_store_n(fill_ring.producer, prod + RING_SIZE, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+// Pass one redirected frame to the proxy. The XDP program only redirects
+// validated IPv4/UDP, but the headers are re-checked before trusting them.
+static void forward_frame(__u8 *frame, __u32 len)
+{
+    struct ethhdr *eth = (struct ethhdr *)frame;
+    struct xsk_frame_hdr hdr = {
+        .version = XSK_FRAME_HDR_VERSION,
+        .protocol = IPPROTO_UDP
+    };
+    __u32 off = sizeof(*eth);
+    __be16 proto = eth->h_proto;
+
+    if (len < off)
+        return;
+
+    // Trunk ports deliver up to two VLAN tags (802.1Q/QinQ)
+    for (int i = 0; i < 2 && (proto == htons(ETH_P_8021Q) || proto == htons(ETH_P_8021AD)); i++) {
+        if (len < off + 4)
+            return;
+        memcpy(&proto, frame + off + 2, sizeof(proto));
+        off += 4;
+    }
+
+    if (proto == htons(ETH_P_IP)) {
+        struct iphdr *ip = (struct iphdr *)(frame + off);
+        if (len < off + sizeof(*ip))
+            return;
+        __u32 ihl = ip->ihl * 4;
+        if (ip->protocol != IPPROTO_UDP || ihl < sizeof(*ip))
+            return;
+
+        hdr.src_addr[10] = hdr.src_addr[11] = 0xff;
+        hdr.dst_addr[10] = hdr.dst_addr[11] = 0xff;
+        memcpy(&hdr.src_addr[12], &ip->saddr, 4);
+        memcpy(&hdr.dst_addr[12], &ip->daddr, 4);
+        off += ihl;
+    } else if (proto == htons(ETH_P_IPV6)) {
+        struct ipv6hdr *ip6 = (struct ipv6hdr *)(frame + off);
+        if (len < off + sizeof(*ip6))
+            return;
+
+        memcpy(hdr.src_addr, &ip6->saddr, sizeof(hdr.src_addr));
+        memcpy(hdr.dst_addr, &ip6->daddr, sizeof(hdr.dst_addr));
+        off += sizeof(*ip6);
+
+        // The XDP program has already bounded the extension header chain
+        __u8 nexthdr = ip6->nexthdr;
+        while (nexthdr != IPPROTO_UDP) {
+            if (len < off + 8)
+                return;
+            __u8 *ext = frame + off;
+            switch (nexthdr) {
+            case IPPROTO_HOPOPTS:
+            case IPPROTO_ROUTING:
+            case IPPROTO_DSTOPTS:
+                off += (ext[1] + 1) * 8;
+                break;
+            case IPPROTO_FRAGMENT:
+                off += 8;
+                break;
+            case IPPROTO_AH:
+                off += (ext[1] + 2) * 4;
+                break;
+            default:
+                return;
+            }
+            nexthdr = ext[0];
+        }
+    } else {
+        return;
+    }
+
+    if (len < off + sizeof(struct udphdr))
+        return;
+
+    struct udphdr *udp = (struct udphdr *)(frame + off);
+    __u8 *payload = (__u8 *)(udp + 1);
+    __u32 payload_len = len - (payload - frame);
+    __u32 udp_len = ntohs(udp->len);
+
+    // Short frames may carry Ethernet padding past the datagram
+    if (udp_len < sizeof(*udp))
+        return;
+    if (udp_len - sizeof(*udp) < payload_len)
+        payload_len = udp_len - sizeof(*udp);
+
+    hdr.src_port = udp->source;
+    hdr.dst_port = udp->dest;
+
+    struct iovec iov[2] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = payload, .iov_len = payload_len }
+    };
+    struct msghdr msg = {
+        .msg_name = &proxy_addr,
+        .msg_namelen = sizeof(proxy_addr),
+        .msg_iov = iov,
+        .msg_iovlen = 2
+    };
+
+    // Best effort: a slow proxy drops datagrams rather than stalling the ring
+    sendmsg(proxy_fd, &msg, MSG_DONTWAIT);
+}
+
+// Drain up to RX_BATCH descriptors and recycle their frames to the fill ring
+static __u32 process_rx(void)
+{
+    __u32 cons = *rx_ring.consumer;
+    __u32 prod = __atomic_load_n(rx_ring.producer, __ATOMIC_ACQUIRE);
+    __u32 avail = prod - cons;
+
+    if (avail == 0)
+        return 0;
+    if (avail > RX_BATCH)
+        avail = RX_BATCH;
+
+    struct xdp_desc *descs = rx_ring.desc;
+    __u64 *fill = fill_ring.desc;
+    __u32 fill_prod = *fill_ring.producer;
+
+    for (__u32 i = 0; i < avail; i++) {
+        struct xdp_desc *desc = &descs[(cons + i) & (RING_SIZE - 1)];
+        forward_frame((__u8 *)umem_area + desc->addr, desc->len);
+        fill[(fill_prod + i) & (RING_SIZE - 1)] = desc->addr & ~((__u64)FRAME_SIZE - 1);
+    }
+
+    __atomic_store_n(rx_ring.consumer, cons + avail, __ATOMIC_RELEASE);
+    __atomic_store_n(fill_ring.producer, fill_prod + avail, __ATOMIC_RELEASE);
+
+    if (*fill_ring.flags & XDP_RING_NEED_WAKEUP)
+        recvfrom(xsk_fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+
+    return avail;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *socket_path = DEFAULT_PROXY_SOCKET;
+    int force_copy = 0;
+
+    if (argc < 3) {
+        printf("Usage: %s <interface> <queue_id> [--proxy-socket <path>] [--copy]\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--proxy-socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--copy") == 0) {
+            force_copy = 1;
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    const char *ifname = argv[1];
+    __u32 queue_id = strtoul(argv[2], NULL, 10);
+    int ifindex = if_nametoindex(ifname);
+    if (ifindex == 0) {
+        fprintf(stderr, "Failed to get interface index for %s\n", ifname);
+        return 1;
+    }
+    if (queue_id >= XSK_MAX_QUEUES) {
+        fprintf(stderr, "Queue %u exceeds XSKMAP size %d\n", queue_id, XSK_MAX_QUEUES);
+        return 1;
+    }
+
+    int xsks_fd = bpf_obj_get(XSKMAP_PIN_PATH);
+    if (xsks_fd < 0) {
+        fprintf(stderr, "Failed to open %s (is the loader running?): %s\n",
+                XSKMAP_PIN_PATH, strerror(errno));
+        return 1;
+    }
+
+    proxy_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (proxy_fd < 0) {
+        fprintf(stderr, "Failed to create proxy socket: %s\n", strerror(errno));
+        return 1;
+    }
+    proxy_addr.sun_family = AF_UNIX;
+    strncpy(proxy_addr.sun_path, socket_path, sizeof(proxy_addr.sun_path) - 1);
+
+    if (setup_xsk(ifindex, queue_id, force_copy) < 0)
+        return 1;
+
+    if (bpf_map_update_elem(xsks_fd, &queue_id, &xsk_fd, BPF_ANY)) {
+        fprintf(stderr, "Failed to register socket in XSKMAP: %s\n", strerror(errno));
+        return 1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    printf("AF_XDP consumer bound to %s queue %u, forwarding to %s\n",
+           ifname, queue_id, socket_path);
+
+    struct pollfd pfd = { .fd = xsk_fd, .events = POLLIN };
+    while (!exiting) {
+        if (process_rx() > 0)
+            continue;
+        poll(&pfd, 1, 1000);
+    }
+
+    // Unregister first so the program falls back to XDP_PASS for this queue
+    bpf_map_delete_elem(xsks_fd, &queue_id);
+    close(xsk_fd);
+    close(proxy_fd);
+    return 0;
+}